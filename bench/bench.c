@@ -0,0 +1,1110 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "calib.h"
+#include "channel.h"
+#include "cpu.h"
+#include "freq.h"
+#include "ladder.h"
+#include "sim.h"
+
+/// Commit the benchmark was built from, which the Makefile passes in
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+/// Timed calls of each primitive per trial unless `--reps` says otherwise
+#define BENCH_DEFAULT_REPS 10000
+
+/// Trials of everything unless `--trials` says otherwise, and the most there
+/// can be
+#define BENCH_DEFAULT_TRIALS 15
+#define BENCH_MAX_TRIALS 64
+
+/// Frames sent through the loopback channel per trial unless `--frames`
+/// says otherwise, and the payload of each
+#define BENCH_DEFAULT_FRAMES 8
+#define BENCH_PAYLOAD 16
+
+/// Seconds the receiver waits for each frame, far shorter than the default
+/// so that a channel that drops every frame does not stall the benchmark
+#define BENCH_CHANNEL_TIMEOUT 1
+
+/// Seed of the payloads, fixed so that every run sends the same bits
+#define BENCH_SEED 0x5851f42d4c957f2dULL
+
+/// Untimed calls before the timed ones, in multiples of 1/8 of `reps`, to
+/// settle the code and the branch predictors
+#define BENCH_WARMUP_EIGHTHS 1
+
+/// Empty timings the cost of the timestamps themselves is taken from
+#define BENCH_OVERHEAD_SAMPLES 10000
+
+/// Smallest change from the baseline mean worth flagging, however
+/// significant: this fraction of the mean, or this many times the half widths
+/// of the confidence intervals of the baseline and the run together if that
+/// is wider. Medians of a few thousand samples move by a tick or two between
+/// otherwise identical runs, which many trials would call significant, and
+/// by far more on a noisy host, whose wider intervals show it.
+#define BENCH_MIN_EFFECT 0.05
+#define BENCH_MIN_EFFECT_CI 2.0
+
+/// Longest baseline file read
+#define BENCH_JSON_MAX (1 << 20)
+
+/**
+ * A primitive under test: `setup` puts the cache in the state it is measured
+ * from, untimed, before each call of `run`, which is timed. Both are given
+ * the same line of the set the benchmark works on, and the set.
+ */
+typedef struct bench_primitive {
+    const char* name;
+    void (*setup)(cache_t* cache, uint8_t* line, size_t setno);
+    void (*run)(cache_t* cache, uint8_t* line, size_t setno);
+} bench_primitive_t;
+
+/**
+ * One figure measured once per trial, and its spread over the trials
+ */
+typedef struct bench_metric {
+    double trials[BENCH_MAX_TRIALS];
+    int ntrials;
+
+    /// Mean over the trials, their sample variance, and the half width of
+    /// the 95% confidence interval of the mean
+    double mean;
+    double variance;
+    double ci95;
+} bench_metric_t;
+
+/**
+ * Cost distribution of one primitive in TSC ticks, less the cost of the
+ * timestamps around it, over the samples of every trial; and the median of
+ * each trial as a metric
+ */
+typedef struct bench_result {
+    uint64_t min;
+    uint64_t median;
+    uint64_t p99;
+    bench_metric_t medians;
+} bench_result_t;
+
+/**
+ * Goodput and bit error rate of frames sent through the loopback channel
+ */
+typedef struct bench_channel {
+    /// Frames per trial, zero if the channel was not measured
+    int frames;
+    uint64_t period;
+
+    /// Payload bits delivered intact per second
+    bench_metric_t bandwidth;
+
+    /// Payload bits wrong or lost over payload bits sent
+    bench_metric_t ber;
+} bench_channel_t;
+
+/**
+ * A metric of the current run next to the one of the same name in the
+ * baseline, and the direction in which it gets worse
+ */
+typedef struct bench_comparison {
+    const char* name;
+    const bench_metric_t* current;
+    bench_metric_t baseline;
+    bool higher_is_worse;
+} bench_comparison_t;
+
+static void bench_fill(cache_t* cache, uint8_t* line, size_t setno)
+{
+    (void)cache;
+    (void)setno;
+    cache_fill(line);
+}
+
+static void bench_flush(cache_t* cache, uint8_t* line, size_t setno)
+{
+    (void)cache;
+    (void)setno;
+    cache_flush(line);
+}
+
+static void bench_fill_set(cache_t* cache, uint8_t* line, size_t setno)
+{
+    (void)line;
+    cache_fill_set(cache, setno);
+}
+
+static void bench_run_clflush(cache_t* cache, uint8_t* line, size_t setno)
+{
+    (void)cache;
+    (void)setno;
+    clflush(line);
+}
+
+static void bench_run_timed_read(cache_t* cache, uint8_t* line, size_t setno)
+{
+    int cpu;
+
+    (void)setno;
+    timed_read(line, cache->timer, &cpu);
+}
+
+static void bench_run_flush_set(cache_t* cache, uint8_t* line, size_t setno)
+{
+    (void)line;
+    cache_flush_set(cache, setno);
+}
+
+static void bench_run_count_hits(cache_t* cache, uint8_t* line, size_t setno)
+{
+    (void)line;
+    cache_count_hits(cache, setno);
+}
+
+/// Each primitive from the state the channel calls it in: flushes and probes
+/// of lines it just brought in, fills of lines that are gone, and primes of a
+/// set it already owns
+static const bench_primitive_t bench_primitives[] = {
+    {"clflush", bench_fill, bench_run_clflush},
+    {"cache_fill", bench_flush, bench_fill},
+    {"timed_read", bench_fill, bench_run_timed_read},
+    {"cache_fill_set", NULL, bench_fill_set},
+    {"cache_flush_set", bench_fill_set, bench_run_flush_set},
+    {"cache_count_hits", bench_fill_set, bench_run_count_hits},
+};
+
+#define BENCH_NPRIMITIVES \
+    (sizeof(bench_primitives) / sizeof(*bench_primitives))
+
+/// Two-sided 95% critical values of Student's t for 1 to 30 degrees of
+/// freedom; the normal value stands in beyond
+static const double bench_t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static double bench_critical(double df)
+{
+    size_t n = sizeof(bench_t95) / sizeof(*bench_t95);
+
+    if (df < 1.0) {
+        return bench_t95[0];
+    }
+
+    return (df > n) ? 1.96 : bench_t95[(size_t)df - 1];
+}
+
+/**
+ * Works out the mean, variance and confidence interval of `metric` from its
+ * trials.
+ */
+static void bench_summarise(bench_metric_t* metric)
+{
+    int n = metric->ntrials;
+    double sum = 0.0;
+    double squares = 0.0;
+
+    metric->mean = 0.0;
+    metric->variance = 0.0;
+    metric->ci95 = 0.0;
+
+    if (n == 0) {
+        return;
+    }
+
+    for (int k = 0; k < n; k++) {
+        sum += metric->trials[k];
+    }
+
+    metric->mean = sum / n;
+
+    if (n < 2) {
+        return;
+    }
+
+    for (int k = 0; k < n; k++) {
+        double d = metric->trials[k] - metric->mean;
+
+        squares += d * d;
+    }
+
+    metric->variance = squares / (n - 1);
+    metric->ci95 = bench_critical(n - 1) * sqrt(metric->variance / n);
+}
+
+/**
+ * Welch's t-test of whether the means of `a` and `b` differ at the 95%
+ * level, which does not assume the two runs are equally noisy. Two runs
+ * without any spread differ if their means do.
+ */
+static bool bench_significant(const bench_metric_t* a,
+                              const bench_metric_t* b)
+{
+    if (a->ntrials < 2 || b->ntrials < 2) {
+        return false;
+    }
+
+    double va = a->variance / a->ntrials;
+    double vb = b->variance / b->ntrials;
+
+    if (va + vb == 0.0) {
+        return a->mean != b->mean;
+    }
+
+    double t = fabs(a->mean - b->mean) / sqrt(va + vb);
+    double df = (va + vb) * (va + vb) /
+                (va * va / (a->ntrials - 1) + vb * vb / (b->ntrials - 1));
+
+    return t > bench_critical(floor(df));
+}
+
+/**
+ * Returns the least time between two back to back timestamps, fenced as in
+ * `bench_measure()`, which every sample is corrected by.
+ */
+static uint64_t bench_overhead(void)
+{
+    uint64_t least = UINT64_MAX;
+
+    for (int k = 0; k < BENCH_OVERHEAD_SAMPLES; k++) {
+        uint64_t t0 = rdtsc_fenced();
+        uint64_t t1 = rdtsc_fenced();
+
+        if (t1 - t0 < least) {
+            least = t1 - t0;
+        }
+    }
+
+    return least;
+}
+
+/**
+ * Times `reps` calls of `prim` on set `setno`, after its setup each, into
+ * `samples`, sorted, and returns the median of the trial.
+ *
+ * Calls take turns over the `cache->assoc` lines of the set, each in its own
+ * page. What a flush or a fill of one line costs depends on where its
+ * physical page landed, which changes from one run to the next, so a single
+ * line would make two runs of the same code differ by tens of percent.
+ *
+ * The timestamps come from `rdtsc_fenced()`: an LFENCE before RDTSC lets a
+ * CLFLUSH, of the setup or of the primitive itself, retire before the line
+ * has left the cache, and lets the primitive start before the first stamp.
+ */
+static uint64_t bench_measure(cache_t* cache, const bench_primitive_t* prim,
+                              size_t setno, size_t reps, uint64_t overhead,
+                              uint64_t* samples)
+{
+    size_t warmup = reps * BENCH_WARMUP_EIGHTHS / 8;
+
+    for (size_t k = 0; k < warmup + reps; k++) {
+        uint8_t* line = cache_line(cache, setno, k % cache->assoc);
+
+        if (prim->setup != NULL) {
+            prim->setup(cache, line, setno);
+        }
+
+        uint64_t t0 = rdtsc_fenced();
+
+        prim->run(cache, line, setno);
+
+        uint64_t t1 = rdtsc_fenced();
+
+        if (k >= warmup) {
+            samples[k - warmup] = (t1 - t0 > overhead) ? t1 - t0 - overhead
+                                                       : 0;
+        }
+    }
+
+    qsort(samples, reps, sizeof(*samples), compare_u64);
+
+    return samples[reps / 2];
+}
+
+/**
+ * Summarises the `n` samples of every trial of a primitive in `result`,
+ * whose trial medians are already filled in.
+ */
+static void bench_distribution(uint64_t* samples, size_t n,
+                               bench_result_t* result)
+{
+    qsort(samples, n, sizeof(*samples), compare_u64);
+
+    result->min = samples[0];
+    result->median = samples[n / 2];
+    result->p99 = samples[(n * 99) / 100];
+    bench_summarise(&result->medians);
+}
+
+static double bench_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Counts the bits of the `len` bytes at `sent` that did not arrive as they
+ * are in `got`, which holds `got_len` bytes or is -1 if the frame was lost.
+ */
+static size_t bench_bit_errors(const uint8_t* sent, size_t len,
+                               const uint8_t* got, int got_len)
+{
+    size_t errors = 0;
+
+    for (size_t k = 0; k < len; k++) {
+        if (got_len < 0 || k >= (size_t)got_len) {
+            errors += 8;
+        } else {
+            errors += __builtin_popcount(sent[k] ^ got[k]);
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * Sends `result->frames` frames of random payload per trial through the
+ * loopback channel over `setno`, as the `loopback` role of covert does, and
+ * records the goodput and bit error rate of each trial. A frame that does not
+ * arrive counts every bit of its payload as wrong, and a trial in which no
+ * bit arrived is the last.
+ *
+ * Returns -1 if the channel or the peer could not be set up.
+ */
+static int bench_channel(cache_t* cache, size_t setno, int trials,
+                         bench_channel_t* result)
+{
+    channel_t channel;
+    cache_t peer;
+    uint64_t rng = BENCH_SEED;
+
+    if (channel_init(&channel, cache, setno) != 0) {
+        return -1;
+    }
+
+    if (cache_init(&peer) != 0) {
+        channel_deinit(&channel);
+        return -1;
+    }
+
+    cache_set_order(&peer, cache->prime_seq, cache->prime_len,
+                    cache->probe_seq);
+    channel.timeout = BENCH_CHANNEL_TIMEOUT;
+    result->period = channel.period;
+
+    for (int trial = 0; trial < trials; trial++) {
+        size_t bits = 0;
+        size_t errors = 0;
+        double start = bench_seconds();
+
+        for (int frame = 0; frame < result->frames; frame++) {
+            uint8_t msg[BENCH_PAYLOAD];
+            uint8_t out[UINT8_MAX];
+
+            for (size_t k = 0; k < sizeof(msg); k++) {
+                msg[k] = (uint8_t)sim_random(&rng);
+            }
+
+            int len = channel_loopback(&channel, &peer, msg, sizeof(msg), out,
+                                       sizeof(out));
+
+            bits += 8 * sizeof(msg);
+            errors += bench_bit_errors(msg, sizeof(msg), out, len);
+        }
+
+        double elapsed = bench_seconds() - start;
+
+        result->bandwidth.trials[trial] = (bits - errors) / elapsed;
+        result->ber.trials[trial] = (double)errors / bits;
+        result->bandwidth.ntrials = trial + 1;
+        result->ber.ntrials = trial + 1;
+
+        // Every frame timing out again would only repeat the same figures
+        if (errors == bits) {
+            break;
+        }
+    }
+
+    bench_summarise(&result->bandwidth);
+    bench_summarise(&result->ber);
+
+    cache_deinit(&peer);
+    channel_deinit(&channel);
+
+    return 0;
+}
+
+/**
+ * Writes `str` to `out` as a JSON string, quotes included.
+ */
+static void bench_json_string(FILE* out, const char* str)
+{
+    fputc('"', out);
+
+    for (const char* p = str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if ((unsigned char)*p < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned char)*p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+
+    fputc('"', out);
+}
+
+/**
+ * Writes the mean, confidence interval and trials of `metric` as the members
+ * of a JSON object, without the braces.
+ */
+static void bench_json_metric(FILE* out, const bench_metric_t* metric)
+{
+    fprintf(out, "\"mean\": %.6g, \"ci95\": %.6g, \"trials\": [",
+            metric->mean, metric->ci95);
+
+    for (int k = 0; k < metric->ntrials; k++) {
+        fprintf(out, "%s%.6g", (k != 0) ? ", " : "", metric->trials[k]);
+    }
+
+    fprintf(out, "]");
+}
+
+/**
+ * Writes the host with the `fingerprint` of its cache hierarchy, as
+ * `ladder_fingerprint()` gives it or empty, the cache geometry and
+ * calibration, and the results to `out` as a single JSON object.
+ */
+static void bench_write_json(FILE* out, const calib_key_t* key,
+                             const char* fingerprint, const cache_t* cache,
+                             size_t setno, size_t reps, uint64_t overhead,
+                             const bench_result_t* results,
+                             const bench_channel_t* channel)
+{
+    char host[256] = "unknown";
+    char date[32] = "unknown";
+    time_t now = time(NULL);
+    struct tm tm;
+
+    gethostname(host, sizeof(host) - 1);
+
+    if (gmtime_r(&now, &tm) != NULL) {
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    }
+
+    fprintf(out, "{\n  \"host\": {\n    \"name\": ");
+    bench_json_string(out, host);
+    fprintf(out, ",\n    \"model\": ");
+    bench_json_string(out, key->model);
+    fprintf(out, ",\n    \"microcode\": ");
+    bench_json_string(out, key->microcode);
+    fprintf(out, ",\n    \"kernel\": ");
+    bench_json_string(out, key->kernel);
+    fprintf(out, ",\n    \"fingerprint\": ");
+    bench_json_string(out, fingerprint);
+    fprintf(out, ",\n    \"cpu\": %d,\n    \"commit\": ", key->cpu);
+    bench_json_string(out, BENCH_COMMIT);
+    fprintf(out, ",\n    \"date\": ");
+    bench_json_string(out, date);
+    fprintf(out, "\n  },\n");
+
+    fprintf(out,
+            "  \"cache\": {\n"
+            "    \"size\": %zu,\n"
+            "    \"assoc\": %zu,\n"
+            "    \"line_size\": %zu,\n"
+            "    \"nsets\": %zu,\n"
+            "    \"policy\": \"%s\",\n"
+            "    \"timer\": \"%s\",\n"
+            "    \"probe\": \"%s\",\n"
+            "    \"hit_latency\": %lu,\n"
+            "    \"miss_latency\": %lu,\n"
+            "    \"noise_floor\": %lu\n"
+            "  },\n",
+            cache->size, cache->assoc, cache->line_size, cache->nsets,
+            cache_policy_names[cache->policy], cache_timer_names[cache->timer],
+            cache_probe_names[cache->probe], cache->hit_latency,
+            cache->miss_latency, cache->noise_floor);
+
+    fprintf(out,
+            "  \"unit\": \"tsc_ticks\",\n"
+            "  \"set\": %zu,\n"
+            "  \"reps\": %zu,\n"
+            "  \"trials\": %d,\n"
+            "  \"overhead\": %lu,\n"
+            "  \"primitives\": {\n",
+            setno, reps, results[0].medians.ntrials, overhead);
+
+    for (size_t k = 0; k < BENCH_NPRIMITIVES; k++) {
+        fprintf(out,
+                "    \"%s\": {\"min\": %lu, \"median\": %lu, \"p99\": %lu, ",
+                bench_primitives[k].name, results[k].min, results[k].median,
+                results[k].p99);
+        bench_json_metric(out, &results[k].medians);
+        fprintf(out, "}%s\n", (k + 1 < BENCH_NPRIMITIVES) ? "," : "");
+    }
+
+    fprintf(out, "  }");
+
+    if (channel->frames != 0) {
+        fprintf(out,
+                ",\n  \"channel\": {\n"
+                "    \"period\": %lu,\n"
+                "    \"frames\": %d,\n"
+                "    \"payload\": %d,\n"
+                "    \"bandwidth\": {",
+                channel->period, channel->frames, BENCH_PAYLOAD);
+        bench_json_metric(out, &channel->bandwidth);
+        fprintf(out, "},\n    \"ber\": {");
+        bench_json_metric(out, &channel->ber);
+        fprintf(out, "}\n  }");
+    }
+
+    fprintf(out, "\n}\n");
+}
+
+/**
+ * Reads the whole file at `path` into a string the caller frees.
+ *
+ * Returns NULL if it cannot be read or is longer than `BENCH_JSON_MAX`.
+ */
+static char* bench_read_file(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    char* text = malloc(BENCH_JSON_MAX + 1);
+    size_t len = 0;
+
+    if (file == NULL || text == NULL) {
+        if (file != NULL) {
+            fclose(file);
+        }
+
+        free(text);
+        return NULL;
+    }
+
+    len = fread(text, 1, BENCH_JSON_MAX + 1, file);
+    fclose(file);
+
+    if (len > BENCH_JSON_MAX) {
+        free(text);
+        return NULL;
+    }
+
+    text[len] = '\0';
+
+    return text;
+}
+
+/**
+ * Copies the string value of the first `"name": "..."` in the JSON `text`
+ * into `value`, undoing the escapes `bench_json_string()` writes.
+ *
+ * Returns -1 if there is none.
+ */
+static int bench_json_get_string(const char* text, const char* name,
+                                 char* value, size_t size)
+{
+    char pattern[64];
+    size_t len = 0;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": \"", name);
+
+    const char* p = strstr(text, pattern);
+
+    if (p == NULL || size == 0) {
+        return -1;
+    }
+
+    for (p += strlen(pattern); *p != '\0' && *p != '"'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p += 1;
+        }
+
+        if (len + 1 < size) {
+            value[len++] = *p;
+        }
+    }
+
+    value[len] = '\0';
+
+    return 0;
+}
+
+/**
+ * Reads the trials of the metric `name` from the JSON `text`, as
+ * `bench_json_metric()` writes them, into `metric` and summarises them.
+ * Metric names are unique within the file.
+ *
+ * Returns -1 if the metric is missing.
+ */
+static int bench_json_get_metric(const char* text, const char* name,
+                                 bench_metric_t* metric)
+{
+    char pattern[64];
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": {", name);
+    memset(metric, 0, sizeof(*metric));
+
+    const char* p = strstr(text, pattern);
+    const char* end = (p != NULL) ? strchr(p, '}') : NULL;
+
+    p = (p != NULL) ? strstr(p, "\"trials\": [") : NULL;
+
+    if (p == NULL || p > end) {
+        return -1;
+    }
+
+    p += strlen("\"trials\": [");
+
+    while (metric->ntrials < BENCH_MAX_TRIALS) {
+        char* next;
+        double value = strtod(p, &next);
+
+        if (next == p) {
+            break;
+        }
+
+        metric->trials[metric->ntrials++] = value;
+        p = next + strspn(next, ", ");
+    }
+
+    bench_summarise(metric);
+
+    return 0;
+}
+
+/**
+ * Prints every metric in `cmps` next to its baseline and flags the ones that
+ * got significantly worse, by at least the larger of `BENCH_MIN_EFFECT` of
+ * the baseline mean and `BENCH_MIN_EFFECT_CI` times the two confidence
+ * intervals, as regressions.
+ *
+ * Returns the number of regressions.
+ */
+static int bench_compare(const bench_comparison_t* cmps, size_t n)
+{
+    int regressions = 0;
+
+    fprintf(stderr, "%-18s %-22s %-22s %s\n", "Metric", "Baseline",
+            "Current", "Change");
+
+    for (size_t k = 0; k < n; k++) {
+        const bench_metric_t* cur = cmps[k].current;
+        const bench_metric_t* base = &cmps[k].baseline;
+        double delta = cur->mean - base->mean;
+        double effect = (base->mean != 0.0) ? delta / base->mean : 0.0;
+        double least = fmax(BENCH_MIN_EFFECT * fabs(base->mean),
+                            BENCH_MIN_EFFECT_CI * (base->ci95 + cur->ci95));
+        bool worse = cmps[k].higher_is_worse ? (delta > 0) : (delta < 0);
+        bool significant = bench_significant(cur, base) &&
+                           fabs(delta) >= least;
+        const char* verdict = "";
+        char before[32];
+        char after[32];
+
+        if (significant) {
+            verdict = worse ? "  REGRESSION" : "  improved";
+            regressions += worse;
+        }
+
+        snprintf(before, sizeof(before), "%.4g +- %.2g", base->mean,
+                 base->ci95);
+        snprintf(after, sizeof(after), "%.4g +- %.2g", cur->mean, cur->ci95);
+
+        if (base->mean != 0.0) {
+            fprintf(stderr, "%-18s %-22s %-22s %+.1f%%%s\n", cmps[k].name,
+                    before, after, 100.0 * effect, verdict);
+        } else {
+            fprintf(stderr, "%-18s %-22s %-22s %+.3g%s\n", cmps[k].name,
+                    before, after, delta, verdict);
+        }
+    }
+
+    return regressions;
+}
+
+/**
+ * Compares the results with the baseline in the JSON `text`, which must be
+ * for the CPU model of `key`, and says how they compare on stderr. Metrics
+ * missing from either side, such as the channel when one run skipped it, are
+ * left out, and so is the channel when the baseline's delivered nothing.
+ *
+ * Returns the number of regressions, or -1 if the baseline is for another
+ * model.
+ */
+static int bench_check_baseline(const char* text, const calib_key_t* key,
+                                const bench_result_t* results,
+                                const bench_channel_t* channel)
+{
+    bench_comparison_t cmps[BENCH_NPRIMITIVES + 2];
+    size_t n = 0;
+    char model[64] = "";
+    char commit[64] = "unknown";
+    char date[32] = "unknown";
+
+    if (bench_json_get_string(text, "model", model, sizeof(model)) != 0 ||
+        strcmp(model, key->model) != 0) {
+        fprintf(stderr, "The baseline is for %s, not %s\n",
+                (model[0] != '\0') ? model : "an unknown model", key->model);
+        return -1;
+    }
+
+    bench_json_get_string(text, "commit", commit, sizeof(commit));
+    bench_json_get_string(text, "date", date, sizeof(date));
+    fprintf(stderr, "Baseline: commit %s, %s\n", commit, date);
+
+    for (size_t k = 0; k < BENCH_NPRIMITIVES; k++) {
+        cmps[n].name = bench_primitives[k].name;
+        cmps[n].current = &results[k].medians;
+        cmps[n].higher_is_worse = true;
+        n += (bench_json_get_metric(text, cmps[n].name,
+                                    &cmps[n].baseline) == 0);
+    }
+
+    bench_metric_t delivered;
+
+    // A channel that delivered nothing in the baseline has a bandwidth of
+    // zero and an error rate of one in every trial, which any run matches
+    if (channel->frames != 0 &&
+        bench_json_get_metric(text, "bandwidth", &delivered) == 0 &&
+        delivered.mean == 0.0) {
+        fprintf(stderr, "The baseline channel delivered nothing, so it is "
+                        "left out\n");
+    } else if (channel->frames != 0) {
+        cmps[n].name = "bandwidth";
+        cmps[n].current = &channel->bandwidth;
+        cmps[n].higher_is_worse = false;
+        n += (bench_json_get_metric(text, cmps[n].name,
+                                    &cmps[n].baseline) == 0);
+
+        cmps[n].name = "ber";
+        cmps[n].current = &channel->ber;
+        cmps[n].higher_is_worse = true;
+        n += (bench_json_get_metric(text, cmps[n].name,
+                                    &cmps[n].baseline) == 0);
+    }
+
+    return bench_compare(cmps, n);
+}
+
+/**
+ * Writes the results as JSON to the file at `path`, or to stdout if it is
+ * NULL.
+ *
+ * Returns -1 if the file cannot be written.
+ */
+static int bench_save(const char* path, const calib_key_t* key,
+                      const char* fingerprint, const cache_t* cache,
+                      size_t setno, size_t reps, uint64_t overhead,
+                      const bench_result_t* results,
+                      const bench_channel_t* channel)
+{
+    FILE* out = (path != NULL) ? fopen(path, "w") : stdout;
+
+    if (out == NULL) {
+        return -1;
+    }
+
+    bench_write_json(out, key, fingerprint, cache, setno, reps, overhead,
+                     results, channel);
+
+    if (out != stdout) {
+        return (fclose(out) == 0) ? 0 : -1;
+    }
+
+    return 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <set> <cpu>\n"
+            "\n"
+            "Times every cache primitive on <cpu> against L1 set <set>, and\n"
+            "the loopback channel over it, and writes the min, median and\n"
+            "99th percentile of each primitive, and the mean and 95%%\n"
+            "confidence interval of every figure over the trials, as JSON.\n"
+            "\n"
+            "Options:\n"
+            "  --reps N      timed calls of each primitive per trial\n"
+            "                (default %d)\n"
+            "  --trials N    trials of everything, at most %d (default %d)\n"
+            "  --frames N    loopback frames per trial, 0 to leave the\n"
+            "                channel out (default %d)\n"
+            "  --no-ladder   leave out the memory latency sweep that\n"
+            "                fingerprints the cache hierarchy\n"
+            "  --output PATH write the JSON there instead of to stdout\n"
+            "  --baseline PATH\n"
+            "                compare with the results in PATH, or in the\n"
+            "                file for this CPU model if PATH is a directory,\n"
+            "                and exit with 2 on a significant regression;\n"
+            "                the results become the baseline if there is none\n"
+            "  --update-baseline\n"
+            "                replace the baseline with the results afterwards\n"
+            "  --calib-file PATH\n"
+            "                where calibrations are kept between runs\n"
+            "  --recalibrate calibrate even if a stored calibration exists\n"
+            "  --no-warmup   start without waiting for the clock to settle\n",
+            prog, BENCH_DEFAULT_REPS, BENCH_MAX_TRIALS, BENCH_DEFAULT_TRIALS,
+            BENCH_DEFAULT_FRAMES);
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option options[] = {
+        {"reps", required_argument, NULL, 'n'},
+        {"trials", required_argument, NULL, 't'},
+        {"frames", required_argument, NULL, 'f'},
+        {"no-ladder", no_argument, NULL, 'l'},
+        {"output", required_argument, NULL, 'o'},
+        {"baseline", required_argument, NULL, 'b'},
+        {"update-baseline", no_argument, NULL, 'u'},
+        {"calib-file", required_argument, NULL, 'c'},
+        {"recalibrate", no_argument, NULL, 'C'},
+        {"no-warmup", no_argument, NULL, 'W'},
+        {NULL, 0, NULL, 0},
+    };
+
+    size_t reps = BENCH_DEFAULT_REPS;
+    int trials = BENCH_DEFAULT_TRIALS;
+    int frames = BENCH_DEFAULT_FRAMES;
+    bool use_ladder = true;
+    const char* output = NULL;
+    const char* baseline = NULL;
+    bool update_baseline = false;
+    char calib_path[4096];
+    bool have_calib_path =
+        (calib_default_path(calib_path, sizeof(calib_path)) == 0);
+    bool recalibrate = false;
+    bool warmup = true;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                reps = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                trials = atoi(optarg);
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'l':
+                use_ladder = false;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baseline = optarg;
+                break;
+            case 'u':
+                update_baseline = true;
+                break;
+            case 'c':
+                snprintf(calib_path, sizeof(calib_path), "%s", optarg);
+                have_calib_path = true;
+                break;
+            case 'C':
+                recalibrate = true;
+                break;
+            case 'W':
+                warmup = false;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2 || reps == 0 || trials < 1 ||
+        trials > BENCH_MAX_TRIALS || frames < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t setno = strtoul(argv[optind], NULL, 0);
+    int cpuno = atoi(argv[optind + 1]);
+    calib_key_t key;
+    char baseline_path[4096];
+
+    if (pin_current_thread(cpuno) != 0) {
+        fprintf(stderr, "Failed to pin to CPU %d\n", cpuno);
+        return 1;
+    }
+
+    if (calib_key_init(&key, cpuno) != 0) {
+        fprintf(stderr, "Cannot identify CPU %d\n", cpuno);
+        return 1;
+    }
+
+    // A directory holds one baseline per model, named after it
+    if (baseline != NULL) {
+        struct stat st;
+
+        if (stat(baseline, &st) == 0 && S_ISDIR(st.st_mode)) {
+            int len = snprintf(baseline_path, sizeof(baseline_path),
+                               "%s/%s.json", baseline, key.model);
+
+            for (int k = strlen(baseline) + 1; k < len; k++) {
+                baseline_path[k] = (baseline_path[k] == '/')
+                                       ? '-'
+                                       : baseline_path[k];
+            }
+        } else {
+            snprintf(baseline_path, sizeof(baseline_path), "%s", baseline);
+        }
+
+        baseline = baseline_path;
+    }
+
+    freq_t freq;
+
+    freq_init(&freq, cpuno);
+
+    if (warmup && freq_warmup(&freq) != 0) {
+        fprintf(stderr, "Warning: clock did not settle after %d windows\n",
+                freq.windows);
+    }
+
+    cache_t cache;
+
+    if (cache_init(&cache) != 0) {
+        fprintf(stderr, "Failed to initialize the cache\n");
+        freq_deinit(&freq);
+        return 1;
+    }
+
+    if (setno >= cache.nsets) {
+        fprintf(stderr, "Invalid set: %zu\n", setno);
+        cache_deinit(&cache);
+        freq_deinit(&freq);
+        return 1;
+    }
+
+    if (calib_restore(&cache, have_calib_path ? calib_path : NULL,
+                      recalibrate) < 0) {
+        fprintf(stderr, "Failed to calibrate the cache\n");
+        cache_deinit(&cache);
+        freq_deinit(&freq);
+        return 1;
+    }
+
+    // Every trial's samples of every primitive, pooled for the distribution
+    uint64_t* samples = calloc(BENCH_NPRIMITIVES * trials * reps,
+                               sizeof(*samples));
+    bench_result_t results[BENCH_NPRIMITIVES];
+    bench_channel_t channel = {.frames = frames};
+
+    if (samples == NULL) {
+        fprintf(stderr, "Out of memory for %zu samples\n", trials * reps);
+        cache_deinit(&cache);
+        freq_deinit(&freq);
+        return 1;
+    }
+
+    memset(results, 0, sizeof(results));
+
+    uint64_t overhead = bench_overhead();
+
+    // Trials interleave the primitives, so that a slow spell of the host
+    // spreads over all of them rather than skewing one
+    for (int trial = 0; trial < trials; trial++) {
+        for (size_t k = 0; k < BENCH_NPRIMITIVES; k++) {
+            uint64_t* trial_samples = samples + (k * trials + trial) * reps;
+            uint64_t median = bench_measure(&cache, &bench_primitives[k],
+                                            setno, reps, overhead,
+                                            trial_samples);
+
+            results[k].medians.trials[trial] = median;
+            results[k].medians.ntrials = trial + 1;
+        }
+    }
+
+    for (size_t k = 0; k < BENCH_NPRIMITIVES; k++) {
+        bench_distribution(samples + k * trials * reps, trials * reps,
+                           &results[k]);
+    }
+
+    if (frames != 0 && bench_channel(&cache, setno, trials, &channel) != 0) {
+        fprintf(stderr, "Warning: could not run the loopback channel\n");
+        channel.frames = 0;
+    } else if (frames != 0 && channel.bandwidth.mean == 0.0) {
+        fprintf(stderr, "Warning: the loopback channel delivered nothing, "
+                        "so its figures say nothing about the code\n");
+    }
+
+    // Kept with the results, so that baselines of hosts of the same model
+    // but another memory system can be told apart
+    char fingerprint[256] = "";
+    ladder_t ladder;
+
+    if (use_ladder && ladder_run(&cache, 0, &ladder) == 0) {
+        ladder_fingerprint(&ladder, fingerprint, sizeof(fingerprint));
+    } else if (use_ladder) {
+        fprintf(stderr, "Warning: could not sweep the memory latency\n");
+    }
+
+    if (warmup && freq_drifted(&freq)) {
+        fprintf(stderr, "Warning: clock frequency drifted during the run\n");
+    }
+
+    int ret = 0;
+
+    if (bench_save(output, &key, fingerprint, &cache, setno, reps, overhead,
+                   results, &channel) != 0) {
+        fprintf(stderr, "Cannot write %s\n", output);
+        ret = 1;
+    }
+
+    if (baseline != NULL) {
+        char* text = bench_read_file(baseline);
+        int regressions = 0;
+
+        if (text == NULL) {
+            fprintf(stderr, "No baseline in %s, storing this run as one\n",
+                    baseline);
+            update_baseline = true;
+        } else {
+            regressions = bench_check_baseline(text, &key, results,
+                                               &channel);
+            free(text);
+        }
+
+        if (regressions < 0) {
+            ret = 1;
+        } else if (regressions > 0) {
+            fprintf(stderr, "Regressions: %d significant\n", regressions);
+            ret = (ret != 0) ? ret : 2;
+        }
+
+        if (update_baseline && regressions >= 0 &&
+            bench_save(baseline, &key, fingerprint, &cache, setno, reps,
+                       overhead, results, &channel) != 0) {
+            fprintf(stderr, "Cannot write the baseline to %s\n", baseline);
+            ret = 1;
+        }
+    }
+
+    free(samples);
+    cache_deinit(&cache);
+    freq_deinit(&freq);
+
+    return ret;
+}
@@ -0,0 +1,324 @@
+#ifndef COVERT_CACHE_H
+#define COVERT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Mask selecting the CPU number from the TSC_AUX value Linux programs on
+/// each CPU (the NUMA node lives in the bits above it).
+#define TSC_AUX_CPU_MASK 0xfffU
+
+/// CPU number reported by `timed_read()` when the two timestamps were taken on
+/// different CPUs.
+#define CPU_MIGRATED (-1)
+
+/// CPU number reported by timers that cannot tell which CPU they ran on. The
+/// sample is kept, trusting the thread to be pinned.
+#define CPU_UNKNOWN (-2)
+
+/**
+ * Cache replacement policies, as far as the tools here care to tell them
+ * apart
+ */
+typedef enum cache_policy {
+    CACHE_POLICY_LRU,
+    CACHE_POLICY_PLRU,
+    CACHE_POLICY_RANDOM,
+    CACHE_NPOLICIES,
+} cache_policy_t;
+
+extern const char* const cache_policy_names[CACHE_NPOLICIES];
+
+/**
+ * Instructions a line can be probed with. The prefetches do not load anything
+ * into a register, so they can retire sooner than a load does, and on some
+ * parts their latency separates hits from misses more cleanly.
+ */
+typedef enum cache_probe {
+    CACHE_PROBE_LOAD,
+    CACHE_PROBE_PREFETCHT0,
+    CACHE_PROBE_PREFETCHNTA,
+    CACHE_PROBE_PREFETCHW,
+    CACHE_NPROBES,
+} cache_probe_t;
+
+extern const char* const cache_probe_names[CACHE_NPROBES];
+
+/**
+ * Ways of taking the two timestamps around a timed load: which counter is
+ * read and what keeps the load from drifting out from between them. No one
+ * of these is the most precise on every CPU; see `timer.c`.
+ */
+typedef enum cache_timer {
+    CACHE_TIMER_RDTSCP,
+    CACHE_TIMER_LFENCE,
+    CACHE_TIMER_MFENCE,
+    CACHE_TIMER_CPUID,
+    CACHE_TIMER_RDPMC,
+    CACHE_NTIMERS,
+} cache_timer_t;
+
+extern const char* const cache_timer_names[CACHE_NTIMERS];
+
+/**
+ * Levels of the memory hierarchy a read can be served by
+ */
+typedef enum cache_level {
+    CACHE_LEVEL_L1,
+    CACHE_LEVEL_L2,
+    CACHE_LEVEL_LLC,
+    CACHE_LEVEL_DRAM,
+    CACHE_NLEVELS,
+} cache_level_t;
+
+extern const char* const cache_level_names[CACHE_NLEVELS];
+
+/**
+ * What `cache_select_timer()` measured of one timer
+ */
+typedef struct cache_timer_stats {
+    /// Whether the timer works here at all. The rest is zero if not.
+    bool available;
+
+    /// Mean and standard deviation of a measurement of nothing
+    double overhead;
+    double jitter;
+
+    /// Signal to noise ratio of hits against misses, as for probes
+    double snr;
+} cache_timer_stats_t;
+
+/**
+ * Implementation of the primitives everything else is built on: filling and
+ * flushing a line, timing a read, and reading the clock. `cache_backend`
+ * points at the one in use, which is the hardware unless the simulator has
+ * been installed.
+ */
+typedef struct cache_backend {
+    /// Name shown to the user
+    const char* name;
+
+    void (*fill)(uint8_t* ptr);
+    void (*flush)(uint8_t* ptr);
+    uint64_t (*timed_read)(uint8_t* ptr, cache_timer_t timer, int* cpu);
+    uint64_t (*timed_flush)(uint8_t* ptr, int* cpu);
+    uint64_t (*timed_prefetch)(uint8_t* ptr, cache_probe_t probe, int* cpu);
+    uint64_t (*clock)(void);
+
+    /// Size, line size and associativity of the L1D the primitives act on,
+    /// which `cache_init()` lays out `cache_t` for
+    void (*geometry)(size_t* size, size_t* line_size, size_t* assoc);
+} cache_backend_t;
+
+extern const cache_backend_t cache_backend_hw;
+extern const cache_backend_t* cache_backend;
+
+/// Number of fractional bits in the moving averages of `cache_t`
+#define TRACK_FRAC_BITS 8
+
+/// Longest access sequence `cache_fill_set()` may be given for a set of
+/// `assoc` ways
+#define CACHE_PRIME_CAPACITY(assoc) (32 * (assoc))
+
+/// Multiple of the median miss latency beyond which a timed read is taken to
+/// have been interrupted. A median holds however many outliers stay under
+/// half the samples, where a high percentile stops rejecting any once they
+/// reach its share.
+#define CACHE_OUTLIER_FACTOR 4
+
+/**
+ * Metadata and resources used for manipulating the cache
+ */
+typedef struct cache {
+    /// Size of the cache in bytes
+    size_t size;
+
+    /// Size of a cache line in bytes
+    size_t line_size;
+
+    /// Size of a cache set in bytes
+    size_t set_size;
+
+    /// Associativity of the cache - the nubmer of ways in a set.
+    size_t assoc;
+
+    /// Number of sets in the cache
+    size_t nsets;
+
+    /// Block offset mask for the address
+    uintptr_t offset_mask;
+
+    /// Index mask for the address
+    uintptr_t index_mask;
+
+    /// Tag mask for the address
+    uintptr_t tag_mask;
+
+    /// LSB of the `index_mask`
+    int index_shift;
+
+    /// LSB of the `tag_mask`
+    int tag_shift;
+
+    /// Instruction `cache_timed_read()` times, and so everything calibrated
+    /// and probed through it
+    cache_probe_t probe;
+
+    /// Timer used for loads. Prefetches and flushes are always timed with
+    /// RDTSCP.
+    cache_timer_t timer;
+
+    /// Measured latency of cache hits
+    uint64_t hit_latency;
+
+    /// Measured latency of cache misses
+    uint64_t miss_latency;
+
+    /// Heuristic threshold for determining if a timed read is a hit or not.
+    /// Currently the average of the hit and miss latency.
+    uint64_t hit_threshold;
+
+    /// Measured latency of a read of a line that conflicting fills of its set
+    /// pushed out of the L1, which the L2 serves, and the midpoint between it
+    /// and `hit_latency`. This, not `hit_threshold`, is what tells a probed
+    /// line apart from one the other end of a prime+probe channel evicted:
+    /// misses calibrated against flushed lines come from DRAM and are far
+    /// slower. Zero until `cache_calibrate_levels()`, when the threshold is
+    /// `hit_threshold`.
+    uint64_t evict_latency;
+    uint64_t evict_threshold;
+
+    /// Median latency of timing nothing at all, which every latency above
+    /// includes, and the spread from the 1st to the 99th percentile of the
+    /// same, below which no difference in latency can be trusted. Both zero
+    /// for calibrations stored before they were measured.
+    uint64_t timer_overhead;
+    uint64_t noise_floor;
+
+    /// Measured latencies of flushing a cached and an uncached line, and the
+    /// midpoint of the two. Which one is slower depends on the CPU; see
+    /// `cache_flush_cached()`. All zero until `cache_calibrate_flush()`.
+    uint64_t flush_hit_latency;
+    uint64_t flush_miss_latency;
+    uint64_t flush_threshold;
+
+    /// Median latency of a read served by each level, from which
+    /// `cache_classify()` tells them apart. Zero for a level whose latency did
+    /// not fall between those of its neighbours, and for every level until
+    /// `cache_calibrate_levels()`.
+    uint64_t level_latency[CACHE_NLEVELS];
+
+    /// Number of reads `cache_probe_set()` attributed to each level, once
+    /// the levels are calibrated. Misses that land in the L2 rather than
+    /// leaving the hierarchy show up here.
+    uint64_t served[CACHE_NLEVELS];
+
+    /// Upper bound on a plausible timed read. Anything slower was almost
+    /// certainly stretched by an interrupt or page fault and is rejected
+    /// rather than classified.
+    uint64_t outlier_threshold;
+
+    /// Number of timed reads rejected for exceeding `outlier_threshold`
+    uint64_t outliers;
+
+    /// Extra passes `cache_fill_set()` makes over the set after a probe
+    /// rejected an outlier, which may have left foreign lines in it. Zero
+    /// only drops the outlier.
+    int reprobes;
+
+    /// Whether a probe has rejected an outlier since the last prime
+    bool disturbed;
+
+    /// Weight of a new sample in `cache_track()` is 1/2^`track_shift`. Zero
+    /// keeps the thresholds fixed.
+    int track_shift;
+
+    /// Moving averages of the hit and miss latencies in fixed point, zero
+    /// until the first sample is tracked
+    uint64_t hit_track;
+    uint64_t miss_track;
+    uint64_t evict_track;
+
+    /// Moving averages of the flush latencies, as for reads
+    uint64_t flush_hit_track;
+    uint64_t flush_miss_track;
+
+    /// Number of samples folded into the moving averages
+    uint64_t tracked;
+
+    /// CPU the structure was calibrated on. Timed reads taken anywhere else are
+    /// discarded.
+    int cpu;
+
+    /// Number of timed reads discarded because of a CPU migration
+    uint64_t migrations;
+
+    /// Replacement policy the fill and probe orders are chosen for
+    cache_policy_t policy;
+
+    /// Lines of a set, numbered as in `cache_line()`, that `cache_fill_set()`
+    /// accesses in order. Room for `CACHE_PRIME_CAPACITY(assoc)` entries.
+    size_t* prime_seq;
+    size_t prime_len;
+
+    /// The `assoc` lines `cache_probe_set()` reads, in order. These are the
+    /// lines `prime_seq` leaves in the set.
+    size_t* probe_seq;
+
+    /// Size of `buffer` in bytes
+    size_t buffer_size;
+
+    /// A buffer a multiple size of the cache used for manipulation of the cache
+    uint8_t* buffer;
+} cache_t;
+
+uint32_t dlog2(size_t n);
+
+void clflush(uint8_t* ptr);
+void cache_flush(uint8_t* ptr);
+void cache_fill(uint8_t* ptr);
+uint64_t timed_read(uint8_t* ptr, cache_timer_t timer, int* cpu);
+uint64_t timed_flush(uint8_t* ptr, int* cpu);
+uint64_t timed_prefetch(uint8_t* ptr, cache_probe_t probe, int* cpu);
+uint64_t rdtsc(void);
+uint64_t rdtsc_fenced(void);
+uint64_t cache_clock(void);
+int compare_u64(const void* a, const void* b);
+uint64_t percentile(const uint64_t* sorted, int n, int pct);
+
+int cache_timed_read(cache_t* cache, uint8_t* ptr, uint64_t* dur);
+int cache_timed_flush(cache_t* cache, uint8_t* ptr, uint64_t* dur);
+int cache_calibrate_l1(cache_t* cache);
+int cache_calibrate(cache_t* cache);
+int cache_measure_overhead(cache_t* cache);
+int cache_calibrate_levels(cache_t* cache);
+cache_level_t cache_classify(const cache_t* cache, uint64_t dur);
+uint64_t cache_net(const cache_t* cache, uint64_t latency);
+double cache_floors(const cache_t* cache, int64_t gap);
+int cache_parse_probe(const char* name, cache_probe_t* probe);
+int cache_select_probe(cache_t* cache, double* snr);
+int cache_parse_timer(const char* name, cache_timer_t* timer);
+int cache_select_timer(cache_t* cache, cache_timer_stats_t* stats);
+int cache_calibrate_flush(cache_t* cache, uint8_t* const* lines,
+                          size_t nlines);
+int cache_check_calibration(cache_t* cache);
+int cache_init(cache_t* cache);
+int cache_deinit(cache_t* cache);
+int cache_parse_policy(const char* name, cache_policy_t* policy);
+void cache_set_policy(cache_t* cache, cache_policy_t policy);
+void cache_set_order(cache_t* cache, const size_t* prime, size_t prime_len,
+                     const size_t* probe);
+uint8_t* cache_line(cache_t* cache, size_t setno, size_t way);
+int cache_flush_set(cache_t* cache, size_t setno);
+int cache_fill_set(cache_t* cache, size_t setno);
+int cache_count_hits(cache_t* cache, size_t setno);
+int cache_probe_set(cache_t* cache, size_t setno, uint64_t* durs,
+                    size_t* valid);
+void cache_track(cache_t* cache, uint64_t dur, bool hit);
+void cache_track_evict(cache_t* cache, uint64_t dur, bool hit);
+void cache_set_evict(cache_t* cache, uint64_t latency);
+bool cache_flush_cached(cache_t* cache, uint64_t dur);
+void cache_track_flush(cache_t* cache, uint64_t dur, bool cached);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef COVERT_CALIB_H
+#define COVERT_CALIB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "inclusion.h"
+#include "llc.h"
+
+/**
+ * Identifies the conditions a calibration was taken under. A stored
+ * calibration is only reused when every field matches.
+ */
+typedef struct calib_key {
+    /// CPU number the calibration was taken on
+    int cpu;
+
+    /// Vendor, family, model and stepping, e.g. "GenuineIntel/6/158/10"
+    char model[64];
+
+    /// Microcode revision as reported by the kernel
+    char microcode[32];
+
+    /// Kernel release
+    char kernel[80];
+} calib_key_t;
+
+/**
+ * Calibration of a single CPU within a `calib_table_t`
+ */
+typedef struct calib_entry {
+    /// Whether the CPU was calibrated at all
+    bool valid;
+
+    /// Whether the calibration was reused from the calibration file
+    bool restored;
+
+    uint64_t hit_latency;
+    uint64_t miss_latency;
+    uint64_t hit_threshold;
+    uint64_t evict_latency;
+    uint64_t outlier_threshold;
+    uint64_t timer_overhead;
+    uint64_t noise_floor;
+    uint64_t level_latency[CACHE_NLEVELS];
+    cache_policy_t policy;
+    cache_probe_t probe;
+    cache_timer_t timer;
+} calib_entry_t;
+
+/**
+ * Per-CPU calibrations, indexed by CPU number
+ */
+typedef struct calib_table {
+    /// Number of entries, one more than the highest CPU number allowed
+    int ncpus;
+
+    calib_entry_t* entries;
+} calib_table_t;
+
+int calib_key_init(calib_key_t* key, int cpuno);
+int calib_default_path(char* path, size_t size);
+int calib_load(const char* path, const calib_key_t* key, cache_t* cache);
+int calib_store(const char* path, const calib_key_t* key, const cache_t* cache);
+int calib_restore(cache_t* cache, const char* path, bool force);
+int calib_load_slices(const char* path, const calib_key_t* key, llc_t* llc);
+int calib_store_slices(const char* path, const calib_key_t* key,
+                       const llc_t* llc);
+int calib_load_inclusion(const char* path, const calib_key_t* key,
+                         inclusion_report_t* report);
+int calib_store_inclusion(const char* path, const calib_key_t* key,
+                          const inclusion_report_t* report);
+
+int calib_table_build(calib_table_t* table, const char* path, bool force);
+void calib_table_deinit(calib_table_t* table);
+const calib_entry_t* calib_table_lookup(const calib_table_t* table, int cpu);
+int calib_table_apply(const calib_table_t* table, cache_t* cache);
+
+#endif
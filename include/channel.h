@@ -0,0 +1,165 @@
+#ifndef COVERT_CHANNEL_H
+#define COVERT_CHANNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "freq.h"
+#include "llc.h"
+
+/// Default length of a symbol slot in TSC ticks
+#define CHANNEL_DEFAULT_PERIOD 20000
+
+/// Default number of seconds `channel_receive()` waits for a frame
+#define CHANNEL_DEFAULT_TIMEOUT 10
+
+/// The preamble and start-of-frame delimiter, sent most significant bit first
+#define CHANNEL_PREAMBLE 0x5555d5U
+
+/// Number of bits in `CHANNEL_PREAMBLE`
+#define CHANNEL_PREAMBLE_BITS 24
+
+/// Number of bits in a frame carrying `len` bytes
+#define CHANNEL_FRAME_BITS(len) (CHANNEL_PREAMBLE_BITS + 8 * ((len) + 2))
+
+/// Default length of a symbol slot in TSC ticks over the LLC, where the
+/// transmitter reads a candidate line of every page of its buffer per pass
+#define CHANNEL_LLC_PERIOD 4000000
+
+/// Number of agreed lines of the shared mapping a Flush+Reload slot uses
+#define CHANNEL_SHARED_LINES 4
+
+/// Agreed line `k` lies `k * k` of these into the shared mapping. Lines a page
+/// or more apart are not brought in by the adjacent-line prefetcher, and at
+/// uneven distances the stride prefetcher cannot guess the next one from the
+/// receiver's reloads.
+#define CHANNEL_SHARED_PAGE 4096
+
+/**
+ * How a channel signals a bit
+ */
+typedef enum channel_mode {
+    /// Contention over a cache set, each end with lines of its own
+    CHANNEL_PRIME_PROBE,
+
+    /// Reloads of lines of a file both ends map
+    CHANNEL_FLUSH_RELOAD,
+
+    /// As `CHANNEL_FLUSH_RELOAD`, but timing flushes of the lines instead of
+    /// reloads
+    CHANNEL_FLUSH_FLUSH,
+
+    /// Contention over a set of the shared last level cache, each end with
+    /// lines of its own
+    CHANNEL_LLC,
+} channel_mode_t;
+
+/**
+ * One end of the channel, over a single cache set or over a few lines of a
+ * shared file.
+ *
+ * Both ends divide time into slots of `period` TSC ticks, counted from zero,
+ * and send one bit per slot. The TSC is synchronised across cores, so the
+ * slots line up without any handshake.
+ *
+ * In prime+probe mode, during a one the transmitter keeps filling the set;
+ * during a zero it leaves it alone. The receiver primes the set at the start
+ * of each slot and probes it three quarters of the way in.
+ *
+ * In Flush+Reload mode both ends map the same file read-only, which the page
+ * cache backs with the same physical memory. During a one the transmitter
+ * keeps reading the agreed lines. The receiver flushes them at the start of
+ * each slot and times reloading them three quarters of the way in: fast
+ * reloads mean the transmitter brought them back. CLFLUSH is coherent across
+ * the whole machine and the lines end up in the shared last level cache, so
+ * this works between any two cores.
+ *
+ * Flush+Flush mode is Flush+Reload with the reload replaced by a timed
+ * CLFLUSH, whose latency depends on whether the line was cached. The probe
+ * leaves the lines flushed for the next slot, so there is nothing to reset,
+ * and the receiver never loads the lines at all.
+ *
+ * LLC mode is prime+probe over the last level cache, which every core of the
+ * socket shares, so it works without SMT. Neither end can tell which LLC set
+ * its lines map to, only the page offset `setno` selects, so the transmitter
+ * signals a one by reading candidate lines at that offset from every page of
+ * its buffer, which evicts every set and slice the offset can reach. The
+ * receiver primes and probes a single eviction set found by timing. The slot
+ * has to be far longer than in the other modes; see `CHANNEL_LLC_PERIOD`.
+ *
+ * A frame is the preamble 0x55 0x55 0xd5, a length byte, the payload and an
+ * 8-bit sum of the length and payload bytes.
+ */
+typedef struct channel {
+    /// Cache structure of the CPU this end runs on
+    cache_t* cache;
+
+    /// Cache set the channel runs over. In the shared and LLC modes, the line
+    /// within each page instead.
+    size_t setno;
+
+    channel_mode_t mode;
+
+    /// The file mapping in the shared modes, NULL otherwise
+    uint8_t* shared;
+    size_t shared_size;
+
+    /// The LLC and the receiver's eviction set in LLC mode. The transmitter
+    /// leaves `evset` empty.
+    llc_t* llc;
+    llc_evset_t evset;
+
+    /// Number of latencies each probe yields: the associativity in
+    /// prime+probe mode, `CHANNEL_SHARED_LINES` in the shared modes and the
+    /// size of the eviction set in LLC mode
+    size_t width;
+
+    /// Length of a slot in TSC ticks
+    uint64_t period;
+
+    /// Seconds `channel_receive()` waits for a frame to start
+    int timeout;
+
+    /// Clock monitor checked for drift between frames, or NULL
+    freq_t* freq;
+
+    /// Called by the receiver between priming and probing in every slot, or
+    /// NULL. Lets a transmitter in the same thread act within the slot, which
+    /// is how the loopback self-test runs, deterministically so under the
+    /// simulator.
+    void (*peer)(struct channel* channel, uint64_t slot);
+
+    /// Argument for `peer`
+    void* peer_arg;
+
+    /// Probe latencies of the last `CHANNEL_PREAMBLE_BITS` slots, used to
+    /// train the thresholds once they turn out to have been the preamble
+    uint64_t* ring;
+
+    /// Slot of `ring` the next probe is stored in
+    int ring_head;
+
+    /// Number of slots sent or received
+    uint64_t slots;
+
+    /// Number of times the clock was found to have drifted
+    uint64_t drifts;
+
+    /// Number of frames received with a bad checksum
+    uint64_t bad_frames;
+} channel_t;
+
+int channel_init(channel_t* channel, cache_t* cache, size_t setno);
+int channel_map_shared(channel_t* channel, const char* path,
+                       channel_mode_t mode);
+int channel_use_llc(channel_t* channel, llc_t* llc, bool receiver);
+void channel_deinit(channel_t* channel);
+size_t channel_frame(const uint8_t* msg, size_t len, uint8_t* bits);
+int channel_transmit(channel_t* channel, const uint8_t* msg, size_t len);
+int channel_receive(channel_t* channel, uint8_t* msg, size_t size);
+int channel_loopback(channel_t* channel, cache_t* peer, const uint8_t* msg,
+                     size_t len, uint8_t* out, size_t size);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef COVERT_CPU_H
+#define COVERT_CPU_H
+
+#include <sched.h>
+
+int pin_current_thread(int cpuno);
+
+int cpulist_parse(const char* list, cpu_set_t* set);
+int cpulist_read(const char* path, cpu_set_t* set);
+
+#endif
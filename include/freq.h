@@ -0,0 +1,43 @@
+#ifndef COVERT_FREQ_H
+#define COVERT_FREQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * State for tracking the clock frequency of one CPU.
+ *
+ * Frequency is never measured in absolute terms, only as a `rate` that is
+ * proportional to it: either APERF/MPERF, when the MSRs are readable, or the
+ * number of iterations of a fixed dependent loop completed per TSC tick.
+ */
+typedef struct freq {
+    /// CPU being tracked. The caller must be running on it.
+    int cpu;
+
+    /// Descriptor of `/dev/cpu/<cpu>/msr`, or -1 when APERF/MPERF cannot be
+    /// read and the timing loop is used instead.
+    int msr_fd;
+
+    /// Relative difference between two rates below which they are considered
+    /// equal.
+    double tolerance;
+
+    /// Rate the CPU settled at during `freq_warmup()`, or last found by
+    /// `freq_drifted()`
+    double reference;
+
+    /// Number of measurement windows `freq_warmup()` took to settle
+    int windows;
+
+    /// Whether `freq_warmup()` settled before giving up
+    bool stable;
+} freq_t;
+
+int freq_init(freq_t* freq, int cpuno);
+void freq_deinit(freq_t* freq);
+double freq_rate(freq_t* freq);
+int freq_warmup(freq_t* freq);
+bool freq_drifted(freq_t* freq);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef COVERT_INCLUSION_H
+#define COVERT_INCLUSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "llc.h"
+
+/**
+ * Pairs of an upper and a lower cache level whose inclusion is tested
+ */
+typedef enum inclusion_pair {
+    INCLUSION_L1_L2,
+    INCLUSION_L1_LLC,
+    INCLUSION_L2_LLC,
+    INCLUSION_NPAIRS,
+} inclusion_pair_t;
+
+/**
+ * What evicting a line from the lower level of a pair does to the upper one
+ */
+typedef enum inclusion {
+    /// Not tested, or the levels could not be told apart, or the trials did
+    /// not agree
+    INCLUSION_UNKNOWN,
+
+    /// The line goes from the upper level as well
+    INCLUSION_INCLUSIVE,
+
+    /// The upper level keeps it, as under non-inclusive and exclusive
+    /// hierarchies alike
+    INCLUSION_NON_INCLUSIVE,
+
+    INCLUSION_NKINDS,
+} inclusion_t;
+
+extern const char* const inclusion_pair_names[INCLUSION_NPAIRS];
+extern const char* const inclusion_names[INCLUSION_NKINDS];
+
+/**
+ * Outcome of `inclusion_infer()`
+ */
+typedef struct inclusion_report {
+    /// Median latency of a read served by the L2, which tells L2 hits from
+    /// LLC hits
+    uint64_t l2_latency;
+
+    /// Trials of each pair in which the upper level lost the line, out of
+    /// `trials`
+    int evicted[INCLUSION_NPAIRS];
+    int trials;
+
+    inclusion_t pairs[INCLUSION_NPAIRS];
+} inclusion_report_t;
+
+int inclusion_parse(const char* name, inclusion_t* inclusion);
+int inclusion_infer(llc_t* llc, size_t setno, inclusion_report_t* report);
+bool inclusion_decided(const inclusion_report_t* report);
+bool inclusion_llc_works(const inclusion_report_t* report);
+
+#endif
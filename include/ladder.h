@@ -0,0 +1,51 @@
+#ifndef COVERT_LADDER_H
+#define COVERT_LADDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/// Most working set sizes a sweep measures
+#define LADDER_MAX_POINTS 64
+
+/// Largest working set a sweep goes up to, whatever the size of the LLC
+#define LADDER_MAX_SIZE (512UL << 20)
+
+/**
+ * Latency of a read at one working set size
+ */
+typedef struct ladder_point {
+    /// Size of the working set in bytes
+    size_t size;
+
+    /// Median latency of a read, less the overhead of the timer
+    uint64_t latency;
+} ladder_point_t;
+
+/**
+ * Outcome of `ladder_run()`: the latency curve and the steps in it
+ */
+typedef struct ladder {
+    ladder_point_t points[LADDER_MAX_POINTS];
+    size_t npoints;
+
+    /// Largest working set before each step up in latency, which is the
+    /// capacity of a cache level, and the latency of reads on the plateau
+    /// below it. `nlevels` counts the plateaus, the last of which is memory
+    /// and has no capacity.
+    size_t capacity[CACHE_NLEVELS];
+    uint64_t latency[CACHE_NLEVELS];
+    size_t nlevels;
+
+    /// Sizes of the L1, L2 and L3 as the CPU reports them to `sysconf()`,
+    /// which `cache_init()` and `llc_init()` go by, or zero if it does not
+    size_t reported[CACHE_NLEVELS - 1];
+} ladder_t;
+
+int ladder_run(cache_t* cache, size_t max_size, ladder_t* ladder);
+int ladder_match(const ladder_t* ladder, size_t level);
+void ladder_fingerprint(const ladder_t* ladder, char* buf, size_t size);
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef COVERT_LLC_H
+#define COVERT_LLC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/// Size of the candidate buffer in multiples of the LLC. Each LLC set gets
+/// about this many times its associativity of candidates at any page offset,
+/// so an eviction set can be found for it and other lines still evict it.
+#define LLC_BUFFER_FACTOR 4
+
+/// Size of the buffer that pushes lines out of the private caches, in
+/// multiples of the L2
+#define LLC_PRIVATE_FACTOR 4
+
+/// Timed trials behind every eviction test, decided by majority
+#define LLC_TEST_TRIALS 5
+
+/// Sets per LLC slice on Intel parts, from which the slice count follows
+#define LLC_SLICE_SETS 2048
+
+/// Most slice index bits a slice hash can have
+#define LLC_MAX_SLICE_BITS 6
+
+/// Masks of the known Intel slice hash, enough for eight slices
+#define LLC_INTEL_SLICE_MASKS 3
+
+/// Rounds of group testing retried when noise hides every removable group
+#define LLC_REDUCE_RETRIES 3
+
+/// Most lines an eviction set for an LLC of `assoc` ways may keep. Noise can
+/// leave a few more than `assoc` after reduction.
+#define LLC_EVSET_CAPACITY(assoc) (2 * (assoc))
+
+/**
+ * Lines of `llc->buffer` that all map to the same LLC set and slice, and
+ * together fill it
+ */
+typedef struct llc_evset {
+    /// Byte offset within a page shared by every line
+    size_t offset;
+
+    /// Room for `LLC_EVSET_CAPACITY(assoc)` lines, `nlines` of them used
+    uint8_t** lines;
+    size_t nlines;
+
+    /// Eviction tests, and TSC ticks, it took to find
+    uint64_t tests;
+    uint64_t ticks;
+} llc_evset_t;
+
+/**
+ * Outcome of `llc_recover_slices()`
+ */
+typedef struct llc_slice_report {
+    /// Lines sharing a set index that were sorted into slices
+    size_t nlines;
+
+    /// Slices they fell into
+    size_t nslices;
+
+    /// Eviction tests the sorting took
+    uint64_t tests;
+
+    /// Whether the slices fit a hash that is linear in the address bits
+    bool linear;
+} llc_slice_report_t;
+
+/**
+ * Metadata and resources used for manipulating the last level cache.
+ *
+ * LLC sets are indexed by physical address bits well above the page offset,
+ * and on most parts further split into slices by a hash of the whole physical
+ * address, so no arithmetic on virtual addresses finds the lines of a set the
+ * way `cache_line()` does for the L1. Only the bits within a page are known:
+ * lines at the same page offset are candidates for the same set, and timing
+ * decides which of them are.
+ */
+typedef struct llc {
+    /// Structure the timed reads go through, for its timer, probe
+    /// instruction, CPU and outlier counts
+    cache_t* cache;
+
+    /// Size of the LLC in bytes
+    size_t size;
+
+    /// Size of a cache line in bytes
+    size_t line_size;
+
+    /// Associativity of the LLC
+    size_t assoc;
+
+    /// Size of a page, the span of address bits that are the same physically
+    size_t page_size;
+
+    /// Sets in each slice, and slices, assuming `LLC_SLICE_SETS`
+    size_t slice_sets;
+    size_t nslices;
+
+    /// Sets of the L2, indexed by the physical address as well
+    size_t l2_sets;
+
+    /// The slice hash: bit `k` of the slice index is the parity of the
+    /// physical address under `slice_masks[k]`. `slice_bits` is zero if the
+    /// hash is not known, which is the case whenever `nslices` is not a power
+    /// of two. It is either known for the CPU or recovered by
+    /// `llc_recover_slices()`.
+    int slice_bits;
+    uint64_t slice_masks[LLC_MAX_SLICE_BITS];
+
+    /// Physical address of each page of `buffer`, from `/proc/self/pagemap`,
+    /// or NULL unless `llc_map_physical()` succeeded
+    uint64_t* phys;
+
+    /// Measured latency of a read served by the LLC
+    uint64_t hit_latency;
+
+    /// Measured latency of a read served by DRAM
+    uint64_t miss_latency;
+
+    /// Midpoint of the two
+    uint64_t hit_threshold;
+
+    /// Upper bound on a plausible timed read, as `cache->outlier_threshold`
+    uint64_t outlier_threshold;
+
+    /// Candidate lines, `LLC_BUFFER_FACTOR` times the size of the LLC
+    size_t buffer_size;
+    uint8_t* buffer;
+
+    /// Bitmap over the lines of `buffer` marking those eviction sets have
+    /// taken, which `llc_signal()` leaves alone
+    uint64_t* reserved;
+
+    /// Lines read to push a line out of the L1 and L2 but not the LLC,
+    /// `LLC_PRIVATE_FACTOR` times the size of the L2
+    size_t private_size;
+    uint8_t* private_buffer;
+} llc_t;
+
+extern const uint64_t llc_intel_slice_masks[LLC_INTEL_SLICE_MASKS];
+
+int llc_init(llc_t* llc, cache_t* cache);
+void llc_deinit(llc_t* llc);
+void llc_touch_page(uint8_t* ptr, size_t page_size);
+int llc_calibrate(llc_t* llc);
+int llc_map_physical(llc_t* llc);
+uint64_t llc_physical(const llc_t* llc, const uint8_t* ptr);
+size_t llc_set_of(const llc_t* llc, uint64_t paddr);
+size_t llc_l2_set_of(const llc_t* llc, uint64_t paddr);
+int llc_slice_of(const llc_t* llc, uint64_t paddr);
+int llc_recover_slices(llc_t* llc, size_t offset, llc_slice_report_t* report);
+bool llc_fit_slices(const llc_t* llc, uint8_t* const* lines, size_t n,
+                    const int* slice, uint8_t* const* reps, size_t nslices,
+                    uint64_t* masks, int* nbits);
+size_t llc_pool_size(const llc_t* llc);
+uint8_t* llc_pool_line(const llc_t* llc, size_t offset, size_t k);
+bool llc_evicts(llc_t* llc, uint8_t* victim, uint8_t* const* lines,
+                size_t nlines);
+int llc_evset_init(llc_evset_t* evset, size_t assoc);
+void llc_evset_deinit(llc_evset_t* evset);
+void llc_reduce(llc_t* llc, llc_evset_t* evset, uint8_t* victim,
+                uint8_t** cand, size_t* n, uint8_t** scratch);
+int llc_build_evsets(llc_t* llc, size_t offset, llc_evset_t* evsets,
+                     size_t count);
+int llc_build_evset(llc_t* llc, size_t offset, llc_evset_t* evset);
+void llc_prime(const llc_evset_t* evset);
+int llc_probe(llc_t* llc, const llc_evset_t* evset, uint64_t* durs,
+              size_t* valid);
+void llc_signal(llc_t* llc, size_t offset);
+
+#endif
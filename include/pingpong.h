@@ -0,0 +1,57 @@
+#ifndef COVERT_PINGPONG_H
+#define COVERT_PINGPONG_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/// Round trips each trial times between a pair of CPUs
+#define PINGPONG_ROUNDS 1000
+
+/// Trials per pair, of which the median is kept
+#define PINGPONG_TRIALS 7
+
+/// Most tiers of the cluster view, from the closest pairs outwards
+#define PINGPONG_MAX_TIERS 4
+
+/// Ratio between consecutive round trips, sorted, that separates two tiers
+#define PINGPONG_TIER_GAP 1.3
+
+/**
+ * Outcome of `pingpong_measure()`: the round trip of a cache line between
+ * every pair of CPUs, and the clusters of CPUs that are closer to each other
+ * than to the rest. On chiplet parts the tiers are SMT siblings, the cores of
+ * a CCX sharing an L3, and the dies or sockets beyond.
+ */
+typedef struct pingpong {
+    /// One more than the highest CPU measured, the row length of `rtt`
+    int ncpus;
+
+    /// CPUs that took part
+    cpu_set_t cpus;
+
+    /// TSC ticks for the line to travel from CPU `a` to CPU `b` and back, at
+    /// `rtt[a * ncpus + b]`, or zero for pairs that were not measured
+    uint64_t* rtt;
+
+    /// Largest round trip within each tier, closest tier first. Each tier
+    /// ends at a gap of `PINGPONG_TIER_GAP` in the sorted round trips, and
+    /// the pairs beyond the last gap, which would join every CPU into one
+    /// cluster, are not a tier.
+    uint64_t tier_latency[PINGPONG_MAX_TIERS];
+    size_t ntiers;
+
+    /// Cluster of each CPU in each tier at `clusters[tier * ncpus + cpu]`,
+    /// numbered from zero in order of their lowest CPU, or -1 for CPUs that
+    /// did not take part; and how many clusters each tier has
+    int* clusters;
+    int nclusters[PINGPONG_MAX_TIERS];
+} pingpong_t;
+
+int pingpong_measure(cache_t* cache, const cpu_set_t* cpus, pingpong_t* pp);
+void pingpong_deinit(pingpong_t* pp);
+uint64_t pingpong_rtt(const pingpong_t* pp, int a, int b);
+
+#endif
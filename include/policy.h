@@ -0,0 +1,35 @@
+#ifndef COVERT_POLICY_H
+#define COVERT_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/**
+ * Outcome of `policy_infer()`
+ */
+typedef struct policy_report {
+    /// Median latency of a read that hits in the L1
+    uint64_t hit_median;
+
+    /// Median latency of a read of a line evicted from the L1 by conflicts
+    uint64_t evicted_median;
+
+    /// Latency separating the two, used to classify the experiments
+    uint64_t threshold;
+
+    /// Root mean square difference between the measured miss rates and
+    /// those each policy predicts
+    double error[CACHE_NPOLICIES];
+
+    /// Policy with the smallest error
+    cache_policy_t best;
+
+    /// Whether `best` fits well enough to be trusted
+    bool confident;
+} policy_report_t;
+
+int policy_infer(cache_t* cache, size_t setno, policy_report_t* report);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef COVERT_PRIME_H
+#define COVERT_PRIME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cache.h"
+
+/**
+ * A prime in the parameterised form of the eviction strategy literature: a
+ * window of `window` consecutive lines slides one line at a time over the
+ * first `lines` lines of a set, and each window is accessed `repeat` times
+ * before it moves on. A window as wide as `lines` makes `repeat` plain passes.
+ *
+ * `prime_optimise()` fills in the rest.
+ */
+typedef struct prime_pattern {
+    /// Distinct lines touched, at least the associativity
+    size_t lines;
+
+    /// Lines accessed together before the window moves
+    size_t window;
+
+    /// Times each window is accessed
+    size_t repeat;
+
+    /// Number of accesses the prime makes
+    size_t len;
+
+    /// Whether the probe reads the lines last primed first
+    bool probe_reverse;
+
+    /// Fraction of simulated starting states after which the prime left
+    /// exactly the probed lines in the set
+    double eviction;
+
+    /// Fraction of simulated probes whose miss count matched the number of
+    /// lines another process evicted
+    double accuracy;
+} prime_pattern_t;
+
+size_t prime_pattern_build(const prime_pattern_t* pattern, size_t* seq);
+int prime_optimise(cache_t* cache, prime_pattern_t* best);
+size_t prime_passes(cache_policy_t policy, size_t assoc);
+
+#endif
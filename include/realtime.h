@@ -0,0 +1,10 @@
+#ifndef COVERT_REALTIME_H
+#define COVERT_REALTIME_H
+
+#include <stddef.h>
+
+int realtime_enter(int cpuno);
+void realtime_prefault(void* ptr, size_t size);
+void realtime_prefault_stack(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef COVERT_SIM_H
+#define COVERT_SIM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/// Marks an entry of a `sim_predict()` sequence as a flush rather than an
+/// access
+#define SIM_FLUSH ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+/**
+ * Parameters of the simulated cache
+ */
+typedef struct sim_config {
+    /// Size of the cache in bytes
+    size_t size;
+
+    /// Size of a cache line in bytes
+    size_t line_size;
+
+    /// Number of ways in a set
+    size_t assoc;
+
+    cache_policy_t policy;
+
+    /// Latency of a timed read of nothing, the cost of the timer alone, which
+    /// the read latencies below include
+    uint64_t timer_latency;
+
+    /// Latency of a timed read that hits
+    uint64_t hit_latency;
+
+    /// Latency of a timed read that misses
+    uint64_t miss_latency;
+
+    /// Latencies of timed flushes of a cached and of an uncached line
+    uint64_t flush_hit_latency;
+    uint64_t flush_miss_latency;
+
+    /// Each timed read takes up to this many extra ticks, uniformly
+    uint64_t noise;
+
+    /// Probability, in parts per million, of a timed read being stretched by
+    /// a simulated interrupt
+    uint32_t outlier_ppm;
+
+    /// Extra ticks taken by an interrupted read
+    uint64_t outlier_latency;
+
+    /// Ticks the clock advances each time it is read, so spin loops end
+    uint64_t clock_step;
+
+    /// Seed of the random number generator. Runs with the same seed and
+    /// configuration are identical.
+    uint64_t seed;
+} sim_config_t;
+
+void sim_default_config(sim_config_t* config);
+void sim_host_geometry(sim_config_t* config);
+int sim_init(const sim_config_t* config);
+void sim_deinit(void);
+void sim_reset(void);
+uint64_t sim_random(uint64_t* rng);
+void sim_predict(cache_policy_t policy, size_t assoc, const size_t* seq,
+                 size_t len, uint64_t seed, bool* present, size_t nlines,
+                 bool* hits);
+
+#endif
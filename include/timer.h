@@ -0,0 +1,13 @@
+#ifndef COVERT_TIMER_H
+#define COVERT_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+bool timer_available(cache_timer_t timer);
+uint64_t timer_read(cache_timer_t timer, uint8_t* ptr, int* cpu);
+void timer_release(void);
+
+#endif
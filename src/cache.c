@@ -0,0 +1,1429 @@
+#include "cache.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "llc.h"
+#include "prime.h"
+#include "timer.h"
+
+/**!
+ * Returns the discrete log of the value `n` rounded down to the nearest whole
+ * number. Equivallently, returns the position of the most significant one.
+ *
+ * `n` is assumed to be non-zero.
+ *
+ * Yes, I know there's a branchless algorithm to do this.
+ */
+uint32_t dlog2(size_t n)
+{
+    uint32_t k = 0;
+
+    while (n != 0) {
+        n >>= 1;
+        k += 1;
+    }
+
+    return k - 1;
+}
+
+/**
+ * Executes the CLFLUSH instruction for the byte at `ptr`.
+ *
+ * The MFENCE was necessary to observe precise timings for `timed_read()`.
+ */
+void clflush(uint8_t* ptr)
+{
+    __asm__ __volatile__(
+        "clflush (%[ptr])\n"
+        "mfence\n"
+        :
+        : [ptr] "r"(ptr));
+}
+
+/**
+ * Simply reads from the byte and throws it away.
+ *
+ * Probably can be more simply done with a volatile read of `ptr`.
+ */
+static void hw_fill(uint8_t* ptr)
+{
+    __asm__ __volatile__("mov (%[ptr]), %%al\n" : : [ptr] "r"(ptr) : "rax");
+}
+
+/**
+ * Times a read to the byte at `ptr`, or nothing at all if it is NULL, with
+ * the kernel of `timer`. See `timer_read()` for the meaning of `*cpu`.
+ */
+static uint64_t hw_timed_read(uint8_t* ptr, cache_timer_t timer, int* cpu)
+{
+    return timer_read(timer, ptr, cpu);
+}
+
+/**
+ * Times a CLFLUSH of the line holding `ptr`, the probe of Flush+Flush. How
+ * long the flush takes to retire depends on whether the line was cached: on
+ * Intel parts writing it back makes it slower, while others have been seen to
+ * return early for a cached line and take longer to look for an uncached one.
+ *
+ * The MFENCE holds back the second timestamp until the flush has completed;
+ * the LFENCEs keep the measurement from starting early or the code after it
+ * from overlapping. `*cpu` is set as by the RDTSCP kernel of `timer_read()`.
+ */
+static uint64_t hw_timed_flush(uint8_t* ptr, int* cpu)
+{
+    uint64_t t0[2];
+    uint64_t t1[2];
+    uint32_t aux0;
+    uint32_t aux1;
+
+    __asm__ __volatile__(
+        "mfence\n"
+        "rdtscp\n"
+        "lfence\n"
+        "mov %%rax, %[t0_0]\n"
+        "mov %%rdx, %[t0_1]\n"
+        "mov %%ecx, %[aux0]\n"
+        "clflush (%[ptr])\n"
+        "mfence\n"
+        "rdtscp\n"
+        "lfence\n"
+        "mov %%rax, %[t1_0]\n"
+        "mov %%rdx, %[t1_1]\n"
+        : [t0_0] "=&r"(t0[0]), [t0_1] "=&r"(t0[1]), [aux0] "=&r"(aux0),
+          [t1_0] "=g"(t1[0]), [t1_1] "=g"(t1[1]), [aux1] "=c"(aux1)
+        : [ptr] "r"(ptr)
+        : "rax", "rdx", "memory");
+
+    *cpu = (aux0 == aux1) ? (int)(aux1 & TSC_AUX_CPU_MASK) : CPU_MIGRATED;
+
+    return (t1[0] | (t1[1] << 32)) - (t0[0] | (t0[1] << 32));
+}
+
+/**
+ * Defines `hw_timed_<name>()`, which times the prefetch instruction `insn` on
+ * the byte at `ptr` exactly as the RDTSCP kernel of `timer_read()` times a
+ * load.
+ */
+#define HW_TIMED_PREFETCH(name, insn)                                        \
+    static uint64_t hw_timed_##name(uint8_t* ptr, int* cpu)                  \
+    {                                                                        \
+        uint64_t t0[2];                                                      \
+        uint64_t t1[2];                                                      \
+        uint32_t aux0;                                                       \
+        uint32_t aux1;                                                       \
+                                                                             \
+        __asm__ __volatile__(                                                \
+            "rdtscp\n"                                                       \
+            "lfence\n"                                                       \
+            "mov %%rax, %[t0_0]\n"                                           \
+            "mov %%rdx, %[t0_1]\n"                                           \
+            "mov %%ecx, %[aux0]\n" insn " (%[ptr])\n"                        \
+            "rdtscp\n"                                                       \
+            "lfence\n"                                                       \
+            "mov %%rax, %[t1_0]\n"                                           \
+            "mov %%rdx, %[t1_1]\n"                                           \
+            : [t0_0] "=&r"(t0[0]), [t0_1] "=&r"(t0[1]), [aux0] "=&r"(aux0),  \
+              [t1_0] "=g"(t1[0]), [t1_1] "=g"(t1[1]), [aux1] "=c"(aux1)      \
+            : [ptr] "r"(ptr)                                                 \
+            : "rax", "rdx");                                                 \
+                                                                             \
+        *cpu = (aux0 == aux1) ? (int)(aux1 & TSC_AUX_CPU_MASK)               \
+                              : CPU_MIGRATED;                                \
+                                                                             \
+        return (t1[0] | (t1[1] << 32)) - (t0[0] | (t0[1] << 32));            \
+    }
+
+HW_TIMED_PREFETCH(prefetcht0, "prefetcht0")
+HW_TIMED_PREFETCH(prefetchnta, "prefetchnta")
+HW_TIMED_PREFETCH(prefetchw, "prefetchw")
+
+/**
+ * Times the prefetch `probe` of the byte at `ptr`. Parts without PREFETCHW
+ * execute it as a no-op, which `cache_select_probe()` then finds useless.
+ */
+static uint64_t hw_timed_prefetch(uint8_t* ptr, cache_probe_t probe, int* cpu)
+{
+    switch (probe) {
+        case CACHE_PROBE_PREFETCHT0:
+            return hw_timed_prefetcht0(ptr, cpu);
+        case CACHE_PROBE_PREFETCHNTA:
+            return hw_timed_prefetchnta(ptr, cpu);
+        case CACHE_PROBE_PREFETCHW:
+            return hw_timed_prefetchw(ptr, cpu);
+        default:
+            return timer_read(CACHE_TIMER_RDTSCP, ptr, cpu);
+    }
+}
+
+/**
+ * Reads the timestamp counter once earlier instructions have completed.
+ */
+uint64_t rdtsc(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ __volatile__("lfence\n"
+                         "rdtsc\n"
+                         : "=a"(lo), "=d"(hi));
+
+    return lo | ((uint64_t)hi << 32);
+}
+
+/**
+ * Reads the timestamp counter once earlier loads, stores and flushes have
+ * completed, which LFENCE does not wait for, and before later instructions
+ * start. A pair of these brackets a CLFLUSH as `timed_flush()` does.
+ */
+uint64_t rdtsc_fenced(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ __volatile__("mfence\n"
+                         "rdtscp\n"
+                         "lfence\n"
+                         : "=a"(lo), "=d"(hi)
+                         :
+                         : "rcx", "memory");
+
+    return lo | ((uint64_t)hi << 32);
+}
+
+const char* const cache_policy_names[CACHE_NPOLICIES] = {
+    [CACHE_POLICY_LRU] = "lru",
+    [CACHE_POLICY_PLRU] = "plru",
+    [CACHE_POLICY_RANDOM] = "random",
+};
+
+const char* const cache_probe_names[CACHE_NPROBES] = {
+    [CACHE_PROBE_LOAD] = "load",
+    [CACHE_PROBE_PREFETCHT0] = "prefetcht0",
+    [CACHE_PROBE_PREFETCHNTA] = "prefetchnta",
+    [CACHE_PROBE_PREFETCHW] = "prefetchw",
+};
+
+const char* const cache_level_names[CACHE_NLEVELS] = {
+    [CACHE_LEVEL_L1] = "l1",
+    [CACHE_LEVEL_L2] = "l2",
+    [CACHE_LEVEL_LLC] = "llc",
+    [CACHE_LEVEL_DRAM] = "dram",
+};
+
+const char* const cache_timer_names[CACHE_NTIMERS] = {
+    [CACHE_TIMER_RDTSCP] = "rdtscp",
+    [CACHE_TIMER_LFENCE] = "lfence",
+    [CACHE_TIMER_MFENCE] = "mfence",
+    [CACHE_TIMER_CPUID] = "cpuid",
+    [CACHE_TIMER_RDPMC] = "rdpmc",
+};
+
+/**
+ * The geometry of the L1D of the host, as the C library reports it
+ */
+static void hw_geometry(size_t* size, size_t* line_size, size_t* assoc)
+{
+    *size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    *line_size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    *assoc = sysconf(_SC_LEVEL1_DCACHE_ASSOC);
+}
+
+/// The real thing
+const cache_backend_t cache_backend_hw = {
+    .name = "hardware",
+    .fill = hw_fill,
+    .flush = clflush,
+    .timed_read = hw_timed_read,
+    .timed_flush = hw_timed_flush,
+    .timed_prefetch = hw_timed_prefetch,
+    .clock = rdtsc,
+    .geometry = hw_geometry,
+};
+
+const cache_backend_t* cache_backend = &cache_backend_hw;
+
+/**
+ * Flushes the line holding the byte at `ptr` from every level of the cache
+ * through the current backend.
+ */
+void cache_flush(uint8_t* ptr)
+{
+    cache_backend->flush(ptr);
+}
+
+/**
+ * Brings the line holding the byte at `ptr` into the cache through the
+ * current backend.
+ */
+void cache_fill(uint8_t* ptr)
+{
+    cache_backend->fill(ptr);
+}
+
+/**
+ * Times a read to the byte at `ptr` with `timer` through the current backend,
+ * or nothing at all if `ptr` is NULL. See `timer_read()` for the meaning of
+ * `*cpu`.
+ */
+uint64_t timed_read(uint8_t* ptr, cache_timer_t timer, int* cpu)
+{
+    return cache_backend->timed_read(ptr, timer, cpu);
+}
+
+/**
+ * Times a flush of the line holding `ptr` through the current backend. See
+ * `hw_timed_flush()`.
+ */
+uint64_t timed_flush(uint8_t* ptr, int* cpu)
+{
+    return cache_backend->timed_flush(ptr, cpu);
+}
+
+/**
+ * Times the prefetch `probe` of the byte at `ptr` through the current
+ * backend. `*cpu` is set as by `timed_read()`.
+ */
+uint64_t timed_prefetch(uint8_t* ptr, cache_probe_t probe, int* cpu)
+{
+    return cache_backend->timed_prefetch(ptr, probe, cpu);
+}
+
+/**
+ * Returns the current time in TSC ticks, or in simulated ticks when the
+ * simulator is the backend.
+ */
+uint64_t cache_clock(void)
+{
+    return cache_backend->clock();
+}
+
+/**
+ * Times a read to the byte at `ptr` with the instruction `cache->probe` and,
+ * for a load, with `cache->timer`, rejecting the sample unless it was taken
+ * entirely on `cache->cpu` or the timer cannot tell. A NULL `ptr` times
+ * nothing at all with the timer the probe would use.
+ *
+ * Returns 0 and stores the latency in `*dur`, or -1 if the sample was
+ * discarded, in which case `cache->migrations` is incremented.
+ */
+int cache_timed_read(cache_t* cache, uint8_t* ptr, uint64_t* dur)
+{
+    cache_timer_t timer = (cache->probe == CACHE_PROBE_LOAD)
+                              ? cache->timer
+                              : CACHE_TIMER_RDTSCP;
+    int cpu;
+
+    if (ptr == NULL || cache->probe == CACHE_PROBE_LOAD) {
+        *dur = timed_read(ptr, timer, &cpu);
+    } else {
+        *dur = timed_prefetch(ptr, cache->probe, &cpu);
+    }
+
+    if (cpu != cache->cpu && cpu != CPU_UNKNOWN) {
+        cache->migrations += 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Times a flush of the line holding `ptr`, rejecting the sample unless it was
+ * taken entirely on `cache->cpu`, as `cache_timed_read()` does. The line is
+ * left flushed either way.
+ */
+int cache_timed_flush(cache_t* cache, uint8_t* ptr, uint64_t* dur)
+{
+    int cpu;
+
+    *dur = timed_flush(ptr, &cpu);
+
+    if (cpu != cache->cpu) {
+        cache->migrations += 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/// Factor by which a prefetch must beat the signal to noise ratio of a load,
+/// or a timer that of RDTSCP, to replace it
+#define CACHE_SELECT_MARGIN 1.1
+
+/**
+ * Comparison function for sorting `uint64_t`s with `qsort()`.
+ */
+int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Returns the `pct`th percentile of the `n` samples in `sorted`.
+ */
+uint64_t percentile(const uint64_t* sorted, int n, int pct)
+{
+    return sorted[(size_t)(n - 1) * pct / 100];
+}
+
+/**
+ * Collects `n` latencies of reads to `ptr` into `samples`, sorted. The line is
+ * flushed before each read if `flush` is set, and filled otherwise. With
+ * `by_flush` set, the line is timed being flushed rather than read. A NULL
+ * `ptr` times nothing at all, for the overhead of `cache->timer`.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations.
+ */
+static int cache_sample(cache_t* cache, uint8_t* ptr, bool flush,
+                        bool by_flush, uint64_t* samples, int n)
+{
+    // Give up if most samples keep landing on another CPU; the thread is
+    // clearly not staying put.
+    int maxattempts = 4 * n;
+    int trial = 0;
+
+    for (int attempt = 0; trial < n && attempt < maxattempts; attempt++) {
+        if (ptr == NULL) {
+            // Nothing to prepare
+        } else if (flush) {
+            cache_flush(ptr);
+        } else {
+            cache_fill(ptr);
+        }
+
+        int ret = by_flush ? cache_timed_flush(cache, ptr, &samples[trial])
+                           : cache_timed_read(cache, ptr, &samples[trial]);
+
+        if (ret == 0) {
+            trial += 1;
+        }
+    }
+
+    if (trial < n) {
+        return -1;
+    }
+
+    qsort(samples, n, sizeof(*samples), compare_u64);
+
+    return 0;
+}
+
+/**
+ * Stores the mean of the sorted `samples` that do not exceed `bound` in
+ * `*mean`, and adds the number that do to `*rejected`.
+ *
+ * Returns -1 if every sample does.
+ */
+static int mean_below(const uint64_t* samples, int n, uint64_t bound,
+                      uint64_t* rejected, uint64_t* mean)
+{
+    uint64_t sum = 0;
+    int k;
+
+    for (k = 0; k < n && samples[k] <= bound; k++) {
+        sum += samples[k];
+    }
+
+    *rejected += n - k;
+
+    if (k == 0) {
+        return -1;
+    }
+
+    *mean = sum / k;
+
+    return 0;
+}
+
+/**
+ * Measures the hit and miss latencies of `cache->buffer` and derives the
+ * thresholds used to classify timed reads.
+ *
+ * An interrupt landing inside a timed read costs thousands of cycles, which
+ * would drag the means far off. The outlier bound is set at
+ * `CACHE_OUTLIER_FACTOR` times the median miss latency, which a genuine miss
+ * (even one served from DRAM) never reaches, and samples beyond it are left
+ * out of both means. Should every hit lie beyond it, or the misses come out
+ * no slower than the hits, there is nothing to calibrate on and this returns
+ * -1.
+ *
+ * The levels beyond the L1 are left alone; `cache_calibrate()` takes them
+ * too.
+ */
+int cache_calibrate_l1(cache_t* cache)
+{
+    enum { NTRIALS = 1024 };
+    uint64_t hits[NTRIALS];
+    uint64_t misses[NTRIALS];
+
+    if (cache_sample(cache, cache->buffer, false, false, hits, NTRIALS) != 0) {
+        return -1;
+    }
+
+    if (cache_sample(cache, cache->buffer, true, false, misses, NTRIALS) != 0) {
+        return -1;
+    }
+
+    cache->outlier_threshold =
+        CACHE_OUTLIER_FACTOR * percentile(misses, NTRIALS, 50);
+
+    if (mean_below(hits, NTRIALS, cache->outlier_threshold, &cache->outliers,
+                   &cache->hit_latency) != 0 ||
+        mean_below(misses, NTRIALS, cache->outlier_threshold,
+                   &cache->outliers, &cache->miss_latency) != 0 ||
+        cache->miss_latency <= cache->hit_latency) {
+        return -1;
+    }
+
+    cache->hit_threshold = (cache->hit_latency + cache->miss_latency) / 2;
+
+    return cache_measure_overhead(cache);
+}
+
+/**
+ * Calibrates `cache` as `cache_calibrate_l1()` does, then measures the
+ * latency of each level of the memory hierarchy with
+ * `cache_calibrate_levels()`.
+ */
+int cache_calibrate(cache_t* cache)
+{
+    if (cache_calibrate_l1(cache) != 0) {
+        return -1;
+    }
+
+    return cache_calibrate_levels(cache);
+}
+
+/**
+ * Measures the baseline of every timed read: the latency of timing nothing
+ * with the timer `cache->probe` is timed with. The median becomes
+ * `cache->timer_overhead` and the spread from the 1st to the 99th percentile
+ * `cache->noise_floor`. `cache_calibrate()` does this once the latencies are
+ * known.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations.
+ */
+int cache_measure_overhead(cache_t* cache)
+{
+    enum { NTRIALS = 1024 };
+    uint64_t empty[NTRIALS];
+
+    if (cache_sample(cache, NULL, false, false, empty, NTRIALS) != 0) {
+        return -1;
+    }
+
+    cache->timer_overhead = percentile(empty, NTRIALS, 50);
+    cache->noise_floor =
+        percentile(empty, NTRIALS, 99) - percentile(empty, NTRIALS, 1);
+
+    return 0;
+}
+
+/**
+ * Collects `n` latencies of reads of the first line of `cache->buffer` served
+ * by `level` into `samples`, sorted. The line is filled and then pushed out of
+ * the levels above: out of the L1 by four passes over twice as many lines of
+ * its set as there are ways, out of the L2 as well by reading every line of
+ * `evict`, `evict_size` bytes of at least four times the L2, at its page
+ * offset, or out of everything by a flush. The passes only empty the L1 set
+ * because `cache_init()` writes every way of the buffer, so that no two of
+ * those lines share the zero page.
+ *
+ * The line half a page away is read last, so that a TLB miss after all those
+ * pages does not count towards the latency.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations.
+ */
+static int cache_sample_level(cache_t* cache, cache_level_t level,
+                              uint8_t* evict, size_t evict_size,
+                              uint64_t* samples, int n)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint8_t* ptr = cache->buffer;
+    int maxattempts = 4 * n;
+    int trial = 0;
+
+    for (int attempt = 0; trial < n && attempt < maxattempts; attempt++) {
+        if (level == CACHE_LEVEL_DRAM) {
+            cache_flush(ptr);
+        } else {
+            cache_fill(ptr);
+        }
+
+        if (level == CACHE_LEVEL_L2 || level == CACHE_LEVEL_LLC) {
+            for (int pass = 0; pass < 4; pass++) {
+                for (size_t k = 1; k <= 2 * cache->assoc; k++) {
+                    cache_fill(cache_line(cache, 0, k));
+                }
+            }
+        }
+
+        if (level == CACHE_LEVEL_LLC) {
+            for (size_t k = 0; k < evict_size; k += page_size) {
+                cache_fill(evict + k);
+            }
+        }
+
+        llc_touch_page(ptr, page_size);
+
+        if (cache_timed_read(cache, ptr, &samples[trial]) == 0) {
+            trial += 1;
+        }
+    }
+
+    if (trial < n) {
+        return -1;
+    }
+
+    qsort(samples, n, sizeof(*samples), compare_u64);
+
+    return 0;
+}
+
+/**
+ * Measures the median latency of a read served by each level of the memory
+ * hierarchy into `cache->level_latency`, so that `cache_classify()` can tell
+ * which one served a read rather than only whether the L1 did, and that of
+ * the L2 into `cache->evict_latency`. `cache_calibrate()` does this as its
+ * last step.
+ *
+ * A level whose median does not fall between those of the levels around it,
+ * by more than `cache->noise_floor`, cannot be told apart from them and is
+ * left at zero: the L2 and LLC under the simulator, which only has an L1, and
+ * the LLC if the CPU does not report the size of its L2.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations or memory runs
+ * out.
+ */
+int cache_calibrate_levels(cache_t* cache)
+{
+    enum { NTRIALS = 256 };
+    uint64_t samples[NTRIALS];
+    long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    size_t evict_size = l2_size > 0 ? 4 * l2_size : 0;
+    uint8_t* evict = NULL;
+
+    if (evict_size != 0) {
+        evict = aligned_alloc(sysconf(_SC_PAGESIZE), evict_size);
+
+        if (evict == NULL) {
+            return -1;
+        }
+
+        memset(evict, 1, evict_size);
+    }
+
+    for (int level = 0; level < CACHE_NLEVELS; level++) {
+        cache->level_latency[level] = 0;
+
+        if (level == CACHE_LEVEL_LLC && evict == NULL) {
+            continue;
+        }
+
+        if (cache_sample_level(cache, level, evict, evict_size, samples,
+                               NTRIALS) != 0) {
+            free(evict);
+            return -1;
+        }
+
+        cache->level_latency[level] = percentile(samples, NTRIALS, 50);
+    }
+
+    free(evict);
+
+    // Lines pushed out of the L1 by fills of their set are what the receiver
+    // of a prime+probe channel has to see, whether or not the L2 can be told
+    // apart from the L1 by more than the noise floor below
+    cache_set_evict(cache, cache->level_latency[CACHE_LEVEL_L2]);
+
+    // Each level has to be slower than the last one kept and faster than
+    // DRAM, by more than the noise floor
+    uint64_t* latency = cache->level_latency;
+    uint64_t floor = cache->noise_floor;
+    int last = CACHE_LEVEL_L1;
+
+    for (int level = CACHE_LEVEL_L2; level < CACHE_LEVEL_DRAM; level++) {
+        if (latency[level] <= latency[last] + floor ||
+            latency[level] + floor >= latency[CACHE_LEVEL_DRAM]) {
+            latency[level] = 0;
+        } else {
+            last = level;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Returns the level of the memory hierarchy that most likely served a read
+ * that took `dur`: the one whose calibrated latency is nearest, among those
+ * `cache_calibrate_levels()` could tell apart. Until then, reads are only
+ * told apart by `cache->hit_threshold`, as L1 hits or DRAM.
+ */
+cache_level_t cache_classify(const cache_t* cache, uint64_t dur)
+{
+    const uint64_t* latency = cache->level_latency;
+    int level = CACHE_LEVEL_L1;
+
+    if (latency[CACHE_LEVEL_L1] == 0 || latency[CACHE_LEVEL_DRAM] == 0) {
+        return dur <= cache->hit_threshold ? CACHE_LEVEL_L1 : CACHE_LEVEL_DRAM;
+    }
+
+    for (int next = CACHE_LEVEL_L2; next < CACHE_NLEVELS; next++) {
+        if (latency[next] == 0) {
+            continue;
+        }
+
+        if (dur <= (latency[level] + latency[next]) / 2) {
+            break;
+        }
+
+        level = next;
+    }
+
+    return level;
+}
+
+/**
+ * Returns `latency` less `cache->timer_overhead`: what the access itself
+ * took, as near as can be told.
+ */
+uint64_t cache_net(const cache_t* cache, uint64_t latency)
+{
+    return latency > cache->timer_overhead ? latency - cache->timer_overhead
+                                           : 0;
+}
+
+/**
+ * Returns a difference in latency `gap` in multiples of `cache->noise_floor`.
+ * A floor under one tick, as the simulator without noise has, counts as one.
+ * The gap is signed, so that latencies the wrong way round show up as such.
+ *
+ * A gap between hits and misses of only a few floors leaves a single read
+ * little room for error; it takes many to read symbols from single probes.
+ */
+double cache_floors(const cache_t* cache, int64_t gap)
+{
+    return (double)gap / (cache->noise_floor > 0 ? cache->noise_floor : 1);
+}
+
+/**
+ * Looks up the probe instruction called `name`.
+ *
+ * Returns -1 if there is no such instruction.
+ */
+int cache_parse_probe(const char* name, cache_probe_t* probe)
+{
+    for (int k = 0; k < CACHE_NPROBES; k++) {
+        if (strcmp(name, cache_probe_names[k]) == 0) {
+            *probe = k;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Stores the mean and variance of the sorted `samples` that do not exceed
+ * `bound` in `*mean` and `*var`.
+ */
+static void moments_below(const uint64_t* samples, int n, uint64_t bound,
+                          double* mean, double* var)
+{
+    double sum = 0;
+    double sumsq = 0;
+    int k;
+
+    for (k = 0; k < n && samples[k] <= bound; k++) {
+        sum += samples[k];
+        sumsq += (double)samples[k] * samples[k];
+    }
+
+    *mean = (k > 0) ? sum / k : 0;
+    *var = (k > 0) ? sumsq / k - *mean * *mean : 0;
+}
+
+/**
+ * Times `NTRIALS` hits and misses with the current probe and timer, and
+ * stores the gap between the mean miss and hit latencies over the spread of
+ * the two together in `*snr`.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations.
+ */
+static int cache_separation(cache_t* cache, double* snr)
+{
+    enum { NTRIALS = 256 };
+    uint64_t hits[NTRIALS];
+    uint64_t misses[NTRIALS];
+    double hit_mean;
+    double hit_var;
+    double miss_mean;
+    double miss_var;
+
+    if (cache_sample(cache, cache->buffer, false, false, hits, NTRIALS) != 0 ||
+        cache_sample(cache, cache->buffer, true, false, misses, NTRIALS) != 0) {
+        return -1;
+    }
+
+    uint64_t bound = 2 * percentile(misses, NTRIALS, 99);
+
+    moments_below(hits, NTRIALS, bound, &hit_mean, &hit_var);
+    moments_below(misses, NTRIALS, bound, &miss_mean, &miss_var);
+
+    *snr = (miss_mean - hit_mean) / sqrt(hit_var + miss_var + 1);
+
+    return 0;
+}
+
+/**
+ * Picks the probe instruction that best separates hits from misses and makes
+ * it `cache->probe`. Unless it is NULL, `snr` receives the signal to noise
+ * ratio of every instruction: the gap between the mean miss and hit latencies
+ * over the spread of the two together.
+ *
+ * A load is kept unless a prefetch beats it by `CACHE_SELECT_MARGIN`, since
+ * the ratios of similar instructions differ by chance from run to run. Follow
+ * up with `cache_calibrate()` for the thresholds of the chosen instruction.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations.
+ */
+int cache_select_probe(cache_t* cache, double* snr)
+{
+    cache_probe_t best = CACHE_PROBE_LOAD;
+    double best_snr = 0;
+
+    for (int probe = 0; probe < CACHE_NPROBES; probe++) {
+        double ratio;
+
+        cache->probe = probe;
+
+        if (cache_separation(cache, &ratio) != 0) {
+            cache->probe = best;
+            return -1;
+        }
+
+        if (snr != NULL) {
+            snr[probe] = ratio;
+        }
+
+        if (probe == CACHE_PROBE_LOAD) {
+            best_snr = ratio * CACHE_SELECT_MARGIN;
+        } else if (ratio > best_snr) {
+            best = probe;
+            best_snr = ratio;
+        }
+    }
+
+    cache->probe = best;
+
+    return 0;
+}
+
+/**
+ * Looks up the timer called `name`.
+ *
+ * Returns -1 if there is no such timer.
+ */
+int cache_parse_timer(const char* name, cache_timer_t* timer)
+{
+    for (int k = 0; k < CACHE_NTIMERS; k++) {
+        if (strcmp(name, cache_timer_names[k]) == 0) {
+            *timer = k;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Picks the timer that best separates hits from misses of a load and makes it
+ * `cache->timer`. Unless it is NULL, `stats` receives what was measured of
+ * every timer: the overhead and jitter of timing nothing, and the signal to
+ * noise ratio as in `cache_select_probe()`.
+ *
+ * RDTSCP, the only timer that notices migrations, is kept unless another
+ * beats it by `CACHE_SELECT_MARGIN`. Timers this CPU or this thread cannot
+ * use, or that lose too many samples, are skipped. The simulator ignores the
+ * timer, so there RDTSCP is always kept. Loads are timed here whatever
+ * `cache->probe` is, and the probe is best chosen afterwards with the new
+ * timer.
+ *
+ * Returns -1 if no timer could be used.
+ */
+int cache_select_timer(cache_t* cache, cache_timer_stats_t* stats)
+{
+    enum { NTRIALS = 256 };
+    uint64_t empty[NTRIALS];
+    cache_probe_t probe = cache->probe;
+    cache_timer_t best = CACHE_TIMER_RDTSCP;
+    double best_snr = -INFINITY;
+    bool found = false;
+
+    cache->probe = CACHE_PROBE_LOAD;
+
+    for (int timer = 0; timer < CACHE_NTIMERS; timer++) {
+        cache_timer_stats_t measured = {0};
+        double var;
+
+        cache->timer = timer;
+
+        if ((cache_backend != &cache_backend_hw || timer_available(timer)) &&
+            cache_sample(cache, NULL, false, false, empty, NTRIALS) == 0 &&
+            cache_separation(cache, &measured.snr) == 0) {
+            uint64_t bound = 2 * percentile(empty, NTRIALS, 99);
+
+            moments_below(empty, NTRIALS, bound, &measured.overhead, &var);
+            measured.jitter = sqrt(var);
+            measured.available = true;
+        } else {
+            measured.snr = 0;
+        }
+
+        if (stats != NULL) {
+            stats[timer] = measured;
+        }
+
+        if (!measured.available) {
+            continue;
+        }
+
+        if (timer == CACHE_TIMER_RDTSCP) {
+            best_snr = measured.snr * CACHE_SELECT_MARGIN;
+        } else if (measured.snr > best_snr) {
+            best = timer;
+            best_snr = measured.snr;
+        }
+
+        found = true;
+    }
+
+    cache->timer = best;
+    cache->probe = probe;
+
+    return found ? 0 : -1;
+}
+
+/**
+ * Measures how long flushing the `nlines` lines of `lines` takes when they are
+ * cached and when they are not, for Flush+Flush. Latencies differ from one
+ * physical line to the next by as much as the gap itself, so calibrating on
+ * the lines that will actually be probed matters more here than for reads.
+ *
+ * The gap is only a few cycles, so the means are taken below
+ * `cache->outlier_threshold` as for reads, which needs `cache_calibrate()` or
+ * a restored calibration first.
+ *
+ * Returns -1 if `nlines` is zero or more than the 1024 samples taken, if
+ * every sample is an outlier, or if the two means come out the same.
+ */
+int cache_calibrate_flush(cache_t* cache, uint8_t* const* lines, size_t nlines)
+{
+    enum { NTRIALS = 1024 };
+    uint64_t hits[NTRIALS];
+    uint64_t misses[NTRIALS];
+
+    if (nlines == 0 || nlines > NTRIALS) {
+        return -1;
+    }
+
+    int per_line = NTRIALS / nlines;
+    int n = per_line * nlines;
+
+    for (size_t k = 0; k < nlines; k++) {
+        if (cache_sample(cache, lines[k], false, true, &hits[k * per_line],
+                         per_line) != 0 ||
+            cache_sample(cache, lines[k], true, true, &misses[k * per_line],
+                         per_line) != 0) {
+            return -1;
+        }
+    }
+
+    qsort(hits, n, sizeof(*hits), compare_u64);
+    qsort(misses, n, sizeof(*misses), compare_u64);
+
+    if (mean_below(hits, n, cache->outlier_threshold, &cache->outliers,
+                   &cache->flush_hit_latency) != 0 ||
+        mean_below(misses, n, cache->outlier_threshold, &cache->outliers,
+                   &cache->flush_miss_latency) != 0 ||
+        cache->flush_hit_latency == cache->flush_miss_latency) {
+        return -1;
+    }
+
+    cache->flush_threshold =
+        (cache->flush_hit_latency + cache->flush_miss_latency) / 2;
+
+    return 0;
+}
+
+/**
+ * Runs a quick probe to check that the current thresholds still separate hits
+ * from misses, for instance after restoring them from an earlier run.
+ *
+ * Returns 0 if at least 95% of a small number of hits and misses each are
+ * classified correctly, and -1 otherwise.
+ */
+int cache_check_calibration(cache_t* cache)
+{
+    enum { NTRIALS = 64, MAXWRONG = NTRIALS / 20 };
+    uint64_t hits[NTRIALS];
+    uint64_t misses[NTRIALS];
+    int wronghits = 0;
+    int wrongmisses = 0;
+
+    if (cache_sample(cache, cache->buffer, false, false, hits, NTRIALS) != 0) {
+        return -1;
+    }
+
+    if (cache_sample(cache, cache->buffer, true, false, misses, NTRIALS) != 0) {
+        return -1;
+    }
+
+    for (int k = 0; k < NTRIALS; k++) {
+        if (hits[k] > cache->hit_threshold) {
+            wronghits += 1;
+        }
+
+        if (misses[k] <= cache->hit_threshold ||
+            misses[k] > cache->outlier_threshold) {
+            wrongmisses += 1;
+        }
+    }
+
+    return (wronghits <= MAXWRONG && wrongmisses <= MAXWRONG) ? 0 : -1;
+}
+
+/**
+ * Initialzie the `cache` structure
+ *
+ * The calling thread should already be pinned: the CPU it runs on here becomes
+ * `cache->cpu`.
+ *
+ * The latencies and thresholds are left zeroed. Follow up with
+ * `cache_calibrate()`, or restore an earlier calibration with
+ * `calib_restore()`.
+ */
+int cache_init(cache_t* cache)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    cache_backend->geometry(&cache->size, &cache->line_size, &cache->assoc);
+
+    cache->set_size = (cache->line_size * cache->assoc);
+    cache->nsets = cache->size / cache->set_size;
+
+    cache->index_shift = dlog2(cache->line_size);
+    cache->tag_shift = dlog2(cache->nsets) + cache->index_shift;
+
+    cache->offset_mask = cache->line_size - 1;
+    cache->index_mask = (cache->nsets - 1) << cache->index_shift;
+    cache->tag_mask = (~0UL) << cache->tag_shift;
+
+    cache->cpu = sched_getcpu();
+
+    if (cache->cpu < 0) {
+        return -1;
+    }
+
+    cache->buffer_size = cache->size * cache->assoc;
+    cache->buffer = aligned_alloc(cache->size, cache->buffer_size);
+
+    if (cache->buffer == NULL) {
+        return -1;
+    }
+
+    // Every way gets its own page: untouched ones would all read the zero
+    // page, and lines of different ways would share one physical line
+    memset(cache->buffer, 0, cache->buffer_size);
+
+    cache->prime_seq =
+        calloc(CACHE_PRIME_CAPACITY(cache->assoc), sizeof(*cache->prime_seq));
+    cache->probe_seq = calloc(cache->assoc, sizeof(*cache->probe_seq));
+
+    if (cache->prime_seq == NULL || cache->probe_seq == NULL) {
+        cache_deinit(cache);
+        return -1;
+    }
+
+    cache_set_policy(cache, CACHE_POLICY_LRU);
+
+    return 0;
+}
+
+/**
+ * Looks up the replacement policy called `name`.
+ *
+ * Returns -1 if there is no such policy.
+ */
+int cache_parse_policy(const char* name, cache_policy_t* policy)
+{
+    for (int k = 0; k < CACHE_NPOLICIES; k++) {
+        if (strcmp(name, cache_policy_names[k]) == 0) {
+            *policy = k;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Chooses the fill and probe orders of `cache` for a cache with the
+ * replacement policy `policy`.
+ *
+ * These are the safe defaults: passes in address order over the first `assoc`
+ * lines of the set. One takes every way under LRU. Tree-PLRU can point back at
+ * a way filled earlier in the same pass, so it gets as many as
+ * `prime_passes()` finds against the simulator: two for eight ways, three for
+ * sixteen. With twelve, the unbalanced tree keeps some starting states from
+ * ever being cleared by plain passes, so the three that clear the most are
+ * only a best effort there. Under random replacement each pass only evicts any
+ * given foreign line with probability 1 - (1 - 1/assoc)^assoc, hence four.
+ * Probing runs last to first in every case: the ways probed first are then the
+ * most recently filled, so a miss evicts a line that has already been
+ * counted.
+ *
+ * `prime_optimise()` finds shorter orders once the policy is settled.
+ */
+void cache_set_policy(cache_t* cache, cache_policy_t policy)
+{
+    static const size_t passes[CACHE_NPOLICIES] = {
+        [CACHE_POLICY_LRU] = 1,
+        [CACHE_POLICY_RANDOM] = 4,
+    };
+    size_t assoc = cache->assoc;
+    size_t npasses = (policy == CACHE_POLICY_PLRU)
+                         ? prime_passes(policy, assoc)
+                         : passes[policy];
+    size_t prime[npasses * assoc];
+    size_t probe[assoc];
+
+    for (size_t k = 0; k < npasses * assoc; k++) {
+        prime[k] = k % assoc;
+    }
+
+    for (size_t k = 0; k < assoc; k++) {
+        probe[k] = assoc - 1 - k;
+    }
+
+    cache->policy = policy;
+    cache_set_order(cache, prime, npasses * assoc, probe);
+}
+
+/**
+ * Makes `cache_fill_set()` access the `prime_len` lines of `prime` in order,
+ * and `cache_probe_set()` read the `cache->assoc` lines of `probe`. Lines are
+ * numbered as in `cache_line()`; `prime_len` is clamped to
+ * `CACHE_PRIME_CAPACITY(cache->assoc)`.
+ */
+void cache_set_order(cache_t* cache, const size_t* prime, size_t prime_len,
+                     const size_t* probe)
+{
+    if (prime_len > CACHE_PRIME_CAPACITY(cache->assoc)) {
+        prime_len = CACHE_PRIME_CAPACITY(cache->assoc);
+    }
+
+    memcpy(cache->prime_seq, prime, prime_len * sizeof(*prime));
+    memcpy(cache->probe_seq, probe, cache->assoc * sizeof(*probe));
+    cache->prime_len = prime_len;
+}
+
+/**
+ * Returns the `way`th line of `cache->buffer` that maps to set `setno`. There
+ * are `cache->assoc` times as many of these as there are ways.
+ */
+uint8_t* cache_line(cache_t* cache, size_t setno, size_t way)
+{
+    return cache->buffer + (setno << cache->index_shift) +
+           way * (cache->nsets << cache->index_shift);
+}
+
+/**
+ *  Tear down the `cache` structure. Tearing it down again does nothing, so
+ *  a `cache_init()` that failed and cleaned up after itself may still be
+ *  followed by this.
+ */
+int cache_deinit(cache_t* cache)
+{
+    free(cache->buffer);
+    free(cache->prime_seq);
+    free(cache->probe_seq);
+
+    cache->buffer = NULL;
+    cache->prime_seq = NULL;
+    cache->probe_seq = NULL;
+
+    return 0;
+}
+
+/**
+ * Flush all ways in a set.
+ *
+ * Note: This function only makes sense when this process has filled all the
+ * ways before this call. As such, this will not likely invalidate lines filled
+ * by other proceses. If none of `cache->buffer` is present in the cache, all
+ * the CLFLUSHes are allowed to be no-ops. To invalidate lines of another
+ * process, use the `cache_fill_set()` function to *take* the lines from the
+ * other process.
+ */
+int cache_flush_set(cache_t* cache, size_t setno)
+{
+    if (setno >= cache->nsets) {
+        return -1;
+    }
+
+    uint8_t* ptr = cache->buffer + (setno << cache->index_shift);
+
+    for (size_t k = 0; k < cache->assoc; k++) {
+        cache_flush(ptr);
+        ptr += cache->nsets << cache->index_shift;
+    }
+
+    return 0;
+}
+
+/**
+ * Fill all ways in a set.
+ *
+ * This works by reading at least N distinct blocks in a given index, where N
+ * is the associativity of the cache, in the order `cache->prime_seq` gives.
+ *
+ * The order depends on `cache->policy`; see `cache_set_policy()` and
+ * `prime_optimise()`. After a probe rejected an outlier, the prime is run
+ * `cache->reprobes` extra times.
+ */
+int cache_fill_set(cache_t* cache, size_t setno)
+{
+    if (setno >= cache->nsets) {
+        return -1;
+    }
+
+    int passes = 1 + (cache->disturbed ? cache->reprobes : 0);
+
+    cache->disturbed = false;
+
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t k = 0; k < cache->prime_len; k++) {
+            cache_fill(cache_line(cache, setno, cache->prime_seq[k]));
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Performs a timed read on each block in the cache and counts how many blocks
+ * are present: no slower than `cache->evict_threshold`, since a block another
+ * process evicted is still in the L2.
+ *
+ * This is useful after a `cache_fill_set()` invocation on the same set. After
+ * that call finishes, this process `owns` all the ways in the set. Therefore,
+ * if this function is called shortly after `cache_fill_set()` on the same set,
+ * one should expect this function to return a number close to `cache->assoc`.
+ *
+ * Returns -1 if `setno` is out of range, or if the thread migrated off
+ * `cache->cpu` during the probe, since the count then describes another CPU's
+ * cache.
+ *
+ * Reads slower than `cache->outlier_threshold` are rejected and counted in
+ * `cache->outliers`, and neither count as present nor as evicted. The next
+ * `cache_fill_set()` then primes `cache->reprobes` extra times.
+ */
+int cache_count_hits(cache_t* cache, size_t setno)
+{
+    return cache_probe_set(cache, setno, NULL, NULL);
+}
+
+/**
+ * Does the work of `cache_count_hits()`, additionally storing the latency of
+ * each of the `cache->assoc` reads in `durs`, in `cache->probe_seq` order,
+ * and the number of reads that were not rejected in `*valid`, unless they are
+ * NULL. The count of present blocks is out of `*valid`.
+ */
+int cache_probe_set(cache_t* cache, size_t setno, uint64_t* durs,
+                    size_t* valid)
+{
+    if (setno >= cache->nsets) {
+        return -1;
+    }
+
+    size_t nvalid = 0;
+    int count = 0;
+
+    for (size_t n = 0; n < cache->assoc; n++) {
+        uint8_t* ptr = cache_line(cache, setno, cache->probe_seq[n]);
+        uint64_t dur;
+
+        if (cache_timed_read(cache, ptr, &dur) != 0) {
+            return -1;
+        }
+
+        if (durs != NULL) {
+            durs[n] = dur;
+        }
+
+        if (dur > cache->outlier_threshold) {
+            // The read is evidence of neither a hit nor an eviction. Probing
+            // again now would find the set as our own prime left it and
+            // lose whatever the sender evicted, so the set is only primed
+            // harder next time, in case the interrupt left lines in it.
+            cache->outliers += 1;
+            cache->disturbed = true;
+            continue;
+        }
+
+        nvalid += 1;
+
+        if (cache->level_latency[CACHE_LEVEL_L1] != 0) {
+            cache->served[cache_classify(cache, dur)] += 1;
+        }
+
+        if (cache->evict_threshold >= dur) {
+            count += 1;
+        }
+    }
+
+    if (valid != NULL) {
+        *valid = nvalid;
+    }
+
+    return count;
+}
+
+/**
+ * Moves the moving average `*avg` of a latency, and its integer part
+ * `*latency`, towards `dur` by 1/2^`shift` of the difference.
+ */
+static void track(uint64_t* avg, uint64_t* latency, uint64_t dur, int shift)
+{
+    // Averages are kept with `TRACK_FRAC_BITS` fractional bits so that small
+    // weights still register single cycle changes.
+    if (*avg == 0) {
+        *avg = *latency << TRACK_FRAC_BITS;
+    }
+
+    *avg = *avg - (*avg >> shift) + ((dur << TRACK_FRAC_BITS) >> shift);
+    *latency = *avg >> TRACK_FRAC_BITS;
+}
+
+/**
+ * Sets `cache->evict_latency` to `latency` and puts `cache->evict_threshold`
+ * midway between it and `cache->hit_latency`, or at `cache->hit_threshold`
+ * if `latency` is no slower than a hit.
+ */
+void cache_set_evict(cache_t* cache, uint64_t latency)
+{
+    cache->evict_latency = latency;
+    cache->evict_threshold = (latency > cache->hit_latency)
+                                 ? (cache->hit_latency + latency) / 2
+                                 : cache->hit_threshold;
+}
+
+/**
+ * Folds a latency `dur`, labelled a hit if `hit` is set, into the moving
+ * average of the hit latency or of the slower latency `*slow`, kept in
+ * `*slow_track`. Then moves both thresholds that depend on the hit latency.
+ *
+ * The label, not the current threshold, decides which average moves, so a
+ * threshold that starts out on the wrong side of either latency is pulled
+ * back between them. Only samples beyond the outlier bound are dropped.
+ */
+static void cache_track_pair(cache_t* cache, uint64_t dur, bool hit,
+                             uint64_t* slow_track, uint64_t* slow)
+{
+    if (cache->track_shift == 0 || dur > cache->outlier_threshold) {
+        return;
+    }
+
+    if (hit) {
+        track(&cache->hit_track, &cache->hit_latency, dur, cache->track_shift);
+    } else {
+        track(slow_track, slow, dur, cache->track_shift);
+    }
+
+    cache->hit_threshold = (cache->hit_latency + cache->miss_latency) / 2;
+
+    if (cache->evict_latency != 0) {
+        cache_set_evict(cache, cache->evict_latency);
+    }
+
+    cache->tracked += 1;
+}
+
+/**
+ * Folds a latency `dur`, known to be of a hit if `hit` is set and of a miss
+ * otherwise, into exponentially weighted moving averages of the hit and miss
+ * latencies, and moves `cache->hit_threshold` to the midpoint of the two.
+ *
+ * Each sample moves its average by 1/2^`cache->track_shift` of the
+ * difference; a shift of zero disables tracking. Thermal and frequency drift
+ * move both latency modes over minutes, which this follows without a pause
+ * for recalibration.
+ */
+void cache_track(cache_t* cache, uint64_t dur, bool hit)
+{
+    cache_track_pair(cache, dur, hit, &cache->miss_track, &cache->miss_latency);
+}
+
+/**
+ * Does for `cache->evict_threshold` what `cache_track()` does for
+ * `cache->hit_threshold`, given a latency `dur` of a probed line that was
+ * evicted from the L1 unless `hit` is set.
+ */
+void cache_track_evict(cache_t* cache, uint64_t dur, bool hit)
+{
+    if (cache->evict_latency == 0) {
+        cache_track(cache, dur, hit);
+        return;
+    }
+
+    cache_track_pair(cache, dur, hit, &cache->evict_track,
+                     &cache->evict_latency);
+}
+
+/**
+ * Classifies a flush latency `dur`, returning whether the line was cached: on
+ * the same side of `cache->flush_threshold` as `cache->flush_hit_latency`.
+ */
+bool cache_flush_cached(cache_t* cache, uint64_t dur)
+{
+    if (cache->flush_hit_latency > cache->flush_miss_latency) {
+        return dur >= cache->flush_threshold;
+    }
+
+    return dur < cache->flush_threshold;
+}
+
+/**
+ * Does for `cache->flush_threshold` what `cache_track()` does for
+ * `cache->hit_threshold`, given a flush latency `dur` of a line known to have
+ * been cached if `cached` is set.
+ */
+void cache_track_flush(cache_t* cache, uint64_t dur, bool cached)
+{
+    if (cache->track_shift == 0 || dur > cache->outlier_threshold) {
+        return;
+    }
+
+    if (cached) {
+        track(&cache->flush_hit_track, &cache->flush_hit_latency, dur,
+              cache->track_shift);
+    } else {
+        track(&cache->flush_miss_track, &cache->flush_miss_latency, dur,
+              cache->track_shift);
+    }
+
+    cache->flush_threshold =
+        (cache->flush_hit_latency + cache->flush_miss_latency) / 2;
+    cache->tracked += 1;
+}
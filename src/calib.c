@@ -0,0 +1,837 @@
+#include "calib.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "freq.h"
+#include "timer.h"
+
+/// Longest line in a calibration file
+#define CALIB_LINE_MAX 1024
+
+/**
+ * Copies the value of the `/proc/cpuinfo` line in `line` into `value` if the
+ * line is for the field `name`.
+ */
+static bool cpuinfo_field(const char* line, const char* name, char* value,
+                          size_t size)
+{
+    size_t len = strlen(name);
+
+    if (strncmp(line, name, len) != 0) {
+        return false;
+    }
+
+    const char* colon = strchr(line + len, ':');
+
+    if (colon == NULL) {
+        return false;
+    }
+
+    colon += 1;
+    colon += strspn(colon, " \t");
+
+    snprintf(value, size, "%.*s", (int)strcspn(colon, "\n"), colon);
+
+    return true;
+}
+
+/**
+ * Fills in `key` for CPU `cpuno` on the running system.
+ *
+ * Returns -1 if the CPU is missing from `/proc/cpuinfo`.
+ */
+int calib_key_init(calib_key_t* key, int cpuno)
+{
+    char line[512];
+    char vendor[32] = "unknown";
+    char family[16] = "0";
+    char model[16] = "0";
+    char stepping[16] = "0";
+    char processor[16];
+    bool found = false;
+    struct utsname uts;
+
+    memset(key, 0, sizeof(*key));
+
+    key->cpu = cpuno;
+    strcpy(key->microcode, "unknown");
+
+    FILE* file = fopen("/proc/cpuinfo", "r");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    // Fields are only taken from the block describing `cpuno`; microcode in
+    // particular can differ between CPUs while an update is rolled out.
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (cpuinfo_field(line, "processor", processor, sizeof(processor))) {
+            if (found) {
+                break;
+            }
+
+            found = (atoi(processor) == cpuno);
+        }
+
+        if (!found) {
+            continue;
+        }
+
+        cpuinfo_field(line, "vendor_id", vendor, sizeof(vendor));
+        cpuinfo_field(line, "cpu family", family, sizeof(family));
+        cpuinfo_field(line, "model\t", model, sizeof(model));
+        cpuinfo_field(line, "stepping", stepping, sizeof(stepping));
+        cpuinfo_field(line, "microcode", key->microcode,
+                      sizeof(key->microcode));
+    }
+
+    fclose(file);
+
+    if (!found) {
+        return -1;
+    }
+
+    snprintf(key->model, sizeof(key->model), "%s/%s/%s/%s", vendor, family,
+             model, stepping);
+
+    if (uname(&uts) == 0) {
+        snprintf(key->kernel, sizeof(key->kernel), "%s", uts.release);
+    } else {
+        strcpy(key->kernel, "unknown");
+    }
+
+    return 0;
+}
+
+/**
+ * Writes the default location of the calibration file into `path`:
+ * `$XDG_CACHE_HOME/covert/calibration`, falling back to `~/.cache`.
+ *
+ * Returns -1 if neither variable is set.
+ */
+int calib_default_path(char* path, size_t size)
+{
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if (xdg != NULL && xdg[0] != '\0') {
+        snprintf(path, size, "%s/covert/calibration", xdg);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(path, size, "%s/.cache/covert/calibration", home);
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Creates every missing directory leading up to the file at `path`.
+ */
+static int mkdir_parents(const char* path)
+{
+    char dir[CALIB_LINE_MAX];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    for (char* p = dir + 1; *p != '\0'; p++) {
+        if (*p != '/') {
+            continue;
+        }
+
+        *p = '\0';
+
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+
+        *p = '/';
+    }
+
+    return 0;
+}
+
+/**
+ * Reports whether the record in `line` was taken under `key`.
+ *
+ * Records are single lines of space separated `name=value` pairs, starting
+ * with the key fields.
+ */
+static bool calib_matches(const char* line, const calib_key_t* key)
+{
+    char prefix[CALIB_LINE_MAX];
+
+    snprintf(prefix, sizeof(prefix), "cpu=%d model=%s microcode=%s kernel=%s ",
+             key->cpu, key->model, key->microcode, key->kernel);
+
+    return strncmp(line, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * Reports whether the slice hash record in `line` is for the CPU model of
+ * `key`. The hash is a property of the part, so nothing else has to match.
+ */
+static bool calib_slices_match(const char* line, const calib_key_t* key)
+{
+    char prefix[CALIB_LINE_MAX];
+
+    snprintf(prefix, sizeof(prefix), "slices model=%s ", key->model);
+
+    return strncmp(line, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * Reports whether the inclusion record in `line` is for the CPU model of
+ * `key`.
+ */
+static bool calib_inclusion_match(const char* line, const calib_key_t* key)
+{
+    char prefix[CALIB_LINE_MAX];
+
+    snprintf(prefix, sizeof(prefix), "inclusion model=%s ", key->model);
+
+    return strncmp(line, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * Looks up the record for `key` in the calibration file at `path` and copies
+ * its latencies and thresholds into `cache`.
+ *
+ * Returns -1 if there is no such record, or if it was taken with a different
+ * cache geometry than `cache` has.
+ */
+int calib_load(const char* path, const calib_key_t* key, cache_t* cache)
+{
+    char line[CALIB_LINE_MAX];
+    int ret = -1;
+
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    while (ret != 0 && fgets(line, sizeof(line), file) != NULL) {
+        if (!calib_matches(line, key)) {
+            continue;
+        }
+
+        size_t size = 0;
+        size_t line_size = 0;
+        size_t assoc = 0;
+        uint64_t hit = 0;
+        uint64_t miss = 0;
+        uint64_t threshold = 0;
+        uint64_t evict = 0;
+        uint64_t outlier = 0;
+        uint64_t overhead = 0;
+        uint64_t floor = 0;
+        uint64_t levels[CACHE_NLEVELS] = {0};
+        cache_policy_t policy = cache->policy;
+        cache_probe_t probe = CACHE_PROBE_LOAD;
+        cache_timer_t timer = CACHE_TIMER_RDTSCP;
+        char* save;
+
+        for (char* field = strtok_r(line, " \n", &save); field != NULL;
+             field = strtok_r(NULL, " \n", &save)) {
+            char* eq = strchr(field, '=');
+
+            if (eq == NULL) {
+                continue;
+            }
+
+            *eq = '\0';
+            unsigned long long value = strtoull(eq + 1, NULL, 0);
+
+            if (strcmp(field, "size") == 0) {
+                size = value;
+            } else if (strcmp(field, "line") == 0) {
+                line_size = value;
+            } else if (strcmp(field, "assoc") == 0) {
+                assoc = value;
+            } else if (strcmp(field, "hit") == 0) {
+                hit = value;
+            } else if (strcmp(field, "miss") == 0) {
+                miss = value;
+            } else if (strcmp(field, "threshold") == 0) {
+                threshold = value;
+            } else if (strcmp(field, "evict") == 0) {
+                evict = value;
+            } else if (strcmp(field, "outlier") == 0) {
+                outlier = value;
+            } else if (strcmp(field, "overhead") == 0) {
+                overhead = value;
+            } else if (strcmp(field, "floor") == 0) {
+                floor = value;
+            } else if (strcmp(field, "levels") == 0) {
+                char* end = eq;
+                int level = 0;
+
+                // Comma separated, one per level from the L1 down
+                do {
+                    levels[level++] = strtoull(end + 1, &end, 0);
+                } while (*end == ',' && level < CACHE_NLEVELS);
+            } else if (strcmp(field, "policy") == 0) {
+                cache_parse_policy(eq + 1, &policy);
+            } else if (strcmp(field, "probe") == 0) {
+                cache_parse_probe(eq + 1, &probe);
+            } else if (strcmp(field, "timer") == 0) {
+                cache_parse_timer(eq + 1, &timer);
+            }
+        }
+
+        if (size != cache->size || line_size != cache->line_size ||
+            assoc != cache->assoc || threshold == 0 || outlier == 0) {
+            continue;
+        }
+
+        cache->hit_latency = hit;
+        cache->miss_latency = miss;
+        cache->hit_threshold = threshold;
+        cache_set_evict(cache, evict);
+        cache->outlier_threshold = outlier;
+        cache->timer_overhead = overhead;
+        cache->noise_floor = floor;
+        memcpy(cache->level_latency, levels, sizeof(levels));
+        cache->probe = probe;
+        cache->timer = timer;
+        cache_set_policy(cache, policy);
+
+        ret = 0;
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+/**
+ * Rewrites the file at `path` with `record` in place of every line
+ * `matches()` accepts for `key`. Other lines are kept as they are.
+ *
+ * The file is replaced atomically, so concurrent runs at worst lose one of
+ * their records.
+ */
+static int calib_replace(const char* path, const calib_key_t* key,
+                         bool (*matches)(const char*, const calib_key_t*),
+                         const char* record)
+{
+    char tmp[CALIB_LINE_MAX];
+    char line[CALIB_LINE_MAX];
+
+    if (mkdir_parents(path) != 0) {
+        return -1;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+    FILE* out = fopen(tmp, "w");
+
+    if (out == NULL) {
+        return -1;
+    }
+
+    FILE* in = fopen(path, "r");
+
+    if (in != NULL) {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (!matches(line, key)) {
+                fputs(line, out);
+            }
+        }
+
+        fclose(in);
+    }
+
+    fputs(record, out);
+
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stores the calibration in `cache` under `key` in the file at `path`,
+ * replacing any earlier record for the same key. Records for other keys are
+ * kept as they are.
+ */
+int calib_store(const char* path, const calib_key_t* key, const cache_t* cache)
+{
+    char record[CALIB_LINE_MAX];
+    const uint64_t* levels = cache->level_latency;
+
+    snprintf(record, sizeof(record),
+             "cpu=%d model=%s microcode=%s kernel=%s size=%zu line=%zu "
+             "assoc=%zu hit=%lu miss=%lu threshold=%lu evict=%lu "
+             "outlier=%lu overhead=%lu floor=%lu levels=%lu,%lu,%lu,%lu "
+             "policy=%s probe=%s timer=%s\n",
+             key->cpu, key->model, key->microcode, key->kernel, cache->size,
+             cache->line_size, cache->assoc, cache->hit_latency,
+             cache->miss_latency, cache->hit_threshold, cache->evict_latency,
+             cache->outlier_threshold, cache->timer_overhead,
+             cache->noise_floor, levels[CACHE_LEVEL_L1],
+             levels[CACHE_LEVEL_L2], levels[CACHE_LEVEL_LLC],
+             levels[CACHE_LEVEL_DRAM], cache_policy_names[cache->policy],
+             cache_probe_names[cache->probe], cache_timer_names[cache->timer]);
+
+    return calib_replace(path, key, calib_matches, record);
+}
+
+/**
+ * Looks up the slice hash stored for the CPU model of `key` in the file at
+ * `path` and installs it in `llc`.
+ *
+ * Returns -1 if there is no such record, or if it was recovered for a
+ * different number of slices than `llc` has.
+ */
+int calib_load_slices(const char* path, const calib_key_t* key, llc_t* llc)
+{
+    char line[CALIB_LINE_MAX];
+    int ret = -1;
+
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    while (ret != 0 && fgets(line, sizeof(line), file) != NULL) {
+        if (!calib_slices_match(line, key)) {
+            continue;
+        }
+
+        size_t nslices = 0;
+        uint64_t masks[LLC_MAX_SLICE_BITS];
+        int nbits = 0;
+        char* save;
+
+        for (char* field = strtok_r(line, " \n", &save); field != NULL;
+             field = strtok_r(NULL, " \n", &save)) {
+            char* eq = strchr(field, '=');
+
+            if (eq == NULL) {
+                continue;
+            }
+
+            *eq = '\0';
+
+            if (strcmp(field, "nslices") == 0) {
+                nslices = strtoull(eq + 1, NULL, 0);
+            } else if (strcmp(field, "masks") == 0 && eq[1] != '\0') {
+                char* end = eq;
+
+                // Comma separated, one per slice bit
+                do {
+                    masks[nbits++] = strtoull(end + 1, &end, 0);
+                } while (*end == ',' && nbits < LLC_MAX_SLICE_BITS);
+            }
+        }
+
+        if (nslices != llc->nslices || nslices != (size_t)1 << nbits) {
+            continue;
+        }
+
+        memcpy(llc->slice_masks, masks, nbits * sizeof(*masks));
+        llc->slice_bits = nbits;
+
+        ret = 0;
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+/**
+ * Stores the slice hash of `llc` for the CPU model of `key` in the file at
+ * `path`, replacing any earlier record for the same model.
+ */
+int calib_store_slices(const char* path, const calib_key_t* key,
+                       const llc_t* llc)
+{
+    char record[CALIB_LINE_MAX];
+    int len = snprintf(record, sizeof(record), "slices model=%s nslices=%zu "
+                       "masks=", key->model, llc->nslices);
+
+    for (int k = 0; k < llc->slice_bits; k++) {
+        len += snprintf(record + len, sizeof(record) - len, "%s%#lx",
+                        k == 0 ? "" : ",", llc->slice_masks[k]);
+    }
+
+    snprintf(record + len, sizeof(record) - len, "\n");
+
+    return calib_replace(path, key, calib_slices_match, record);
+}
+
+/**
+ * Looks up the inclusion of the cache levels stored for the CPU model of
+ * `key` in the file at `path` and copies it into `report`. Only the verdicts
+ * are stored, so the rest of `report` is zeroed.
+ *
+ * Returns -1 if there is no such record.
+ */
+int calib_load_inclusion(const char* path, const calib_key_t* key,
+                         inclusion_report_t* report)
+{
+    char line[CALIB_LINE_MAX];
+    int ret = -1;
+
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    while (ret != 0 && fgets(line, sizeof(line), file) != NULL) {
+        if (!calib_inclusion_match(line, key)) {
+            continue;
+        }
+
+        char* save;
+
+        memset(report, 0, sizeof(*report));
+
+        for (char* field = strtok_r(line, " \n", &save); field != NULL;
+             field = strtok_r(NULL, " \n", &save)) {
+            char* eq = strchr(field, '=');
+
+            if (eq == NULL) {
+                continue;
+            }
+
+            *eq = '\0';
+
+            for (int pair = 0; pair < INCLUSION_NPAIRS; pair++) {
+                if (strcmp(field, inclusion_pair_names[pair]) == 0) {
+                    inclusion_parse(eq + 1, &report->pairs[pair]);
+                }
+            }
+        }
+
+        ret = 0;
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+/**
+ * Stores the inclusion verdicts of `report` for the CPU model of `key` in the
+ * file at `path`, replacing any earlier record for the same model.
+ */
+int calib_store_inclusion(const char* path, const calib_key_t* key,
+                          const inclusion_report_t* report)
+{
+    char record[CALIB_LINE_MAX];
+    int len = snprintf(record, sizeof(record), "inclusion model=%s",
+                       key->model);
+
+    for (int pair = 0; pair < INCLUSION_NPAIRS; pair++) {
+        len += snprintf(record + len, sizeof(record) - len, " %s=%s",
+                        inclusion_pair_names[pair],
+                        inclusion_names[report->pairs[pair]]);
+    }
+
+    snprintf(record + len, sizeof(record) - len, "\n");
+
+    return calib_replace(path, key, calib_inclusion_match, record);
+}
+
+/**
+ * Calibrates `cache`, reusing the record stored under `key` in the file at
+ * `path` when there is one and a quick sanity probe agrees with it. `force`
+ * skips the lookup. A fresh calibration picks the timer and then the probe
+ * instruction first.
+ * Nothing is written back.
+ *
+ * The levels beyond the L1 are measured holding `levels_lock` unless it is
+ * NULL, since the L2 and LLC reads of other cores calibrating at the same
+ * time would skew them.
+ *
+ * Returns 1 if a stored calibration was reused, 0 if a fresh one was taken and
+ * -1 if calibration failed.
+ */
+static int calib_acquire(cache_t* cache, const calib_key_t* key,
+                         const char* path, bool force,
+                         pthread_mutex_t* levels_lock)
+{
+    if (key != NULL && !force && calib_load(path, key, cache) == 0 &&
+        cache_check_calibration(cache) == 0) {
+        return 1;
+    }
+
+    if (cache_select_timer(cache, NULL) != 0 ||
+        cache_select_probe(cache, NULL) != 0 ||
+        cache_calibrate_l1(cache) != 0) {
+        return -1;
+    }
+
+    if (levels_lock != NULL) {
+        pthread_mutex_lock(levels_lock);
+    }
+
+    int ret = cache_calibrate_levels(cache);
+
+    if (levels_lock != NULL) {
+        pthread_mutex_unlock(levels_lock);
+    }
+
+    return ret;
+}
+
+/**
+ * Calibrates `cache`, reusing the record stored in the file at `path` for the
+ * running CPU when there is one and a quick sanity probe agrees with it. A
+ * fresh calibration is stored back to the file. `force` skips the lookup.
+ *
+ * A file that cannot be read or written only costs the time of a full
+ * calibration. A NULL `path` disables the file altogether.
+ *
+ * Returns 1 if a stored calibration was reused, 0 if a fresh one was taken and
+ * -1 if calibration failed.
+ */
+int calib_restore(cache_t* cache, const char* path, bool force)
+{
+    calib_key_t key;
+    bool keyed = (path != NULL && calib_key_init(&key, cache->cpu) == 0);
+
+    int ret = calib_acquire(cache, keyed ? &key : NULL, path, force, NULL);
+
+    if (ret == 0 && keyed && calib_store(path, &key, cache) != 0) {
+        fprintf(stderr, "Warning: could not store calibration in %s\n", path);
+    }
+
+    return ret;
+}
+
+/**
+ * Arguments and results of one per-CPU calibration thread
+ */
+typedef struct calib_worker {
+    pthread_t thread;
+
+    /// CPU to calibrate
+    int cpu;
+
+    /// Calibration file to consult, or NULL
+    const char* path;
+
+    /// Whether to skip the calibration file
+    bool force;
+
+    /// Whether `key` could be determined
+    bool keyed;
+
+    calib_key_t key;
+
+    /// Scratch cache structure, holding the result once the thread is done
+    cache_t cache;
+
+    /// Return value of `calib_acquire()`, or -1 if the thread failed earlier
+    int status;
+} calib_worker_t;
+
+/// Taken by the workers around their level calibration, one at a time
+static pthread_mutex_t calib_levels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* calib_worker_main(void* arg)
+{
+    calib_worker_t* worker = arg;
+    freq_t freq;
+
+    worker->status = -1;
+
+    if (pin_current_thread(worker->cpu) != 0) {
+        return NULL;
+    }
+
+    freq_init(&freq, worker->cpu);
+    freq_warmup(&freq);
+    freq_deinit(&freq);
+
+    if (cache_init(&worker->cache) != 0) {
+        return NULL;
+    }
+
+    worker->keyed = (worker->path != NULL &&
+                     calib_key_init(&worker->key, worker->cpu) == 0);
+
+    worker->status = calib_acquire(&worker->cache,
+                                   worker->keyed ? &worker->key : NULL,
+                                   worker->path, worker->force,
+                                   &calib_levels_lock);
+
+    timer_release();
+
+    return NULL;
+}
+
+/**
+ * Calibrates every CPU the process may run on, concurrently, with one pinned
+ * thread per CPU, and collects the results into `table` indexed by CPU
+ * number. Hit and miss latencies differ between cores and with the state of
+ * the SMT sibling, so each core is best served by its own thresholds. SMT
+ * siblings are calibrated with their sibling busy, as they would be while a
+ * channel is running. Only the L1 is calibrated concurrently: the threads
+ * take turns at the levels beyond it, which they share.
+ *
+ * Stored calibrations in the file at `path` are reused as by
+ * `calib_restore()`, and fresh ones are written back once all threads are
+ * done. A CPU that fails to calibrate is left invalid in the table.
+ *
+ * Returns -1 if no CPU could be calibrated.
+ */
+int calib_table_build(calib_table_t* table, const char* path, bool force)
+{
+    cpu_set_t allowed;
+    int ncalibrated = 0;
+
+    memset(table, 0, sizeof(*table));
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            table->ncpus = cpu + 1;
+        }
+    }
+
+    table->entries = calloc(table->ncpus, sizeof(*table->entries));
+    calib_worker_t* workers = calloc(table->ncpus, sizeof(*workers));
+
+    if (table->entries == NULL || workers == NULL) {
+        free(workers);
+        calib_table_deinit(table);
+        return -1;
+    }
+
+    for (int cpu = 0; cpu < table->ncpus; cpu++) {
+        workers[cpu].cpu = cpu;
+        workers[cpu].path = path;
+        workers[cpu].force = force;
+        workers[cpu].status = -1;
+
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        if (pthread_create(&workers[cpu].thread, NULL, calib_worker_main,
+                           &workers[cpu]) != 0) {
+            CPU_CLR(cpu, &allowed);
+        }
+    }
+
+    for (int cpu = 0; cpu < table->ncpus; cpu++) {
+        calib_worker_t* worker = &workers[cpu];
+        calib_entry_t* entry = &table->entries[cpu];
+
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        pthread_join(worker->thread, NULL);
+
+        if (worker->status >= 0) {
+            entry->valid = true;
+            entry->restored = (worker->status == 1);
+            entry->hit_latency = worker->cache.hit_latency;
+            entry->miss_latency = worker->cache.miss_latency;
+            entry->hit_threshold = worker->cache.hit_threshold;
+            entry->evict_latency = worker->cache.evict_latency;
+            entry->outlier_threshold = worker->cache.outlier_threshold;
+            entry->timer_overhead = worker->cache.timer_overhead;
+            entry->noise_floor = worker->cache.noise_floor;
+            memcpy(entry->level_latency, worker->cache.level_latency,
+                   sizeof(entry->level_latency));
+            entry->policy = worker->cache.policy;
+            entry->probe = worker->cache.probe;
+            entry->timer = worker->cache.timer;
+            ncalibrated += 1;
+        }
+
+        // Stored one at a time from here: the threads would otherwise race
+        // to rewrite the file and lose each other's records.
+        if (worker->status == 0 && worker->keyed &&
+            calib_store(path, &worker->key, &worker->cache) != 0) {
+            fprintf(stderr, "Warning: could not store calibration in %s\n",
+                    path);
+        }
+
+        cache_deinit(&worker->cache);
+    }
+
+    free(workers);
+
+    if (ncalibrated == 0) {
+        calib_table_deinit(table);
+        return -1;
+    }
+
+    return 0;
+}
+
+void calib_table_deinit(calib_table_t* table)
+{
+    free(table->entries);
+    table->entries = NULL;
+    table->ncpus = 0;
+}
+
+/**
+ * Returns the entry of `table` for CPU `cpu`, or NULL if it was not
+ * calibrated.
+ */
+const calib_entry_t* calib_table_lookup(const calib_table_t* table, int cpu)
+{
+    if (cpu < 0 || cpu >= table->ncpus || !table->entries[cpu].valid) {
+        return NULL;
+    }
+
+    return &table->entries[cpu];
+}
+
+/**
+ * Copies the calibration of the CPU `cache` belongs to from `table` into
+ * `cache`.
+ *
+ * Returns -1 if that CPU is not in the table.
+ */
+int calib_table_apply(const calib_table_t* table, cache_t* cache)
+{
+    const calib_entry_t* entry = calib_table_lookup(table, cache->cpu);
+
+    if (entry == NULL) {
+        return -1;
+    }
+
+    cache->hit_latency = entry->hit_latency;
+    cache->miss_latency = entry->miss_latency;
+    cache->hit_threshold = entry->hit_threshold;
+    cache_set_evict(cache, entry->evict_latency);
+    cache->outlier_threshold = entry->outlier_threshold;
+    cache->timer_overhead = entry->timer_overhead;
+    cache->noise_floor = entry->noise_floor;
+    memcpy(cache->level_latency, entry->level_latency,
+           sizeof(cache->level_latency));
+    cache->probe = entry->probe;
+    cache->timer = entry->timer;
+    cache_set_policy(cache, entry->policy);
+
+    return 0;
+}
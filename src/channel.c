@@ -0,0 +1,609 @@
+#include "channel.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/// How often, in slots, `channel_receive()` looks at the clock while waiting
+/// for a frame
+#define CHANNEL_POLL_SLOTS 1024
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Spins until the clock reaches `tsc`.
+ */
+static void wait_until(uint64_t tsc)
+{
+    while (cache_clock() < tsc) {
+    }
+}
+
+int channel_init(channel_t* channel, cache_t* cache, size_t setno)
+{
+    memset(channel, 0, sizeof(*channel));
+
+    if (setno >= cache->nsets) {
+        return -1;
+    }
+
+    channel->cache = cache;
+    channel->setno = setno;
+    channel->period = CHANNEL_DEFAULT_PERIOD;
+    channel->timeout = CHANNEL_DEFAULT_TIMEOUT;
+    channel->mode = CHANNEL_PRIME_PROBE;
+    channel->width = cache->assoc;
+
+    channel->ring = calloc(CHANNEL_PREAMBLE_BITS * channel->width,
+                           sizeof(*channel->ring));
+
+    if (channel->ring == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Returns the `k`th agreed line of the shared mapping.
+ */
+static uint8_t* channel_line(channel_t* channel, size_t k)
+{
+    return channel->shared + k * k * CHANNEL_SHARED_PAGE +
+           channel->setno * channel->cache->line_size;
+}
+
+/**
+ * Switches `channel` to `mode`, Flush+Reload or Flush+Flush, over the file at
+ * `path`, which the other end must map too. Agreed line `k` is line
+ * `channel->setno` of page `k * k` of the file, so the file must reach that far
+ * and `setno` must lie within a page.
+ *
+ * Flush+Flush then calibrates the flush latencies of the agreed lines.
+ *
+ * Returns -1 if the file cannot be mapped or is too small, or if flushes of
+ * cached and uncached lines cannot be told apart.
+ */
+int channel_map_shared(channel_t* channel, const char* path,
+                       channel_mode_t mode)
+{
+    size_t offset = channel->setno * channel->cache->line_size;
+    size_t last = CHANNEL_SHARED_LINES - 1;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || offset >= CHANNEL_SHARED_PAGE ||
+        (size_t)st.st_size <= last * last * CHANNEL_SHARED_PAGE + offset) {
+        close(fd);
+        return -1;
+    }
+
+    // The mapping outlives the descriptor
+    uint8_t* shared = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+
+    uint64_t* ring = calloc(CHANNEL_PREAMBLE_BITS * CHANNEL_SHARED_LINES,
+                            sizeof(*ring));
+
+    if (ring == NULL) {
+        munmap(shared, st.st_size);
+        return -1;
+    }
+
+    free(channel->ring);
+
+    channel->ring = ring;
+    channel->mode = mode;
+    channel->shared = shared;
+    channel->shared_size = st.st_size;
+    channel->width = CHANNEL_SHARED_LINES;
+
+    if (mode == CHANNEL_FLUSH_FLUSH) {
+        uint8_t* lines[CHANNEL_SHARED_LINES];
+
+        for (size_t k = 0; k < CHANNEL_SHARED_LINES; k++) {
+            lines[k] = channel_line(channel, k);
+        }
+
+        if (cache_calibrate_flush(channel->cache, lines,
+                                  CHANNEL_SHARED_LINES) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Switches `channel` to prime+probe over the LLC `llc`, at the page offset of
+ * line `channel->setno`. Only a `receiver` needs an eviction set, which is
+ * built here and takes a while.
+ *
+ * Returns -1 if `setno` does not lie within a page, if no eviction set could
+ * be found or if memory runs out.
+ */
+int channel_use_llc(channel_t* channel, llc_t* llc, bool receiver)
+{
+    size_t offset = channel->setno * llc->line_size;
+
+    if (offset >= llc->page_size ||
+        llc_evset_init(&channel->evset, llc->assoc) != 0) {
+        return -1;
+    }
+
+    channel->llc = llc;
+    channel->mode = CHANNEL_LLC;
+    channel->evset.offset = offset;
+
+    if (!receiver) {
+        return 0;
+    }
+
+    if (llc_build_evset(llc, offset, &channel->evset) != 0) {
+        return -1;
+    }
+
+    uint64_t* ring = calloc(CHANNEL_PREAMBLE_BITS * channel->evset.nlines,
+                            sizeof(*ring));
+
+    if (ring == NULL) {
+        return -1;
+    }
+
+    free(channel->ring);
+
+    channel->ring = ring;
+    channel->width = channel->evset.nlines;
+
+    return 0;
+}
+
+void channel_deinit(channel_t* channel)
+{
+    free(channel->ring);
+    channel->ring = NULL;
+
+    llc_evset_deinit(&channel->evset);
+
+    if (channel->shared != NULL) {
+        munmap(channel->shared, channel->shared_size);
+        channel->shared = NULL;
+    }
+}
+
+/**
+ * Does what a transmitter does throughout a one: fills the set from the
+ * buffer of `cache`, reads the agreed lines, or reads the LLC candidates at
+ * the agreed offset.
+ */
+static void channel_signal(channel_t* channel, cache_t* cache)
+{
+    if (channel->mode == CHANNEL_PRIME_PROBE) {
+        cache_fill_set(cache, channel->setno);
+        return;
+    }
+
+    if (channel->mode == CHANNEL_LLC) {
+        llc_signal(channel->llc, channel->evset.offset);
+        return;
+    }
+
+    for (size_t k = 0; k < CHANNEL_SHARED_LINES; k++) {
+        cache_fill(channel_line(channel, k));
+    }
+}
+
+/**
+ * Puts the lines the receiver watches in their idle state at the start of a
+ * slot: primes the set or the eviction set, or flushes the agreed lines.
+ * Flush+Flush probes left them flushed already.
+ */
+static void channel_reset(channel_t* channel)
+{
+    if (channel->mode == CHANNEL_PRIME_PROBE) {
+        cache_fill_set(channel->cache, channel->setno);
+        return;
+    }
+
+    if (channel->mode == CHANNEL_LLC) {
+        llc_prime(&channel->evset);
+        return;
+    }
+
+    if (channel->mode == CHANNEL_FLUSH_FLUSH) {
+        return;
+    }
+
+    for (size_t k = 0; k < CHANNEL_SHARED_LINES; k++) {
+        cache_flush(channel_line(channel, k));
+    }
+}
+
+/**
+ * Times a reload, or in Flush+Flush mode a flush, of each agreed line into
+ * `durs`, and stores the number of timings that were not rejected in
+ * `*valid`, unless they are NULL. Returns how many lines were cached, or -1
+ * if the thread migrated.
+ *
+ * An outlier is evidence of neither a cached nor an uncached line, so it is
+ * left out of both the count and `*valid`, as in `cache_probe_set()`.
+ */
+static int channel_reload(channel_t* channel, uint64_t* durs,
+                          size_t* valid)
+{
+    cache_t* cache = channel->cache;
+    bool flush = (channel->mode == CHANNEL_FLUSH_FLUSH);
+    size_t nvalid = 0;
+    int count = 0;
+
+    for (size_t k = 0; k < CHANNEL_SHARED_LINES; k++) {
+        uint8_t* ptr = channel_line(channel, k);
+        uint64_t dur;
+        int ret = flush ? cache_timed_flush(cache, ptr, &dur)
+                        : cache_timed_read(cache, ptr, &dur);
+
+        if (ret != 0) {
+            return -1;
+        }
+
+        if (durs != NULL) {
+            durs[k] = dur;
+        }
+
+        if (dur > cache->outlier_threshold) {
+            cache->outliers += 1;
+            continue;
+        }
+
+        nvalid += 1;
+
+        if (flush ? cache_flush_cached(cache, dur)
+                  : dur <= cache->hit_threshold) {
+            count += 1;
+        }
+    }
+
+    if (valid != NULL) {
+        *valid = nvalid;
+    }
+
+    return count;
+}
+
+/**
+ * Sends `bit` during `slot`, returning once the slot is over.
+ */
+static void channel_send_bit(channel_t* channel, uint64_t slot, int bit)
+{
+    uint64_t end = (slot + 1) * channel->period;
+
+    wait_until(slot * channel->period);
+
+    if (bit) {
+        while (cache_clock() < end) {
+            channel_signal(channel, channel->cache);
+        }
+    }
+
+    channel->slots += 1;
+}
+
+/**
+ * Receives the bit sent during `slot`, storing the probe latencies in `durs`
+ * unless it is NULL.
+ *
+ * A one shows up as more than half the set or the eviction set being evicted
+ * between the prime and the probe, or more than half the agreed lines
+ * reloading fast, counting only the reads that were not outliers. A probe
+ * that fails altogether reads as a zero.
+ */
+static int channel_recv_bit(channel_t* channel, uint64_t slot, uint64_t* durs)
+{
+    cache_t* cache = channel->cache;
+    uint64_t start = slot * channel->period;
+
+    wait_until(start);
+    channel_reset(channel);
+
+    if (channel->peer != NULL) {
+        channel->peer(channel, slot);
+    }
+
+    wait_until(start + channel->period * 3 / 4);
+
+    size_t valid = channel->width;
+    int hits;
+
+    if (channel->mode == CHANNEL_PRIME_PROBE) {
+        hits = cache_probe_set(cache, channel->setno, durs, &valid);
+    } else if (channel->mode == CHANNEL_LLC) {
+        hits = llc_probe(channel->llc, &channel->evset, durs, &valid);
+    } else {
+        hits = channel_reload(channel, durs, &valid);
+    }
+
+    channel->slots += 1;
+
+    if (hits < 0) {
+        return 0;
+    }
+
+    if (channel->mode == CHANNEL_PRIME_PROBE || channel->mode == CHANNEL_LLC) {
+        return (valid - hits) > valid / 2;
+    }
+
+    return (size_t)hits > valid / 2;
+}
+
+/**
+ * Appends the `nbits` low bits of `value`, most significant first, to `bits`.
+ */
+static size_t channel_put_bits(uint8_t* bits, size_t nbits, uint32_t value,
+                               int width)
+{
+    for (int k = width - 1; k >= 0; k--) {
+        bits[nbits++] = (value >> k) & 1;
+    }
+
+    return nbits;
+}
+
+/**
+ * Receives `nbits` bits, most significant first, starting at `*slot`.
+ */
+static uint32_t channel_recv_bits(channel_t* channel, uint64_t* slot,
+                                  int nbits)
+{
+    uint32_t value = 0;
+
+    for (int k = 0; k < nbits; k++) {
+        value = (value << 1) | channel_recv_bit(channel, *slot, NULL);
+        *slot += 1;
+    }
+
+    return value;
+}
+
+/**
+ * Lays out the frame carrying the `len` bytes of `msg` in `bits`, one bit per
+ * byte, which must have room for `CHANNEL_FRAME_BITS(len)` entries.
+ *
+ * Returns the number of bits in the frame, or 0 if `msg` is longer than a
+ * frame can carry.
+ */
+size_t channel_frame(const uint8_t* msg, size_t len, uint8_t* bits)
+{
+    size_t nbits = 0;
+    uint8_t sum = len;
+
+    if (len > UINT8_MAX) {
+        return 0;
+    }
+
+    nbits = channel_put_bits(bits, nbits, CHANNEL_PREAMBLE,
+                             CHANNEL_PREAMBLE_BITS);
+    nbits = channel_put_bits(bits, nbits, len, 8);
+
+    for (size_t k = 0; k < len; k++) {
+        nbits = channel_put_bits(bits, nbits, msg[k], 8);
+        sum += msg[k];
+    }
+
+    return channel_put_bits(bits, nbits, sum, 8);
+}
+
+/**
+ * Sends `len` bytes of `msg` as a single frame, starting at the next slot.
+ *
+ * Returns -1 if `msg` is longer than a frame can carry.
+ */
+int channel_transmit(channel_t* channel, const uint8_t* msg, size_t len)
+{
+    uint8_t bits[CHANNEL_FRAME_BITS(UINT8_MAX)];
+    size_t nbits = channel_frame(msg, len, bits);
+
+    if (nbits == 0) {
+        return -1;
+    }
+
+    uint64_t slot = cache_clock() / channel->period + 1;
+
+    for (size_t k = 0; k < nbits; k++) {
+        channel_send_bit(channel, slot + k, bits[k]);
+    }
+
+    return 0;
+}
+
+/**
+ * Trains the thresholds on the probes of the preamble that was just received.
+ * Each slot's latencies are labelled with the bit the transmitter is known to
+ * have sent: zeros leave the set alone, so those probes should all be hits,
+ * while ones should have evicted it. In the shared modes it is the other way
+ * round, and Flush+Flush trains the flush threshold instead. The LLC
+ * threshold is left as calibrated.
+ */
+static void channel_train(channel_t* channel)
+{
+    cache_t* cache = channel->cache;
+
+    if (channel->mode == CHANNEL_LLC) {
+        return;
+    }
+
+    for (int k = 0; k < CHANNEL_PREAMBLE_BITS; k++) {
+        // The oldest slot in the ring carried the first preamble bit.
+        int idx = (channel->ring_head + k) % CHANNEL_PREAMBLE_BITS;
+        bool one = (CHANNEL_PREAMBLE >> (CHANNEL_PREAMBLE_BITS - 1 - k)) & 1;
+        uint64_t* durs = &channel->ring[idx * channel->width];
+
+        for (size_t n = 0; n < channel->width; n++) {
+            if (channel->mode == CHANNEL_PRIME_PROBE) {
+                cache_track_evict(cache, durs[n], !one);
+            } else if (channel->mode == CHANNEL_FLUSH_RELOAD) {
+                cache_track(cache, durs[n], one);
+            } else {
+                cache_track_flush(cache, durs[n], one);
+            }
+        }
+    }
+}
+
+/**
+ * Waits up to `channel->timeout` seconds for a frame and receives it into
+ * `msg`, which can hold `size` bytes.
+ *
+ * Returns the length of the payload, or -1 on timeout, on a frame too long
+ * for `msg` or on a checksum mismatch.
+ */
+int channel_receive(channel_t* channel, uint8_t* msg, size_t size)
+{
+    int64_t deadline = monotonic_ns() + channel->timeout * 1000000000L;
+    uint64_t slot = cache_clock() / channel->period + 1;
+    uint32_t window = 0;
+    uint32_t mask = (1U << CHANNEL_PREAMBLE_BITS) - 1;
+
+    memset(channel->ring, 0,
+           CHANNEL_PREAMBLE_BITS * channel->width * sizeof(*channel->ring));
+
+    for (uint64_t n = 1; (window & mask) != CHANNEL_PREAMBLE; n++) {
+        uint64_t* durs = &channel->ring[channel->ring_head * channel->width];
+
+        window = (window << 1) | channel_recv_bit(channel, slot, durs);
+        channel->ring_head = (channel->ring_head + 1) % CHANNEL_PREAMBLE_BITS;
+        slot += 1;
+
+        if (n % CHANNEL_POLL_SLOTS != 0) {
+            continue;
+        }
+
+        if (monotonic_ns() >= deadline) {
+            return -1;
+        }
+
+        // Checking costs a few slots, so only do it while the line is idle.
+        if ((window & mask) == 0 && channel->freq != NULL &&
+            freq_drifted(channel->freq)) {
+            channel->drifts += 1;
+            slot = cache_clock() / channel->period + 1;
+        }
+    }
+
+    channel_train(channel);
+
+    uint8_t len = channel_recv_bits(channel, &slot, 8);
+    uint8_t sum = len;
+
+    for (size_t k = 0; k < len; k++) {
+        uint8_t byte = channel_recv_bits(channel, &slot, 8);
+
+        if (k < size) {
+            msg[k] = byte;
+        }
+
+        sum += byte;
+    }
+
+    if (channel_recv_bits(channel, &slot, 8) != sum || len > size) {
+        channel->bad_frames += 1;
+        return -1;
+    }
+
+    return len;
+}
+
+/**
+ * State of the transmitter side of `channel_loopback()`
+ */
+typedef struct loopback {
+    /// Cache structure with a buffer of its own to evict the receiver with
+    cache_t* cache;
+
+    uint8_t bits[CHANNEL_FRAME_BITS(UINT8_MAX)];
+    size_t nbits;
+
+    /// Slot the frame starts in, once known
+    uint64_t first;
+    bool started;
+} loopback_t;
+
+/// Idle slots the loopback transmitter leaves before the frame
+#define LOOPBACK_LEAD 8
+
+static void loopback_peer(channel_t* channel, uint64_t slot)
+{
+    loopback_t* loopback = channel->peer_arg;
+
+    if (!loopback->started) {
+        loopback->first = slot + LOOPBACK_LEAD;
+        loopback->started = true;
+    }
+
+    if (slot < loopback->first || slot - loopback->first >= loopback->nbits) {
+        return;
+    }
+
+    if (loopback->bits[slot - loopback->first]) {
+        channel_signal(channel, loopback->cache);
+    }
+}
+
+/**
+ * Sends `len` bytes of `msg` through the channel to itself and receives them
+ * into `out`, which can hold `size` bytes. The transmitter runs in the same
+ * thread, filling the set from the buffer of `peer`, or reading the agreed
+ * lines, between the receiver's prime and probe of each slot.
+ *
+ * Under the simulator this exercises the whole protocol deterministically,
+ * which `make check` relies on. On hardware it only decodes where the L1 and
+ * L2 latencies stand further apart than the timer noise, which a noisy VM
+ * does not guarantee.
+ *
+ * Returns what `channel_receive()` returns.
+ */
+int channel_loopback(channel_t* channel, cache_t* peer, const uint8_t* msg,
+                     size_t len, uint8_t* out, size_t size)
+{
+    loopback_t loopback;
+
+    memset(&loopback, 0, sizeof(loopback));
+
+    loopback.cache = peer;
+    loopback.nbits = channel_frame(msg, len, loopback.bits);
+
+    if (loopback.nbits == 0) {
+        return -1;
+    }
+
+    channel->peer = loopback_peer;
+    channel->peer_arg = &loopback;
+
+    int ret = channel_receive(channel, out, size);
+
+    channel->peer = NULL;
+    channel->peer_arg = NULL;
+
+    return ret;
+}
@@ -0,0 +1,107 @@
+#include "cpu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+/**
+ * Restricts the calling thread to run only on CPU `cpuno`.
+ *
+ * Returns -1 if the affinity could not be set, or if the thread is not running
+ * on `cpuno` once it has been.
+ */
+int pin_current_thread(int cpuno)
+{
+    pthread_t current = pthread_self();
+    cpu_set_t cpuset;
+
+    if (cpuno < 0 || cpuno >= CPU_SETSIZE) {
+        return -1;
+    }
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpuno, &cpuset);
+
+    if (pthread_setaffinity_np(current, sizeof(cpuset), &cpuset) != 0) {
+        return -1;
+    }
+
+    if (sched_getcpu() != cpuno) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parses a kernel CPU list such as "0-3,8,10-11" into `set`.
+ *
+ * Returns -1 if `list` is malformed or names a CPU beyond `CPU_SETSIZE`.
+ */
+int cpulist_parse(const char* list, cpu_set_t* set)
+{
+    const char* p = list;
+
+    CPU_ZERO(set);
+
+    while (*p != '\0' && *p != '\n') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p) {
+            return -1;
+        }
+
+        p = end;
+
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+
+            if (end == p + 1) {
+                return -1;
+            }
+
+            p = end;
+        }
+
+        if (first < 0 || last < first || last >= CPU_SETSIZE) {
+            return -1;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+        }
+
+        if (*p == ',') {
+            p += 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads a CPU list from the sysfs file at `path` into `set`. An empty file
+ * yields an empty set.
+ *
+ * Returns -1 if the file does not exist or cannot be parsed.
+ */
+int cpulist_read(const char* path, cpu_set_t* set)
+{
+    char buf[4096];
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    if (fgets(buf, sizeof(buf), file) == NULL) {
+        buf[0] = '\0';
+    }
+
+    fclose(file);
+
+    return cpulist_parse(buf, set);
+}
@@ -0,0 +1,220 @@
+#include "freq.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+/// Architectural MSR counting at the fixed (TSC) frequency while in C0
+#define MSR_IA32_MPERF 0xe7
+
+/// Architectural MSR counting at the actual core frequency while in C0
+#define MSR_IA32_APERF 0xe8
+
+/// Iterations of the dependent loop in one measurement window. Roughly 100us
+/// on current parts, which is long enough to swamp the cost of reading the
+/// counters and short enough to follow a P-state ramp.
+#define FREQ_WINDOW_ITERS (1 << 16)
+
+/// Number of consecutive windows that must agree before the clock is
+/// considered settled.
+#define FREQ_STABLE_WINDOWS 4
+
+/// Give up on settling after this long, in nanoseconds.
+#define FREQ_WARMUP_TIMEOUT 2000000000L
+
+/// Windows measured by `freq_drifted()`. Interrupts only ever make a window
+/// look slower, so the fastest of a few is taken.
+#define FREQ_DRIFT_WINDOWS 3
+
+/// Default value of `freq->tolerance`
+#define FREQ_DEFAULT_TOLERANCE 0.01
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Runs `FREQ_WINDOW_ITERS` iterations of a serial dependency chain. The chain
+ * cannot be overlapped, so its duration scales with the core clock.
+ */
+static void freq_spin(void)
+{
+    uint64_t x = 1;
+
+    for (int k = 0; k < FREQ_WINDOW_ITERS; k++) {
+        __asm__ __volatile__("imul %[x], %[x]\n"
+                             "add $1, %[x]\n"
+                             : [x] "+r"(x));
+    }
+}
+
+static int freq_read_msr(freq_t* freq, uint32_t msr, uint64_t* value)
+{
+    if (pread(freq->msr_fd, value, sizeof(*value), msr) != sizeof(*value)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Opens the APERF/MPERF counters of `cpuno` if they are accessible, which
+ * needs the msr driver and root.
+ */
+int freq_init(freq_t* freq, int cpuno)
+{
+    char path[64];
+    uint64_t value;
+
+    memset(freq, 0, sizeof(*freq));
+
+    freq->cpu = cpuno;
+    freq->tolerance = FREQ_DEFAULT_TOLERANCE;
+
+    snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpuno);
+    freq->msr_fd = open(path, O_RDONLY);
+
+    if (freq->msr_fd >= 0 && freq_read_msr(freq, MSR_IA32_APERF, &value) != 0) {
+        close(freq->msr_fd);
+        freq->msr_fd = -1;
+    }
+
+    return 0;
+}
+
+void freq_deinit(freq_t* freq)
+{
+    if (freq->msr_fd >= 0) {
+        close(freq->msr_fd);
+    }
+}
+
+/**
+ * Measures one window and returns a rate proportional to the average clock
+ * frequency of the CPU over it, or a negative value if the counters could not
+ * be read.
+ */
+double freq_rate(freq_t* freq)
+{
+    if (freq->msr_fd >= 0) {
+        uint64_t aperf[2];
+        uint64_t mperf[2];
+
+        if (freq_read_msr(freq, MSR_IA32_APERF, &aperf[0]) != 0 ||
+            freq_read_msr(freq, MSR_IA32_MPERF, &mperf[0]) != 0) {
+            return -1.0;
+        }
+
+        freq_spin();
+
+        if (freq_read_msr(freq, MSR_IA32_APERF, &aperf[1]) != 0 ||
+            freq_read_msr(freq, MSR_IA32_MPERF, &mperf[1]) != 0) {
+            return -1.0;
+        }
+
+        if (mperf[1] == mperf[0]) {
+            return -1.0;
+        }
+
+        return (double)(aperf[1] - aperf[0]) / (double)(mperf[1] - mperf[0]);
+    }
+
+    uint64_t t0 = rdtsc();
+    freq_spin();
+    uint64_t t1 = rdtsc();
+
+    return (double)FREQ_WINDOW_ITERS / (double)(t1 - t0);
+}
+
+static bool freq_agree(freq_t* freq, double a, double b)
+{
+    return fabs(a - b) <= freq->tolerance * b;
+}
+
+/**
+ * Keeps the CPU busy until its clock has settled, that is until
+ * `FREQ_STABLE_WINDOWS` consecutive windows agree to within
+ * `freq->tolerance`. The settled rate becomes `freq->reference`.
+ *
+ * Calibrating on a core that is still ramping out of a low P-state ties every
+ * latency to how far the ramp had got, so this should run right before
+ * `cache_init()`.
+ *
+ * Returns -1 if the clock did not settle within `FREQ_WARMUP_TIMEOUT`, in
+ * which case the last rate measured is used as the reference.
+ */
+int freq_warmup(freq_t* freq)
+{
+    int64_t deadline = monotonic_ns() + FREQ_WARMUP_TIMEOUT;
+    double prev = freq_rate(freq);
+    int agreeing = 0;
+
+    freq->windows = 1;
+    freq->stable = false;
+
+    while (monotonic_ns() < deadline) {
+        double rate = freq_rate(freq);
+
+        freq->windows += 1;
+
+        if (rate < 0) {
+            return -1;
+        }
+
+        agreeing = freq_agree(freq, rate, prev) ? agreeing + 1 : 0;
+        prev = rate;
+
+        if (agreeing + 1 >= FREQ_STABLE_WINDOWS) {
+            freq->stable = true;
+            break;
+        }
+    }
+
+    freq->reference = prev;
+
+    return freq->stable ? 0 : -1;
+}
+
+/**
+ * Measures the clock and reports whether it has moved away from
+ * `freq->reference` by more than `freq->tolerance`. The new rate then becomes
+ * the reference, so each change is reported once.
+ *
+ * This costs `FREQ_DRIFT_WINDOWS` windows, so long runs should call it every so
+ * often rather than per sample.
+ */
+bool freq_drifted(freq_t* freq)
+{
+    double best = -1.0;
+
+    for (int k = 0; k < FREQ_DRIFT_WINDOWS; k++) {
+        double rate = freq_rate(freq);
+
+        if (rate < 0) {
+            return true;
+        }
+
+        if (rate > best) {
+            best = rate;
+        }
+    }
+
+    if (freq_agree(freq, best, freq->reference)) {
+        return false;
+    }
+
+    freq->reference = best;
+
+    return true;
+}
@@ -0,0 +1,300 @@
+#include "inclusion.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/// Lines tested per pair, each a different candidate of the LLC buffer
+#define INCLUSION_TRIALS 16
+
+/// Trials of a pair, in quarters of `INCLUSION_TRIALS`, that have to agree for
+/// a verdict; the pair is unknown when fewer do
+#define INCLUSION_QUORUM 3
+
+/// Noise floors two levels' latencies have to stand apart for the pair to be
+/// tested at all
+#define INCLUSION_MIN_FLOORS 2.0
+
+/// Samples per median in `inclusion_l2_latency()`
+#define INCLUSION_CALIB_TRIALS 256
+
+/// Attempts allowed per sample before giving up on a noisy or unstable CPU
+#define INCLUSION_MAX_ATTEMPTS 8
+
+const char* const inclusion_pair_names[INCLUSION_NPAIRS] = {
+    [INCLUSION_L1_L2] = "l1/l2",
+    [INCLUSION_L1_LLC] = "l1/llc",
+    [INCLUSION_L2_LLC] = "l2/llc",
+};
+
+const char* const inclusion_names[INCLUSION_NKINDS] = {
+    [INCLUSION_UNKNOWN] = "unknown",
+    [INCLUSION_INCLUSIVE] = "inclusive",
+    [INCLUSION_NON_INCLUSIVE] = "non-inclusive",
+};
+
+int inclusion_parse(const char* name, inclusion_t* inclusion)
+{
+    for (int k = 0; k < INCLUSION_NKINDS; k++) {
+        if (strcmp(name, inclusion_names[k]) == 0) {
+            *inclusion = k;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Pushes whatever else is in set `setno` of the L1 out of it, and out of the
+ * L1 alone, by filling the set twice over with `cache_fill_set()`.
+ */
+static void inclusion_evict_l1(cache_t* cache, size_t setno)
+{
+    cache_fill_set(cache, setno);
+    cache_fill_set(cache, setno);
+}
+
+/**
+ * Measures the median latency of a read of `ptr`, in L1 set `setno`, once the
+ * L1 has lost it and the L2 has not.
+ *
+ * Returns -1 if too many reads had to be discarded.
+ */
+static int inclusion_l2_latency(llc_t* llc, size_t setno, uint8_t* ptr,
+                                uint64_t* latency)
+{
+    uint64_t samples[INCLUSION_CALIB_TRIALS];
+    int attempts = INCLUSION_MAX_ATTEMPTS * INCLUSION_CALIB_TRIALS;
+
+    for (int n = 0; n < INCLUSION_CALIB_TRIALS;) {
+        if (attempts-- == 0) {
+            return -1;
+        }
+
+        cache_fill(ptr);
+        inclusion_evict_l1(llc->cache, setno);
+        llc_touch_page(ptr, llc->page_size);
+
+        if (cache_timed_read(llc->cache, ptr, &samples[n]) == 0 &&
+            samples[n] <= llc->outlier_threshold) {
+            n += 1;
+        }
+    }
+
+    qsort(samples, INCLUSION_CALIB_TRIALS, sizeof(*samples), compare_u64);
+    *latency = samples[INCLUSION_CALIB_TRIALS / 2];
+
+    return 0;
+}
+
+/**
+ * Caches `victim` and then evicts it from the lower level of `pair` while
+ * keeping it in the upper one, which only ever hits, so the lower level never
+ * sees it used:
+ *
+ * - from the L2 or the LLC when the upper level is the L1, by reading every
+ *   line of `llc->private_buffer`, or every other candidate of `llc->buffer`,
+ *   at its page offset and rereading the victim after each. The reread comes
+ *   right after a single conflicting line, so the victim is the most recently
+ *   used line of its L1 set and never leaves it: every reread is an L1 hit
+ *   that neither lower level sees;
+ * - from the LLC while keeping it in the L2, by filling the L1 set with
+ *   `cache_fill_set()` after each candidate so that the reread misses the L1
+ *   and hits the L2, which does not reach the LLC either. The set is filled
+ *   once more at the end for the timed read to reach the L2.
+ *
+ * Then times a read of the victim: if the upper level included nothing the
+ * lower one lost, the victim is gone from it too.
+ *
+ * Returns -1 if the read had to be discarded.
+ */
+static int inclusion_trial(llc_t* llc, size_t setno, inclusion_pair_t pair,
+                           uint8_t* victim, uint64_t* dur)
+{
+    cache_t* cache = llc->cache;
+    size_t offset = (uintptr_t)victim & (llc->page_size - 1);
+
+    cache_fill(victim);
+
+    if (pair == INCLUSION_L1_L2) {
+        for (size_t k = offset; k < llc->private_size; k += llc->page_size) {
+            cache_fill(llc->private_buffer + k);
+            cache_fill(victim);
+        }
+    } else {
+        size_t npool = llc_pool_size(llc);
+
+        for (size_t k = 0; k < npool; k++) {
+            uint8_t* line = llc_pool_line(llc, offset, k);
+
+            if (line == victim) {
+                continue;
+            }
+
+            cache_fill(line);
+
+            if (pair == INCLUSION_L2_LLC) {
+                inclusion_evict_l1(cache, setno);
+            }
+
+            cache_fill(victim);
+        }
+
+        if (pair == INCLUSION_L2_LLC) {
+            inclusion_evict_l1(cache, setno);
+        }
+    }
+
+    llc_touch_page(victim, llc->page_size);
+
+    if (cache_timed_read(cache, victim, dur) != 0) {
+        return -1;
+    }
+
+    return *dur > llc->outlier_threshold ? -1 : 0;
+}
+
+/**
+ * Returns the verdict `evicted` trials out of `INCLUSION_TRIALS` amount to:
+ * inclusive or non-inclusive when at least `INCLUSION_QUORUM` quarters of
+ * them agree, unknown otherwise.
+ */
+static inclusion_t inclusion_vote(int evicted)
+{
+    int quorum = INCLUSION_TRIALS * INCLUSION_QUORUM / 4;
+
+    if (evicted >= quorum) {
+        return INCLUSION_INCLUSIVE;
+    }
+
+    if (INCLUSION_TRIALS - evicted >= quorum) {
+        return INCLUSION_NON_INCLUSIVE;
+    }
+
+    return INCLUSION_UNKNOWN;
+}
+
+/**
+ * Returns whether `slow` stands at least `INCLUSION_MIN_FLOORS` noise floors
+ * of `cache` above `fast`.
+ */
+static bool inclusion_distinct(const cache_t* cache, uint64_t fast,
+                               uint64_t slow)
+{
+    return slow > fast && cache_floors(cache, slow - fast) >=
+                              INCLUSION_MIN_FLOORS;
+}
+
+/**
+ * Tests, for each pair of cache levels, whether evicting a line from the lower
+ * level evicts it from the upper one as well, by evicting candidates of
+ * `llc->buffer` in L1 set `setno` from the lower level while keeping them in
+ * the upper one; see `inclusion_trial()`. The latencies of the L1 and the LLC
+ * come from `llc->cache` and `llc`, which must be calibrated, and that of the
+ * L2 is measured.
+ *
+ * An inclusive LLC is what lets prime+probe over the LLC evict the lines
+ * another core keeps in its L1 and L2. Exclusive hierarchies, such as the
+ * victim L3 of AMD parts, keep them just as non-inclusive ones do and are
+ * reported as such.
+ *
+ * A pair whose two levels are fewer than `INCLUSION_MIN_FLOORS` noise floors
+ * apart, or whose trials do not agree well enough, is left unknown.
+ *
+ * Returns -1 if `setno` is out of range or too many reads had to be
+ * discarded.
+ */
+int inclusion_infer(llc_t* llc, size_t setno, inclusion_report_t* report)
+{
+    cache_t* cache = llc->cache;
+    size_t offset = setno * cache->line_size;
+
+    memset(report, 0, sizeof(*report));
+    report->trials = INCLUSION_TRIALS;
+
+    if (setno >= cache->nsets || offset >= llc->page_size ||
+        llc_pool_size(llc) < INCLUSION_TRIALS) {
+        return -1;
+    }
+
+    if (inclusion_l2_latency(llc, setno, llc_pool_line(llc, offset, 0),
+                             &report->l2_latency) != 0) {
+        return -1;
+    }
+
+    // Where the victim has to be for it to have stayed in the upper level
+    uint64_t thresholds[INCLUSION_NPAIRS] = {
+        [INCLUSION_L1_L2] = (cache->hit_latency + report->l2_latency) / 2,
+        [INCLUSION_L1_LLC] = (cache->hit_latency + report->l2_latency) / 2,
+        [INCLUSION_L2_LLC] = (report->l2_latency + llc->hit_latency) / 2,
+    };
+    bool distinct[INCLUSION_NPAIRS] = {
+        [INCLUSION_L1_L2] =
+            inclusion_distinct(cache, cache->hit_latency, report->l2_latency),
+        [INCLUSION_L1_LLC] =
+            inclusion_distinct(cache, cache->hit_latency, report->l2_latency),
+        [INCLUSION_L2_LLC] =
+            inclusion_distinct(cache, report->l2_latency, llc->hit_latency),
+    };
+
+    for (int pair = 0; pair < INCLUSION_NPAIRS; pair++) {
+        int attempts = INCLUSION_MAX_ATTEMPTS * INCLUSION_TRIALS;
+
+        if (!distinct[pair]) {
+            continue;
+        }
+
+        for (int trial = 0; trial < INCLUSION_TRIALS;) {
+            uint8_t* victim = llc_pool_line(llc, offset, trial);
+            uint64_t dur;
+
+            if (attempts-- == 0) {
+                return -1;
+            }
+
+            if (inclusion_trial(llc, setno, pair, victim, &dur) != 0) {
+                continue;
+            }
+
+            report->evicted[pair] += (dur > thresholds[pair]);
+            trial += 1;
+        }
+
+        report->pairs[pair] = inclusion_vote(report->evicted[pair]);
+    }
+
+    // The candidates evict the victim from the L2 too, so an L2 that includes
+    // the L1 takes it out of the L1 whatever the LLC does, and the L1 keeps
+    // what the L2 keeps
+    if (report->pairs[INCLUSION_L1_L2] == INCLUSION_INCLUSIVE) {
+        report->pairs[INCLUSION_L1_LLC] = report->pairs[INCLUSION_L2_LLC];
+    }
+
+    return 0;
+}
+
+/**
+ * Returns whether every pair of `report` got a verdict, which is what makes
+ * it worth keeping with the calibration.
+ */
+bool inclusion_decided(const inclusion_report_t* report)
+{
+    for (int pair = 0; pair < INCLUSION_NPAIRS; pair++) {
+        if (report->pairs[pair] == INCLUSION_UNKNOWN) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Returns whether prime+probe over the LLC can work on a hierarchy described
+ * by `report`: unless the LLC is known not to include the L1 and L2, as far
+ * as those were tested.
+ */
+bool inclusion_llc_works(const inclusion_report_t* report)
+{
+    return report->pairs[INCLUSION_L1_LLC] != INCLUSION_NON_INCLUSIVE &&
+           report->pairs[INCLUSION_L2_LLC] != INCLUSION_NON_INCLUSIVE;
+}
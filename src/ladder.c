@@ -0,0 +1,296 @@
+#include "ladder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "sim.h"
+
+/// Timed reads per working set size
+#define LADDER_SAMPLES 2048
+
+/// Working set sizes per doubling, spread evenly between powers of two
+#define LADDER_STEPS 2
+
+/// Sweeps over every size, whose median at each size is the curve
+#define LADDER_SWEEPS 3
+
+/// Rise in latency over the plateau that starts a new level, as a fraction
+#define LADDER_RISE 0.25
+
+/// Seed of the chase order, fixed so that every run walks the same way
+#define LADDER_SEED 0x2545f4914f6cdd1dULL
+
+/**
+ * Links the first `nlines` lines of `buffer` into a single cycle in random
+ * order, each line holding a pointer to the next in its first bytes, so that
+ * no prefetcher can guess what comes next. `order` is scratch space for
+ * `nlines` entries.
+ */
+static void ladder_link(uint8_t* buffer, size_t line_size, size_t nlines,
+                        size_t* order)
+{
+    uint64_t rng = LADDER_SEED;
+
+    for (size_t k = 0; k < nlines; k++) {
+        order[k] = k;
+    }
+
+    // Sattolo's shuffle, which only makes single cycles
+    for (size_t k = nlines - 1; k > 0; k--) {
+        size_t j = sim_random(&rng) % k;
+        size_t tmp = order[k];
+
+        order[k] = order[j];
+        order[j] = tmp;
+    }
+
+    for (size_t k = 0; k < nlines; k++) {
+        uint8_t* line = buffer + order[k] * line_size;
+
+        *(uint8_t**)line = buffer + order[(k + 1) % nlines] * line_size;
+    }
+}
+
+/**
+ * Walks the chain starting at `start` once round, `nlines` lines, so that
+ * whatever fits of it is cached, then times `LADDER_SAMPLES` reads as the walk
+ * goes on, each read of a line the walk came to last longest ago. Returns the
+ * median latency of those reads less `cache->timer_overhead`.
+ *
+ * Returns -1 if too many reads were lost to CPU migrations.
+ */
+static int ladder_measure(cache_t* cache, uint8_t* start, size_t nlines,
+                          uint64_t* latency)
+{
+    uint64_t samples[LADDER_SAMPLES];
+    int maxattempts = 4 * LADDER_SAMPLES;
+    uint8_t* ptr = start;
+    int n = 0;
+
+    for (size_t k = 0; k < nlines; k++) {
+        ptr = *(uint8_t* volatile*)ptr;
+    }
+
+    for (int attempt = 0; n < LADDER_SAMPLES && attempt < maxattempts;
+         attempt++) {
+        if (cache_timed_read(cache, ptr, &samples[n]) == 0) {
+            n += 1;
+        }
+
+        ptr = *(uint8_t* volatile*)ptr;
+    }
+
+    if (n < LADDER_SAMPLES) {
+        return -1;
+    }
+
+    qsort(samples, n, sizeof(*samples), compare_u64);
+    *latency = cache_net(cache, samples[n / 2]);
+
+    return 0;
+}
+
+/**
+ * Finds the plateaus of the curve in `ladder`: a point more than `LADDER_RISE`
+ * and more than `floor` above the plateau before it starts a new level,
+ * unless the one before it did, in which case the curve is still climbing to
+ * the new plateau. The last point of a plateau gives the capacity of its
+ * level.
+ */
+static void ladder_levels(ladder_t* ladder, uint64_t floor)
+{
+    const ladder_point_t* points = ladder->points;
+    double plateau = points[0].latency;
+    bool climbing = false;
+
+    ladder->nlevels = 1;
+    ladder->latency[0] = points[0].latency;
+
+    for (size_t k = 1; k < ladder->npoints; k++) {
+        size_t level = ladder->nlevels - 1;
+        bool rise = points[k].latency > plateau * (1.0 + LADDER_RISE) &&
+                    points[k].latency > plateau + floor;
+
+        if (rise && !climbing && ladder->nlevels < CACHE_NLEVELS) {
+            ladder->capacity[level] = points[k - 1].size;
+            ladder->nlevels += 1;
+            level += 1;
+        }
+
+        if (rise || !climbing) {
+            plateau = points[k].latency;
+        }
+
+        climbing = rise;
+        ladder->latency[level] = points[k].latency;
+    }
+
+    ladder->capacity[ladder->nlevels - 1] = 0;
+}
+
+/**
+ * Measures the latency of a read against the size of the working set, as
+ * lmbench's lat_mem_rd does, from a quarter of the L1 up to `max_size` bytes
+ * in `LADDER_STEPS` steps per doubling. A `max_size` of zero goes up to four
+ * times the largest cache the CPU reports, or `LADDER_MAX_SIZE` if it reports
+ * none; no sweep goes beyond that. Every line of the working set is visited
+ * in a random cycle and each read is timed with `cache_timed_read()`.
+ *
+ * The sizes are swept `LADDER_SWEEPS` times over and each point of the curve
+ * is the median of its sweeps, so that a burst of noise during one sweep
+ * does not pass for a step. The level boundaries are then found in the
+ * curve; see `ladder_levels()`.
+ *
+ * `cache->buffer` only spans `assoc` times the L1, so the sweep has a buffer
+ * of its own. The pages of large working sets miss the TLB too, which shows
+ * in their latency as it does in lmbench's.
+ *
+ * Returns -1 if memory runs out or too many reads were lost to CPU
+ * migrations.
+ */
+int ladder_run(cache_t* cache, size_t max_size, ladder_t* ladder)
+{
+    long reported[CACHE_NLEVELS - 1] = {
+        sysconf(_SC_LEVEL1_DCACHE_SIZE),
+        sysconf(_SC_LEVEL2_CACHE_SIZE),
+        sysconf(_SC_LEVEL3_CACHE_SIZE),
+    };
+    size_t largest = 0;
+
+    memset(ladder, 0, sizeof(*ladder));
+
+    for (int k = 0; k < CACHE_NLEVELS - 1; k++) {
+        ladder->reported[k] = reported[k] > 0 ? reported[k] : 0;
+
+        if (ladder->reported[k] > largest) {
+            largest = ladder->reported[k];
+        }
+    }
+
+    if (max_size == 0) {
+        max_size = (largest != 0) ? 4 * largest : LADDER_MAX_SIZE;
+    }
+
+    if (max_size > LADDER_MAX_SIZE) {
+        max_size = LADDER_MAX_SIZE;
+    }
+
+    for (size_t base = cache->size / 4; base <= max_size; base *= 2) {
+        for (int step = 0; step < LADDER_STEPS; step++) {
+            size_t size = base + base * step / LADDER_STEPS;
+
+            if (size > max_size || ladder->npoints == LADDER_MAX_POINTS) {
+                break;
+            }
+
+            ladder->points[ladder->npoints++].size = size;
+        }
+    }
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t max_lines = max_size / cache->line_size;
+    uint8_t* buffer = aligned_alloc(page_size, max_size);
+    size_t* order = calloc(max_lines, sizeof(*order));
+    uint64_t sweeps[LADDER_MAX_POINTS][LADDER_SWEEPS];
+
+    if (buffer == NULL || order == NULL) {
+        free(buffer);
+        free(order);
+        ladder->npoints = 0;
+        return -1;
+    }
+
+    memset(buffer, 1, max_size);
+
+    for (int sweep = 0; sweep < LADDER_SWEEPS; sweep++) {
+        for (size_t k = 0; k < ladder->npoints; k++) {
+            size_t nlines = ladder->points[k].size / cache->line_size;
+
+            ladder_link(buffer, cache->line_size, nlines, order);
+
+            if (ladder_measure(cache, buffer, nlines, &sweeps[k][sweep]) !=
+                0) {
+                free(buffer);
+                free(order);
+                ladder->npoints = 0;
+                return -1;
+            }
+        }
+    }
+
+    free(buffer);
+    free(order);
+
+    for (size_t k = 0; k < ladder->npoints; k++) {
+        qsort(sweeps[k], LADDER_SWEEPS, sizeof(*sweeps[k]), compare_u64);
+        ladder->points[k].latency = sweeps[k][LADDER_SWEEPS / 2];
+    }
+
+    if (ladder->npoints > 0) {
+        ladder_levels(ladder, cache->noise_floor);
+    }
+
+    return 0;
+}
+
+/**
+ * Returns which of the reported sizes in `ladder->reported` the capacity of
+ * plateau `level` is nearest to, as an index from 0 for the L1, or -1 if none
+ * is within a factor of two, which is as close as a sweep with `LADDER_STEPS`
+ * steps per doubling and the replacement policy allow. Memory matches
+ * nothing.
+ */
+int ladder_match(const ladder_t* ladder, size_t level)
+{
+    size_t capacity = ladder->capacity[level];
+    int best = -1;
+    double best_ratio = 2.0;
+
+    for (int k = 0; k < CACHE_NLEVELS - 1 && capacity != 0; k++) {
+        if (ladder->reported[k] == 0) {
+            continue;
+        }
+
+        double ratio = (double)capacity / ladder->reported[k];
+
+        ratio = ratio < 1.0 ? 1.0 / ratio : ratio;
+
+        if (ratio <= best_ratio) {
+            best = k;
+            best_ratio = ratio;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Writes a one line summary of `ladder` into `buf`, for telling hosts apart
+ * in stored benchmark results: the capacity and read latency of each level
+ * found, e.g. `48K@4,2M@14,260M@70,mem@140`.
+ */
+void ladder_fingerprint(const ladder_t* ladder, char* buf, size_t size)
+{
+    size_t len = 0;
+
+    buf[0] = '\0';
+
+    for (size_t k = 0; k < ladder->nlevels && len < size; k++) {
+        size_t capacity = ladder->capacity[k];
+        const char* sep = (k == 0) ? "" : ",";
+
+        if (capacity == 0) {
+            len += snprintf(buf + len, size - len, "%smem@%lu", sep,
+                            ladder->latency[k]);
+        } else if (capacity >= (1UL << 20)) {
+            len += snprintf(buf + len, size - len, "%s%zuM@%lu", sep,
+                            capacity >> 20, ladder->latency[k]);
+        } else {
+            len += snprintf(buf + len, size - len, "%s%zuK@%lu", sep,
+                            capacity >> 10, ladder->latency[k]);
+        }
+    }
+}
@@ -0,0 +1,1011 @@
+#include "llc.h"
+
+#include <cpuid.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+/// Samples per latency in `llc_calibrate()`
+#define LLC_CALIB_TRIALS 256
+
+/// Fields of a `/proc/self/pagemap` entry
+#define LLC_PAGEMAP_PRESENT (1ULL << 63)
+#define LLC_PAGEMAP_PFN ((1ULL << 55) - 1)
+
+/**
+ * Slice hash of Intel Core parts since Sandy Bridge, as reverse engineered by
+ * Maurice et al. (RAID 2015): slice bit `k` is the parity of the physical
+ * address under mask `k`, and parts with 2, 4 and 8 slices use the first 1, 2
+ * and 3 masks.
+ */
+const uint64_t llc_intel_slice_masks[LLC_INTEL_SLICE_MASKS] = {
+    0x1b5f575440ULL,
+    0x2eb5faa880ULL,
+    0x3cccc93100ULL,
+};
+
+/**
+ * Returns whether the CPU is an Intel part, the only ones whose slice hash is
+ * known.
+ */
+static bool llc_is_intel(void)
+{
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+
+    // "GenuineIntel", spread over EBX, EDX and ECX
+    return __get_cpuid(0, &eax, &ebx, &ecx, &edx) && ebx == 0x756e6547 &&
+           edx == 0x49656e69 && ecx == 0x6c65746e;
+}
+
+/**
+ * Derives the slice geometry of `llc` from its size, and picks the known slice
+ * hash for it if there is one.
+ */
+static void llc_init_slices(llc_t* llc)
+{
+    size_t sets = llc->size / (llc->assoc * llc->line_size);
+
+    llc->nslices = sets > LLC_SLICE_SETS ? sets / LLC_SLICE_SETS : 1;
+    llc->slice_sets = sets / llc->nslices;
+    llc->slice_bits = 0;
+
+    for (size_t k = 1; k <= LLC_INTEL_SLICE_MASKS && llc_is_intel(); k++) {
+        if (llc->nslices == (size_t)1 << k) {
+            memcpy(llc->slice_masks, llc_intel_slice_masks,
+                   k * sizeof(*llc_intel_slice_masks));
+            llc->slice_bits = k;
+        }
+    }
+}
+
+/**
+ * Initialise the `llc` structure for the last level cache, with a candidate
+ * buffer of `LLC_BUFFER_FACTOR` times its size. Timed reads go through
+ * `cache`, which must already be calibrated.
+ *
+ * Every page of the buffers is written, so that each is backed by a frame of
+ * its own rather than by the shared zero page.
+ *
+ * The latencies and thresholds are left zeroed. Follow up with
+ * `llc_calibrate()`.
+ *
+ * Returns -1 if the CPU reports no L3 or memory runs out.
+ */
+int llc_init(llc_t* llc, cache_t* cache)
+{
+    memset(llc, 0, sizeof(*llc));
+
+    long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    long assoc = sysconf(_SC_LEVEL3_CACHE_ASSOC);
+    long line_size = sysconf(_SC_LEVEL3_CACHE_LINESIZE);
+    long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    long l2_assoc = sysconf(_SC_LEVEL2_CACHE_ASSOC);
+
+    if (size <= 0 || assoc <= 0 || line_size <= 0 || l2_size <= 0 ||
+        l2_assoc <= 0) {
+        return -1;
+    }
+
+    llc->cache = cache;
+    llc->size = size;
+    llc->assoc = assoc;
+    llc->line_size = line_size;
+    llc->page_size = sysconf(_SC_PAGESIZE);
+    llc->l2_sets = l2_size / (l2_assoc * line_size);
+    llc_init_slices(llc);
+
+    llc->buffer_size = LLC_BUFFER_FACTOR * llc->size;
+    llc->buffer = aligned_alloc(llc->page_size, llc->buffer_size);
+    llc->private_size = LLC_PRIVATE_FACTOR * l2_size;
+    llc->private_buffer = aligned_alloc(llc->page_size, llc->private_size);
+    llc->reserved =
+        calloc(llc->buffer_size / llc->line_size / 64 + 1, sizeof(uint64_t));
+
+    if (llc->buffer == NULL || llc->private_buffer == NULL ||
+        llc->reserved == NULL) {
+        llc_deinit(llc);
+        return -1;
+    }
+
+    memset(llc->buffer, 1, llc->buffer_size);
+    memset(llc->private_buffer, 1, llc->private_size);
+
+    return 0;
+}
+
+/**
+ *  Tear down the `llc` structure
+ */
+void llc_deinit(llc_t* llc)
+{
+    free(llc->buffer);
+    free(llc->private_buffer);
+    free(llc->reserved);
+    free(llc->phys);
+
+    llc->buffer = NULL;
+    llc->private_buffer = NULL;
+    llc->reserved = NULL;
+    llc->phys = NULL;
+}
+
+/**
+ * Pushes the line holding `ptr` out of the L1 and L2 by reading every line of
+ * `llc->private_buffer` at the same page offset. Those share its L1 set and,
+ * being four times the L2 over, fill its L2 set several times whichever
+ * physical pages they are, while taking up a sliver of the LLC.
+ */
+static void llc_evict_private(llc_t* llc, uint8_t* ptr)
+{
+    size_t offset = (uintptr_t)ptr & (llc->page_size - 1);
+
+    for (size_t k = offset; k < llc->private_size; k += llc->page_size) {
+        cache_fill(llc->private_buffer + k);
+    }
+}
+
+/**
+ * Reads the line half a page of `page_size` bytes away from `ptr`, which
+ * brings the translation of its page back into the TLB without touching its
+ * cache set. Reading lines of thousands of pages, as every eviction test
+ * does, flushes the TLB, and a page walk would otherwise make an LLC hit look
+ * like a DRAM access.
+ */
+void llc_touch_page(uint8_t* ptr, size_t page_size)
+{
+    cache_fill((uint8_t*)((uintptr_t)ptr ^ (page_size / 2)));
+}
+
+/**
+ * Collects `n` latencies of reads of `ptr` into `samples`, sorted: served by
+ * the LLC if `dram` is clear, and by DRAM if it is set.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations.
+ */
+static int llc_sample(llc_t* llc, uint8_t* ptr, bool dram, uint64_t* samples,
+                      int n)
+{
+    int maxattempts = 4 * n;
+    int trial = 0;
+
+    for (int attempt = 0; trial < n && attempt < maxattempts; attempt++) {
+        if (dram) {
+            cache_flush(ptr);
+        } else {
+            cache_fill(ptr);
+            llc_evict_private(llc, ptr);
+        }
+
+        llc_touch_page(ptr, llc->page_size);
+
+        if (cache_timed_read(llc->cache, ptr, &samples[trial]) == 0) {
+            trial += 1;
+        }
+    }
+
+    if (trial < n) {
+        return -1;
+    }
+
+    qsort(samples, n, sizeof(*samples), compare_u64);
+
+    return 0;
+}
+
+/**
+ * Measures the latencies of reads served by the LLC and by DRAM and derives
+ * the threshold between them, taking medians so that an interrupt or a line
+ * that slipped out of the LLC does not skew them. The outlier bound is
+ * `CACHE_OUTLIER_FACTOR` times the median DRAM latency, as for the L1.
+ *
+ * Returns -1 if too many samples were lost to CPU migrations, or if the two
+ * cannot be told apart.
+ */
+int llc_calibrate(llc_t* llc)
+{
+    uint64_t hits[LLC_CALIB_TRIALS];
+    uint64_t misses[LLC_CALIB_TRIALS];
+
+    if (llc_sample(llc, llc->buffer, false, hits, LLC_CALIB_TRIALS) != 0 ||
+        llc_sample(llc, llc->buffer, true, misses, LLC_CALIB_TRIALS) != 0) {
+        return -1;
+    }
+
+    llc->hit_latency = hits[LLC_CALIB_TRIALS / 2];
+    llc->miss_latency = misses[LLC_CALIB_TRIALS / 2];
+    llc->hit_threshold = (llc->hit_latency + llc->miss_latency) / 2;
+    llc->outlier_threshold = CACHE_OUTLIER_FACTOR * llc->miss_latency;
+
+    return llc->miss_latency > llc->hit_latency ? 0 : -1;
+}
+
+/**
+ * Looks up the physical address of every page of `llc->buffer` in
+ * `/proc/self/pagemap`, after which `llc_physical()` works and
+ * `llc_build_evsets()` only tries candidates that can share the victim's set.
+ *
+ * The kernel only shows frame numbers to processes with CAP_SYS_ADMIN, and
+ * zeroes them for everyone else. It is also free to migrate the pages later,
+ * which compaction and NUMA balancing do, so the addresses are best used right
+ * away.
+ *
+ * Returns -1, leaving `llc->phys` NULL, if any frame number is unavailable.
+ */
+int llc_map_physical(llc_t* llc)
+{
+    size_t npages = llc_pool_size(llc);
+    uint64_t* entries = calloc(npages, sizeof(*entries));
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    off_t first = (uintptr_t)llc->buffer / llc->page_size;
+    size_t size = npages * sizeof(*entries);
+    bool mapped = false;
+
+    if (entries != NULL && fd >= 0 &&
+        pread(fd, entries, size, first * sizeof(*entries)) == (ssize_t)size) {
+        mapped = true;
+
+        for (size_t k = 0; k < npages; k++) {
+            uint64_t pfn = entries[k] & LLC_PAGEMAP_PFN;
+
+            mapped &= (entries[k] & LLC_PAGEMAP_PRESENT) && pfn != 0;
+            entries[k] = pfn * llc->page_size;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (!mapped) {
+        free(entries);
+        return -1;
+    }
+
+    free(llc->phys);
+    llc->phys = entries;
+
+    return 0;
+}
+
+/**
+ * Returns the physical address of `ptr` within `llc->buffer`. Only valid after
+ * `llc_map_physical()`.
+ */
+uint64_t llc_physical(const llc_t* llc, const uint8_t* ptr)
+{
+    size_t offset = ptr - llc->buffer;
+
+    return llc->phys[offset / llc->page_size] + offset % llc->page_size;
+}
+
+/**
+ * Returns the set within its slice that the line at physical address `paddr`
+ * maps to in the LLC.
+ */
+size_t llc_set_of(const llc_t* llc, uint64_t paddr)
+{
+    return (paddr / llc->line_size) % llc->slice_sets;
+}
+
+/**
+ * Returns the set the line at physical address `paddr` maps to in the L2.
+ */
+size_t llc_l2_set_of(const llc_t* llc, uint64_t paddr)
+{
+    return (paddr / llc->line_size) % llc->l2_sets;
+}
+
+/**
+ * Returns the LLC slice the line at physical address `paddr` maps to, or -1 if
+ * the slice hash is not known.
+ */
+int llc_slice_of(const llc_t* llc, uint64_t paddr)
+{
+    int slice = 0;
+
+    if (llc->nslices == 1) {
+        return 0;
+    }
+
+    if (llc->slice_bits == 0) {
+        return -1;
+    }
+
+    for (int k = 0; k < llc->slice_bits; k++) {
+        slice |= __builtin_parityll(paddr & llc->slice_masks[k]) << k;
+    }
+
+    return slice;
+}
+
+/**
+ * Returns 1 if the lines `a` and `b` of `llc->buffer` map to the same LLC set
+ * and slice, 0 if they do not, and -1 if it takes timing to tell: when no
+ * physical addresses are known, or the slice hash is not.
+ */
+static int llc_same_set(const llc_t* llc, const uint8_t* a, const uint8_t* b)
+{
+    if (llc->phys == NULL) {
+        return -1;
+    }
+
+    uint64_t pa = llc_physical(llc, a);
+    uint64_t pb = llc_physical(llc, b);
+
+    if (llc_set_of(llc, pa) != llc_set_of(llc, pb)) {
+        return 0;
+    }
+
+    int slice = llc_slice_of(llc, pa);
+
+    if (slice < 0) {
+        return -1;
+    }
+
+    return slice == llc_slice_of(llc, pb);
+}
+
+/**
+ * Returns the number of candidate lines at each page offset, one per page of
+ * `llc->buffer`.
+ */
+size_t llc_pool_size(const llc_t* llc)
+{
+    return llc->buffer_size / llc->page_size;
+}
+
+/**
+ * Returns the `k`th candidate line at byte `offset` within a page.
+ */
+uint8_t* llc_pool_line(const llc_t* llc, size_t offset, size_t k)
+{
+    return llc->buffer + k * llc->page_size + offset;
+}
+
+static size_t llc_line_index(const llc_t* llc, const uint8_t* ptr)
+{
+    return (ptr - llc->buffer) / llc->line_size;
+}
+
+static bool llc_is_reserved(const llc_t* llc, const uint8_t* ptr)
+{
+    size_t idx = llc_line_index(llc, ptr);
+
+    return (llc->reserved[idx / 64] >> (idx % 64)) & 1;
+}
+
+static void llc_reserve(llc_t* llc, const uint8_t* ptr)
+{
+    size_t idx = llc_line_index(llc, ptr);
+
+    llc->reserved[idx / 64] |= (uint64_t)1 << (idx % 64);
+}
+
+/**
+ * Returns whether reading the `nlines` lines of `lines` evicts `victim` from
+ * the LLC, by majority over `LLC_TEST_TRIALS` trials. Each trial caches the
+ * victim, reads the lines twice over and times a read of the victim: a DRAM
+ * latency means it went. See `llc_touch_page()` for why its page is touched
+ * first.
+ *
+ * Lines are read twice since one pass may leave a few of them out under
+ * replacement policies that protect lines already in the set.
+ */
+bool llc_evicts(llc_t* llc, uint8_t* victim, uint8_t* const* lines,
+                size_t nlines)
+{
+    int evicted = 0;
+
+    for (int trial = 0; trial < LLC_TEST_TRIALS; trial++) {
+        uint64_t dur;
+
+        cache_fill(victim);
+
+        for (int pass = 0; pass < 2; pass++) {
+            for (size_t k = 0; k < nlines; k++) {
+                cache_fill(lines[k]);
+            }
+        }
+
+        llc_touch_page(victim, llc->page_size);
+
+        if (cache_timed_read(llc->cache, victim, &dur) == 0 &&
+            dur > llc->hit_threshold && dur <= llc->outlier_threshold) {
+            evicted += 1;
+        }
+    }
+
+    return evicted > LLC_TEST_TRIALS / 2;
+}
+
+/**
+ * Runs `llc_evicts()` on behalf of the search for `evset`, counting it.
+ */
+static bool llc_test(llc_t* llc, llc_evset_t* evset, uint8_t* victim,
+                     uint8_t* const* lines, size_t nlines)
+{
+    evset->tests += 1;
+
+    return llc_evicts(llc, victim, lines, nlines);
+}
+
+/**
+ * Initialise `evset` with room for the lines of an LLC of `assoc` ways.
+ */
+int llc_evset_init(llc_evset_t* evset, size_t assoc)
+{
+    memset(evset, 0, sizeof(*evset));
+
+    evset->lines = calloc(LLC_EVSET_CAPACITY(assoc), sizeof(*evset->lines));
+
+    return evset->lines == NULL ? -1 : 0;
+}
+
+void llc_evset_deinit(llc_evset_t* evset)
+{
+    free(evset->lines);
+    evset->lines = NULL;
+}
+
+/**
+ * Reduces the `*n` lines of `cand`, which evict `victim`, to `llc->assoc`
+ * lines that still do, by group testing: the lines are split into
+ * `llc->assoc + 1` groups, and since at most `llc->assoc` of them hold a line
+ * of the victim's set, at least one group can go. Removing it leaves
+ * `llc->assoc / (llc->assoc + 1)` of the lines, so this takes
+ * O(`llc->assoc`^2 * `*n`) reads all told rather than O(`*n`^2).
+ *
+ * A round in which noise hides every removable group is tried again up to
+ * `LLC_REDUCE_RETRIES` times before giving up with more lines than ways, which
+ * the caller can still use if there are not too many. `scratch` must hold
+ * `*n` lines.
+ */
+void llc_reduce(llc_t* llc, llc_evset_t* evset, uint8_t* victim,
+                uint8_t** cand, size_t* n, uint8_t** scratch)
+{
+    size_t ngroups = llc->assoc + 1;
+    int retries = LLC_REDUCE_RETRIES;
+
+    while (*n > llc->assoc) {
+        bool removed = false;
+
+        for (size_t g = 0; g < ngroups && !removed; g++) {
+            size_t lo = g * *n / ngroups;
+            size_t hi = (g + 1) * *n / ngroups;
+            size_t rest = *n - (hi - lo);
+
+            if (hi == lo) {
+                continue;
+            }
+
+            memcpy(scratch, cand, lo * sizeof(*cand));
+            memcpy(scratch + lo, cand + hi, (*n - hi) * sizeof(*cand));
+
+            if (llc_test(llc, evset, victim, scratch, rest)) {
+                memcpy(cand, scratch, rest * sizeof(*cand));
+                *n = rest;
+                removed = true;
+            }
+        }
+
+        if (!removed && --retries < 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * Finds eviction sets for `count` distinct LLC sets at byte `offset` within a
+ * page, from timing alone, and stores them in `evsets`. Their lines are
+ * reserved so that no later eviction set or `llc_signal()` touches them.
+ *
+ * Each victim is the first free candidate that none of the sets found so far
+ * evicts. Candidates at the same offset are added in order of address until
+ * they evict it, which takes about as many of them as there are ways in all
+ * the sets and slices sharing the offset, and `llc_reduce()` whittles them
+ * down to `llc->assoc`.
+ *
+ * Once `llc_map_physical()` has run, candidates in another set, or another
+ * slice where the hash is known, are left out, and so are victims some earlier
+ * set is known to cover. With the slice hash every candidate left is in the
+ * victim's set, and the first `llc->assoc` of them are the eviction set,
+ * confirmed by a single test. Without it, group testing starts from a pool
+ * `llc->slice_sets` times smaller.
+ *
+ * Returns the number of sets found, which is short of `count` if a victim
+ * could not be evicted or reduction stalled above `LLC_EVSET_CAPACITY()`
+ * lines, or -1 if memory runs out.
+ */
+int llc_build_evsets(llc_t* llc, size_t offset, llc_evset_t* evsets,
+                     size_t count)
+{
+    size_t npool = llc_pool_size(llc);
+    uint8_t** cand = calloc(npool, sizeof(*cand));
+    uint8_t** scratch = calloc(npool, sizeof(*scratch));
+    size_t found = 0;
+    size_t next = 0;
+
+    if (cand == NULL || scratch == NULL) {
+        free(cand);
+        free(scratch);
+        return -1;
+    }
+
+    while (found < count) {
+        llc_evset_t* evset = &evsets[found];
+        uint8_t* victim = NULL;
+        size_t ncand = 0;
+
+        uint64_t start = cache_clock();
+
+        evset->offset = offset;
+        evset->tests = 0;
+
+        // A victim some earlier set already evicts would only find it again
+        for (; next < npool && victim == NULL; next++) {
+            uint8_t* line = llc_pool_line(llc, offset, next);
+            bool covered = llc_is_reserved(llc, line);
+
+            for (size_t k = 0; k < found && !covered; k++) {
+                int same = llc_same_set(llc, line, evsets[k].lines[0]);
+
+                covered = (same == 1) ||
+                          (same < 0 && llc_test(llc, evset, line,
+                                                evsets[k].lines,
+                                                evsets[k].nlines));
+            }
+
+            if (!covered) {
+                victim = line;
+            }
+        }
+
+        for (size_t k = next; k < npool && victim != NULL; k++) {
+            uint8_t* line = llc_pool_line(llc, offset, k);
+
+            if (!llc_is_reserved(llc, line) &&
+                llc_same_set(llc, victim, line) != 0) {
+                cand[ncand++] = line;
+            }
+        }
+
+        size_t n = llc->assoc;
+
+        while (n < ncand && !llc_test(llc, evset, victim, cand, n)) {
+            n *= 2;
+        }
+
+        if (victim == NULL || n > ncand) {
+            n = ncand;
+        }
+
+        if (n == 0 || !llc_test(llc, evset, victim, cand, n)) {
+            break;
+        }
+
+        llc_reduce(llc, evset, victim, cand, &n, scratch);
+
+        if (n > LLC_EVSET_CAPACITY(llc->assoc)) {
+            break;
+        }
+
+        memcpy(evset->lines, cand, n * sizeof(*cand));
+        evset->nlines = n;
+        evset->ticks = cache_clock() - start;
+
+        for (size_t k = 0; k < n; k++) {
+            llc_reserve(llc, cand[k]);
+        }
+
+        llc_reserve(llc, victim);
+        found += 1;
+    }
+
+    free(cand);
+    free(scratch);
+
+    return found;
+}
+
+/**
+ * Adds `v` to the GF(2) basis `basis`, kept as one vector per leading bit.
+ *
+ * Returns false if `v` already lies in its span.
+ */
+static bool llc_basis_insert(uint64_t* basis, uint64_t v)
+{
+    for (int bit = 63; bit >= 0 && v != 0; bit--) {
+        if (!((v >> bit) & 1)) {
+            continue;
+        }
+
+        if (basis[bit] == 0) {
+            basis[bit] = v;
+            return true;
+        }
+
+        v ^= basis[bit];
+    }
+
+    return false;
+}
+
+/**
+ * Finds `nbits` masks under which the parity of each of the `nrows`
+ * linearly independent vectors of `rows` is the matching bit of `rhs`, by
+ * Gauss-Jordan elimination: once each row has a leading bit no other row has,
+ * a mask made of the leading bits of the rows whose right hand side is set
+ * satisfies every row. Both arrays are clobbered.
+ */
+static void llc_solve_masks(uint64_t* rows, uint64_t* rhs, size_t nrows,
+                            uint64_t* masks, int nbits)
+{
+    int pivots[64];
+    size_t rank = 0;
+
+    for (int bit = 63; bit >= 0 && rank < nrows; bit--) {
+        size_t r = rank;
+
+        while (r < nrows && !((rows[r] >> bit) & 1)) {
+            r++;
+        }
+
+        if (r == nrows) {
+            continue;
+        }
+
+        uint64_t row = rows[r];
+        uint64_t val = rhs[r];
+
+        rows[r] = rows[rank];
+        rhs[r] = rhs[rank];
+        rows[rank] = row;
+        rhs[rank] = val;
+
+        for (size_t k = 0; k < nrows; k++) {
+            if (k != rank && ((rows[k] >> bit) & 1)) {
+                rows[k] ^= row;
+                rhs[k] ^= val;
+            }
+        }
+
+        pivots[rank++] = bit;
+    }
+
+    for (int j = 0; j < nbits; j++) {
+        masks[j] = 0;
+
+        for (size_t r = 0; r < rank; r++) {
+            masks[j] |= ((rhs[r] >> j) & 1) << pivots[r];
+        }
+    }
+}
+
+/**
+ * Fits a slice hash that is linear in the address bits to the `n` lines of
+ * `lines`, sorted into `nslices` slices by `slice`, which is indexed by page as
+ * `llc_pool_line()` numbers them, with `reps` the first line of each slice.
+ *
+ * Two lines of a slice differ by an address the hash maps to zero, and the
+ * first lines of the others by addresses it maps to distinct non-zero slices.
+ * The former span its kernel, and the latter pick the slice bits out of the
+ * rest; the masks follow from solving the two together.
+ *
+ * The `*nbits` masks are stored in `masks`.
+ *
+ * Returns false if the slices fit no linear hash.
+ */
+bool llc_fit_slices(const llc_t* llc, uint8_t* const* lines, size_t n,
+                    const int* slice, uint8_t* const* reps, size_t nslices,
+                    uint64_t* masks, int* nbits)
+{
+    uint64_t basis[64] = {0};
+    uint64_t rows[64];
+    uint64_t rhs[64];
+    size_t nrows = 0;
+
+    *nbits = 0;
+
+    for (size_t k = 0; k < n; k++) {
+        size_t page = (lines[k] - llc->buffer) / llc->page_size;
+        uint64_t diff = llc_physical(llc, lines[k]) ^
+                        llc_physical(llc, reps[slice[page]]);
+
+        if (llc_basis_insert(basis, diff)) {
+            rows[nrows] = diff;
+            rhs[nrows++] = 0;
+        }
+    }
+
+    uint64_t base = llc_physical(llc, reps[0]);
+
+    for (size_t c = 1; c < nslices; c++) {
+        uint64_t diff = llc_physical(llc, reps[c]) ^ base;
+
+        if (llc_basis_insert(basis, diff)) {
+            if (*nbits == LLC_MAX_SLICE_BITS) {
+                return false;
+            }
+
+            rows[nrows] = diff;
+            rhs[nrows++] = (uint64_t)1 << (*nbits)++;
+        }
+    }
+
+    if (nslices != (size_t)1 << *nbits) {
+        return false;
+    }
+
+    uint64_t seen = 0;
+
+    llc_solve_masks(rows, rhs, nrows, masks, *nbits);
+
+    // Slices that only differ where the kernel does would share a number
+    for (size_t c = 0; c < nslices; c++) {
+        uint64_t diff = llc_physical(llc, reps[c]) ^ base;
+        int bits = 0;
+
+        for (int j = 0; j < *nbits; j++) {
+            bits |= __builtin_parityll(diff & masks[j]) << j;
+        }
+
+        if ((seen >> bits) & 1) {
+            return false;
+        }
+
+        seen |= (uint64_t)1 << bits;
+    }
+
+    return true;
+}
+
+/**
+ * Recovers the slice hash of the LLC from timing and physical addresses,
+ * which `llc_map_physical()` must have looked up, and installs it in `llc`.
+ *
+ * The free candidate lines at byte `offset` within a page that share the set
+ * index of the first one can only differ in slice. They are sorted into
+ * slices by building an eviction set for the first unsorted line, as
+ * `llc_build_evsets()` does, and testing every unsorted line against it. On
+ * Intel parts with a power of two slices the hash is linear in the address
+ * bits, and `llc_fit_slices()` recovers it from the sorted lines.
+ *
+ * The hash is only recovered over the address bits that differ between lines
+ * sharing a set index, and numbers the slices its own way; neither matters to
+ * `llc_build_evsets()`, which only compares lines of the same set index. It
+ * is described in `report`.
+ *
+ * Returns 1, leaving the hash of `llc` alone, if the slices fit no linear hash
+ * or number other than `llc->nslices`, and -1 if there are no physical
+ * addresses, a line cannot be evicted or memory runs out.
+ */
+int llc_recover_slices(llc_t* llc, size_t offset, llc_slice_report_t* report)
+{
+    size_t npool = llc_pool_size(llc);
+    uint8_t** lines = calloc(npool, sizeof(*lines));
+    uint8_t** cand = calloc(npool, sizeof(*cand));
+    uint8_t** scratch = calloc(npool, sizeof(*scratch));
+    int* slice = calloc(npool, sizeof(*slice));
+    uint8_t* reps[1 << LLC_MAX_SLICE_BITS];
+    llc_evset_t evset;
+    size_t nslices = 0;
+    size_t n = 0;
+    int ret = 0;
+
+    memset(report, 0, sizeof(*report));
+
+    if (llc->phys == NULL || lines == NULL || cand == NULL ||
+        scratch == NULL || slice == NULL ||
+        llc_evset_init(&evset, llc->assoc) != 0) {
+        free(lines);
+        free(cand);
+        free(scratch);
+        free(slice);
+        return -1;
+    }
+
+    size_t set = llc_set_of(llc, llc_physical(llc, llc->buffer + offset));
+
+    for (size_t k = 0; k < npool; k++) {
+        uint8_t* line = llc_pool_line(llc, offset, k);
+
+        slice[k] = -1;
+
+        if (!llc_is_reserved(llc, line) &&
+            llc_set_of(llc, llc_physical(llc, line)) == set) {
+            lines[n++] = line;
+        }
+    }
+
+    for (size_t v = 0; v < n && ret == 0; v++) {
+        size_t page = (lines[v] - llc->buffer) / llc->page_size;
+        size_t ncand = 0;
+
+        if (slice[page] >= 0) {
+            continue;
+        }
+
+        if (nslices == sizeof(reps) / sizeof(*reps)) {
+            ret = 1;
+            break;
+        }
+
+        for (size_t k = v + 1; k < n; k++) {
+            if (slice[(lines[k] - llc->buffer) / llc->page_size] < 0) {
+                cand[ncand++] = lines[k];
+            }
+        }
+
+        size_t m = llc->assoc;
+
+        while (m < ncand && !llc_test(llc, &evset, lines[v], cand, m)) {
+            m *= 2;
+        }
+
+        m = m > ncand ? ncand : m;
+
+        if (m == 0 || !llc_test(llc, &evset, lines[v], cand, m)) {
+            ret = -1;
+            break;
+        }
+
+        llc_reduce(llc, &evset, lines[v], cand, &m, scratch);
+
+        if (m > LLC_EVSET_CAPACITY(llc->assoc)) {
+            ret = -1;
+            break;
+        }
+
+        // The lines of the eviction set cannot be tested against it
+        slice[page] = nslices;
+
+        for (size_t k = 0; k < m; k++) {
+            slice[(cand[k] - llc->buffer) / llc->page_size] = nslices;
+        }
+
+        for (size_t k = v + 1; k < n; k++) {
+            size_t other = (lines[k] - llc->buffer) / llc->page_size;
+
+            if (slice[other] < 0 &&
+                llc_test(llc, &evset, lines[k], cand, m)) {
+                slice[other] = nslices;
+            }
+        }
+
+        reps[nslices++] = lines[v];
+    }
+
+    report->nlines = n;
+    report->nslices = nslices;
+    report->tests = evset.tests;
+
+    uint64_t masks[LLC_MAX_SLICE_BITS];
+    int nbits;
+
+    if (ret == 0 && nslices == 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        report->linear = llc_fit_slices(llc, lines, n, slice, reps, nslices,
+                                        masks, &nbits);
+        ret = (report->linear && nslices == llc->nslices) ? 0 : 1;
+    }
+
+    if (ret == 0) {
+        memcpy(llc->slice_masks, masks, nbits * sizeof(*masks));
+        llc->slice_bits = nbits;
+    }
+
+    llc_evset_deinit(&evset);
+    free(lines);
+    free(cand);
+    free(scratch);
+    free(slice);
+
+    return ret;
+}
+
+/**
+ * Finds an eviction set for the LLC set of the first free candidate line at
+ * byte `offset` within a page, as `llc_build_evsets()` does.
+ *
+ * Returns -1 if none could be found.
+ */
+int llc_build_evset(llc_t* llc, size_t offset, llc_evset_t* evset)
+{
+    return llc_build_evsets(llc, offset, evset, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * Fills the LLC set of `evset` with its lines, reading them twice over as
+ * `llc_evicts()` does.
+ */
+void llc_prime(const llc_evset_t* evset)
+{
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t k = 0; k < evset->nlines; k++) {
+            cache_fill(evset->lines[k]);
+        }
+    }
+}
+
+/**
+ * Times a read of each line of `evset`, last primed first, and counts how
+ * many were still cached, storing the latencies in `durs` and the number of
+ * reads that were not rejected in `*valid` unless they are NULL. Anything
+ * short of DRAM counts as cached: the lines are usually still in the L1 or L2
+ * as well.
+ *
+ * An outlier is evidence of neither a hit nor an eviction, so it is left out
+ * of both the count and `*valid`, as in `cache_probe_set()`. Other reads are
+ * attributed to a level in `llc->cache->served` as there.
+ *
+ * Returns -1 if the thread migrated during the probe.
+ */
+int llc_probe(llc_t* llc, const llc_evset_t* evset, uint64_t* durs,
+              size_t* valid)
+{
+    size_t nvalid = 0;
+    int count = 0;
+
+    for (size_t n = 0; n < evset->nlines; n++) {
+        uint8_t* ptr = evset->lines[evset->nlines - 1 - n];
+        uint64_t dur;
+
+        llc_touch_page(ptr, llc->page_size);
+
+        if (cache_timed_read(llc->cache, ptr, &dur) != 0) {
+            return -1;
+        }
+
+        if (durs != NULL) {
+            durs[n] = dur;
+        }
+
+        if (dur > llc->outlier_threshold) {
+            llc->cache->outliers += 1;
+            continue;
+        }
+
+        nvalid += 1;
+
+        if (llc->cache->level_latency[CACHE_LEVEL_L1] != 0) {
+            llc->cache->served[cache_classify(llc->cache, dur)] += 1;
+        }
+
+        if (dur <= llc->hit_threshold) {
+            count += 1;
+        }
+    }
+
+    if (valid != NULL) {
+        *valid = nvalid;
+    }
+
+    return count;
+}
+
+/**
+ * Reads every free candidate line at byte `offset` within a page. That is
+ * `LLC_BUFFER_FACTOR` times the associativity of every LLC set and slice
+ * sharing the offset, so it evicts whatever another core keeps in any of
+ * them, without either end knowing which set the other uses.
+ */
+void llc_signal(llc_t* llc, size_t offset)
+{
+    size_t npool = llc_pool_size(llc);
+
+    for (size_t k = 0; k < npool; k++) {
+        uint8_t* line = llc_pool_line(llc, offset, k);
+
+        if (!llc_is_reserved(llc, line)) {
+            cache_fill(line);
+        }
+    }
+}
@@ -1,363 +1,1091 @@
+#include <getopt.h>
 #include <stdbool.h>
-#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <pthread.h>
-#include <sched.h>
-#include <sys/sysinfo.h>
-#include <time.h>
-#include <unistd.h>
-
-/**!
- * Returns the discrete log of the value `n` rounded down to the nearest whole
- * number. Equivallently, returns the position of the most significant one.
- *
- * `n` is assumed to be non-zero.
- *
- * Yes, I know there's a branchless algorithm to do this.
+#include "cache.h"
+#include "calib.h"
+#include "channel.h"
+#include "cpu.h"
+#include "freq.h"
+#include "inclusion.h"
+#include "ladder.h"
+#include "llc.h"
+#include "pingpong.h"
+#include "policy.h"
+#include "prime.h"
+#include "realtime.h"
+#include "sim.h"
+#include "timer.h"
+
+/**
+ * Searches for the shortest prime under the policy of `cache`, installs it
+ * and says what it found.
  */
-uint32_t dlog2(size_t n)
+static void tune_prime(cache_t* cache)
 {
-    uint32_t k = 0;
+    prime_pattern_t pattern;
+    int ret = prime_optimise(cache, &pattern);
+
+    if (ret < 0) {
+        fprintf(stderr, "Warning: could not optimise the prime\n");
+        return;
+    }
 
-    while (n != 0) {
-        n >>= 1;
-        k += 1;
+    if (ret > 0) {
+        printf("Prime:  no pattern evicts reliably (best %.1f%%), keeping "
+               "%zu accesses\n",
+               100.0 * pattern.eviction, cache->prime_len);
+        return;
     }
 
-    return k - 1;
+    printf("Prime:  %zu accesses over %zu lines (window %zu x%zu), "
+           "evicts %.1f%%\n",
+           pattern.len, pattern.lines, pattern.window, pattern.repeat,
+           100.0 * pattern.eviction);
+    printf("Probe:  %s, %.1f%% exact\n",
+           pattern.probe_reverse ? "reverse" : "forward",
+           100.0 * pattern.accuracy);
 }
 
 /**
- * Executes the CLFLUSH instruction for the byte at `ptr`.
- *
- * The MFENCE was necessary to observe precise timings for `timed_read()`.
+ * Says what the timer of `cache` costs, how much it wanders, and how the
+ * calibrated latencies compare with that: the net latencies with the
+ * overhead taken off, and the gap and the hit margin of the threshold in
+ * multiples of the noise floor.
  */
-void clflush(uint8_t* ptr)
+static void print_timing(const cache_t* cache)
 {
-    __asm__ __volatile__(
-        "clflush (%[ptr])\n"
-        "mfence\n"
-        :
-        : [ptr] "r"(ptr));
+    // Signed, since nothing stops a bad calibration from putting the misses
+    // or the thresholds below the hits
+    int64_t hit = cache->hit_latency;
+
+    printf("Timing: overhead %lu, noise floor %lu\n", cache->timer_overhead,
+           cache->noise_floor);
+    printf("Net:    hit %lu, miss %lu, gap %.1f floors, threshold hit + "
+           "%.1f floors\n",
+           cache_net(cache, cache->hit_latency),
+           cache_net(cache, cache->miss_latency),
+           cache_floors(cache, (int64_t)cache->miss_latency - hit),
+           cache_floors(cache, (int64_t)cache->hit_threshold - hit));
+    printf("Evict:  net %lu, threshold hit + %.1f floors\n",
+           cache_net(cache, cache->evict_latency),
+           cache_floors(cache, (int64_t)cache->evict_threshold - hit));
+    printf("Levels:");
+
+    for (int level = 0; level < CACHE_NLEVELS; level++) {
+        if (cache->level_latency[level] != 0) {
+            printf(" %s %lu", cache_level_names[level],
+                   cache->level_latency[level]);
+        } else {
+            printf(" %s -", cache_level_names[level]);
+        }
+    }
+
+    printf("\n");
 }
 
 /**
- * Invokes `clflush()`.
- *
- * This is an abstraction for the purpose of experimentation, but currently
- * redundant.
+ * Measures every timer, says how each did, switches `cache` to the best with
+ * the best probe instruction for it, recalibrates and stores the result in
+ * the file at `path` unless that is NULL.
  */
-void cache_flush(uint8_t* ptr)
+static void run_timers(cache_t* cache, const char* path)
 {
-    clflush(ptr);
+    cache_timer_stats_t stats[CACHE_NTIMERS];
+    calib_key_t key;
+
+    if (cache_select_timer(cache, stats) != 0) {
+        printf("No timer could be used\n");
+        return;
+    }
+
+    printf("Timer   Overhead  Jitter  SNR\n");
+
+    for (int timer = 0; timer < CACHE_NTIMERS; timer++) {
+        if (!stats[timer].available) {
+            printf("%-7s unavailable\n", cache_timer_names[timer]);
+            continue;
+        }
+
+        printf("%-7s %-9.1f %-7.2f %.2f\n", cache_timer_names[timer],
+               stats[timer].overhead, stats[timer].jitter, stats[timer].snr);
+    }
+
+    if (cache_select_probe(cache, NULL) != 0 || cache_calibrate(cache) != 0) {
+        printf("Could not recalibrate with %s\n",
+               cache_timer_names[cache->timer]);
+        return;
+    }
+
+    printf("Timer: %s, reads timed with %s (hit %lu, miss %lu)\n",
+           cache_timer_names[cache->timer], cache_probe_names[cache->probe],
+           cache->hit_latency, cache->miss_latency);
+    print_timing(cache);
+
+    if (path != NULL && calib_key_init(&key, cache->cpu) == 0 &&
+        calib_store(path, &key, cache) != 0) {
+        fprintf(stderr, "Warning: could not store the timer in %s\n", path);
+    }
 }
 
 /**
- * Simply reads from the byte and throws it away.
- *
- * Probably can be more simply done with a volatile read of `ptr`.
+ * Recovers the slice hash of the LLC from timing and physical addresses, says
+ * what it found and stores it in the file at `path` unless that is NULL.
  */
-void cache_fill(uint8_t* ptr)
+static void run_slices(cache_t* cache, const char* path)
 {
-    __asm__ __volatile__("mov (%[ptr]), %%al\n" : : [ptr] "r"(ptr) : "rax");
+    llc_t llc;
+    llc_slice_report_t report;
+    calib_key_t key;
+
+    if (llc_init(&llc, cache) != 0 || llc_calibrate(&llc) != 0) {
+        printf("Could not measure the LLC\n");
+        llc_deinit(&llc);
+        return;
+    }
+
+    if (llc_map_physical(&llc) != 0) {
+        printf("No physical addresses in /proc/self/pagemap, run as root\n");
+        llc_deinit(&llc);
+        return;
+    }
+
+    int ret = llc_recover_slices(&llc, 0, &report);
+
+    printf("Slices: %zu lines sorted into %zu slices after %lu tests, %zu "
+           "expected\n",
+           report.nlines, report.nslices, report.tests, llc.nslices);
+
+    if (ret < 0) {
+        printf("Could not sort the lines into slices\n");
+    } else if (ret > 0) {
+        printf("%s\n", report.linear ? "Slice count does not match the LLC"
+                                     : "No linear hash fits the slices");
+    } else {
+        for (int k = 0; k < llc.slice_bits; k++) {
+            printf("Hash:   slice bit %d = parity(address & %#lx)\n", k,
+                   llc.slice_masks[k]);
+        }
+
+        if (path != NULL && calib_key_init(&key, cache->cpu) == 0 &&
+            calib_store_slices(path, &key, &llc) != 0) {
+            fprintf(stderr, "Warning: could not store the hash in %s\n",
+                    path);
+        }
+    }
+
+    llc_deinit(&llc);
 }
 
-/**
- * Times a read to the byte at `ptr`.
- *
- * This does not have to be accurate. In fact, the two requiremetns are for it
- * to be precise (that is, low deviation) and for the difference between an L1
- * cache hit and all other accesses scenarios.
- */
-uint64_t timed_read(uint8_t* ptr)
+static void print_inclusion(const inclusion_report_t* report)
 {
-    uint64_t t0[2];
-    uint64_t t1[2];
-
-    __asm__ __volatile__(
-        "rdtscp\n"
-        "lfence\n"
-        "mov %%rax, %[t0_0]\n"
-        "mov %%rdx, %[t0_1]\n"
-        "mov (%[ptr]), %%al\n"
-        "rdtscp\n"
-        "lfence\n"
-        "mov %%rax, %[t1_0]\n"
-        "mov %%rdx, %[t1_1]\n"
-        : [t0_0] "=r"(t0[0]), [t0_1] "=r"(t0[1]), [t1_0] "=g"(t1[0]),
-          [t1_1] "=g"(t1[1])
-        : [ptr] "r"(ptr)
-        : "rax", "rcx", "rdx", "rbx");
-
-    return (t1[0] | (t1[1] << 32)) - (t0[0] | (t0[1] << 32));
+    printf("Inclusion:");
+
+    for (int pair = 0; pair < INCLUSION_NPAIRS; pair++) {
+        printf(" %s %s", inclusion_pair_names[pair],
+               inclusion_names[report->pairs[pair]]);
+    }
+
+    printf("\n");
 }
 
 /**
- * Metadata and resources used for manipulating the cache
+ * Tests which cache levels include which, says what it found and stores it
+ * in the file at `path` unless that is NULL or a pair was left unknown.
  */
-typedef struct cache {
-    /// Size of the cache in bytes
-    size_t size;
+static void run_inclusion(cache_t* cache, size_t setno, const char* path)
+{
+    llc_t llc;
+    inclusion_report_t report;
+    calib_key_t key;
+
+    if (llc_init(&llc, cache) != 0 || llc_calibrate(&llc) != 0) {
+        printf("Could not measure the LLC\n");
+        llc_deinit(&llc);
+        return;
+    }
 
-    /// Size of a cache line in bytes
-    size_t line_size;
+    if (inclusion_infer(&llc, setno, &report) != 0) {
+        printf("Could not run the experiments: the set is out of range or "
+               "the CPU is too noisy\n");
+        llc_deinit(&llc);
+        return;
+    }
 
-    /// Size of a cache set in bytes
-    size_t set_size;
+    printf("L1 hit %lu, L2 hit %lu, LLC hit %lu\n", cache->hit_latency,
+           report.l2_latency, llc.hit_latency);
 
-    /// Associativity of the cache - the nubmer of ways in a set.
-    size_t assoc;
+    for (int pair = 0; pair < INCLUSION_NPAIRS; pair++) {
+        printf("  %-7s evicted %d/%d, %s\n", inclusion_pair_names[pair],
+               report.evicted[pair], report.trials,
+               inclusion_names[report.pairs[pair]]);
+    }
 
-    /// Number of sets in the cache
-    size_t nsets;
+    printf("LLC channel: %s\n",
+           inclusion_llc_works(&report) ? "possible" : "cannot work");
 
-    /// Block offset mask for the address
-    uintptr_t offset_mask;
+    // A pair left unknown would be taken for a verdict by later runs
+    if (path != NULL && !inclusion_decided(&report)) {
+        printf("Not stored: some pairs could not be decided\n");
+    } else if (path != NULL && calib_key_init(&key, cache->cpu) == 0 &&
+               calib_store_inclusion(path, &key, &report) != 0) {
+        fprintf(stderr, "Warning: could not store the inclusion in %s\n",
+                path);
+    }
 
-    /// Index mask for the address
-    uintptr_t index_mask;
+    llc_deinit(&llc);
+}
 
-    /// Tag mask for the address
-    uintptr_t tag_mask;
+/**
+ * Sweeps the read latency over working sets up to four times the LLC, prints
+ * the curve and the levels found in it next to the sizes the CPU reports, and
+ * the fingerprint of the host.
+ */
+static void run_ladder(cache_t* cache)
+{
+    char fingerprint[256];
+    ladder_t ladder;
 
-    /// LSB of the `index_mask`
-    int index_shift;
+    if (ladder_run(cache, 0, &ladder) != 0) {
+        printf("Could not run the sweep\n");
+        return;
+    }
 
-    /// LSB of the `tag_mask`
-    int tag_shift;
+    printf("Size (KiB)  Latency\n");
 
-    /// Measured latency of cache hits
-    uint64_t hit_latency;
+    for (size_t k = 0; k < ladder.npoints; k++) {
+        printf("%-11zu %lu\n", ladder.points[k].size >> 10,
+               ladder.points[k].latency);
+    }
 
-    /// Measured latency of cache misses
-    uint64_t miss_latency;
+    for (size_t k = 0; k < ladder.nlevels; k++) {
+        if (ladder.capacity[k] == 0) {
+            printf("Memory:  latency %lu\n", ladder.latency[k]);
+            continue;
+        }
 
-    /// Heuristic threshold for determining if a timed read is a hit or not.
-    /// Currently the average of the hit and miss latency.
-    uint64_t hit_threshold;
+        int match = ladder_match(&ladder, k);
 
-    /// Size of `buffer` in bytes
-    size_t buffer_size;
+        printf("Level %zu: latency %lu up to %zu KiB", k + 1,
+               ladder.latency[k], ladder.capacity[k] >> 10);
 
-    /// A buffer a multiple size of the cache used for manipulation of the cache
-    uint8_t* buffer;
-} cache_t;
+        if (match < 0) {
+            printf(", no reported cache within 2x\n");
+        } else {
+            printf(", L%d reported at %zu KiB\n", match + 1,
+                   ladder.reported[match] >> 10);
+        }
+    }
+
+    ladder_fingerprint(&ladder, fingerprint, sizeof(fingerprint));
+    printf("Fingerprint: %s\n", fingerprint);
+}
 
 /**
- * Initialzie the `cache` structure
+ * Prints the CPUs of `cluster` in tier `tier` as a kernel CPU list, such as
+ * "0-3,8".
  */
-int cache_init(cache_t* cache)
+static void print_cluster(const pingpong_t* pp, size_t tier, int cluster)
 {
-    memset(cache, 0, sizeof(*cache));
+    const int* clusters = &pp->clusters[tier * pp->ncpus];
+    const char* sep = "";
 
-    cache->size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
-    cache->line_size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
-    cache->assoc = sysconf(_SC_LEVEL1_DCACHE_ASSOC);
+    for (int cpu = 0; cpu < pp->ncpus; cpu++) {
+        if (clusters[cpu] != cluster) {
+            continue;
+        }
+
+        int last = cpu;
 
-    cache->set_size = (cache->line_size * cache->assoc);
-    cache->nsets = cache->size / cache->set_size;
+        while (last + 1 < pp->ncpus && clusters[last + 1] == cluster) {
+            last += 1;
+        }
 
-    cache->index_shift = dlog2(cache->line_size);
-    cache->tag_shift = dlog2(cache->nsets) + cache->index_shift;
+        if (last == cpu) {
+            printf("%s%d", sep, cpu);
+        } else {
+            printf("%s%d-%d", sep, cpu, last);
+        }
 
-    cache->offset_mask = cache->line_size - 1;
-    cache->index_mask = (cache->nsets - 1) << cache->index_shift;
-    cache->tag_mask = (~0UL) << cache->tag_shift;
+        sep = ",";
+        cpu = last;
+    }
+}
 
-    cache->buffer_size = cache->size * cache->assoc;
-    cache->buffer = aligned_alloc(cache->size, cache->buffer_size);
+/**
+ * Bounces a line between every pair of the CPUs in `cpus`, prints the round
+ * trips as a matrix and the clusters the CPUs fall into at each tier.
+ */
+static void run_pingpong(cache_t* cache, const cpu_set_t* cpus)
+{
+    pingpong_t pp;
 
-    if (cache->buffer == NULL) {
-        return -1;
+    if (CPU_COUNT(cpus) < 2) {
+        printf("Only one CPU is allowed, so there is no pair to measure\n");
+        return;
     }
 
-    const int NTRIALS = 1024;
-    uint64_t mean;
+    if (pingpong_measure(cache, cpus, &pp) != 0) {
+        printf("Could not measure any pair of CPUs\n");
+        return;
+    }
 
-    mean = 0;
+    printf("Round trips in TSC ticks\nCPU ");
 
-    for (int trial = 0; trial < NTRIALS; trial++) {
-        cache_fill(&cache->buffer[0]);
-        mean += timed_read(&cache->buffer[0]);
+    for (int b = 0; b < pp.ncpus; b++) {
+        if (CPU_ISSET(b, &pp.cpus)) {
+            printf(" %5d", b);
+        }
     }
 
-    cache->hit_latency = mean / NTRIALS;
+    printf("\n");
+
+    for (int a = 0; a < pp.ncpus; a++) {
+        if (!CPU_ISSET(a, &pp.cpus)) {
+            continue;
+        }
+
+        printf("%-4d", a);
+
+        for (int b = 0; b < pp.ncpus; b++) {
+            if (!CPU_ISSET(b, &pp.cpus)) {
+                continue;
+            }
 
-    mean = 0;
+            uint64_t rtt = pingpong_rtt(&pp, a, b);
 
-    for (int trial = 0; trial < NTRIALS; trial++) {
-        cache_flush(&cache->buffer[0]);
-        mean += timed_read(&cache->buffer[0]);
+            if (rtt != 0) {
+                printf(" %5lu", rtt);
+            } else {
+                printf(" %5s", "-");
+            }
+        }
+
+        printf("\n");
+    }
+
+    if (pp.ntiers == 0) {
+        printf("Tiers:  none, every pair is about as close as any other\n");
     }
 
-    cache->miss_latency = mean / NTRIALS;
+    for (size_t tier = 0; tier < pp.ntiers; tier++) {
+        printf("Tier %zu: up to %lu ticks, %d clusters:", tier + 1,
+               pp.tier_latency[tier], pp.nclusters[tier]);
 
-    cache->hit_threshold = (cache->hit_latency + cache->miss_latency) / 2;
+        for (int cluster = 0; cluster < pp.nclusters[tier]; cluster++) {
+            printf(" ");
+            print_cluster(&pp, tier, cluster);
+        }
 
-    memset(cache->buffer, 0, cache->size);
+        printf("\n");
+    }
 
-    return 0;
+    pingpong_deinit(&pp);
 }
 
-/**
- *  Tear down the `cache` structure
- */
-int cache_deinit(cache_t* cache)
+static void print_calib_table(const calib_table_t* table)
 {
-    free(cache->buffer);
+    printf("CPU   Hit   Miss  Threshold  Floor  Source\n");
+
+    for (int cpu = 0; cpu < table->ncpus; cpu++) {
+        const calib_entry_t* entry = calib_table_lookup(table, cpu);
 
-    return 0;
+        if (entry != NULL) {
+            printf("%-5d %-5lu %-5lu %-10lu %-6lu %s\n", cpu,
+                   entry->hit_latency, entry->miss_latency,
+                   entry->hit_threshold, entry->noise_floor,
+                   entry->restored ? "restored" : "fresh");
+        }
+    }
 }
 
 /**
- * Flush all ways in a set.
- *
- * Note: This function only makes sense when this process has filled all the
- * ways before this call. As such, this will not likely invalidate lines filled
- * by other proceses. If none of `cache->buffer` is present in the cache, all
- * the CLFLUSHes are allowed to be no-ops. To invalidate lines of another
- * process, use the `cache_fill_set()` function to *take* the lines from the
- * other process.
+ * Infers the replacement policy of the L1D, switches `cache` to it and stores
+ * it with the calibration in the file at `path` unless that is NULL.
  */
-int cache_flush_set(cache_t* cache, size_t setno)
+static void run_policy(cache_t* cache, size_t setno, const char* path)
 {
-    if (setno >= cache->nsets) {
-        return -1;
+    policy_report_t report;
+    calib_key_t key;
+
+    if (policy_infer(cache, setno, &report) != 0) {
+        printf("Could not run the experiments: L1 hits (%lu) and L2 hits "
+               "(%lu) are indistinguishable or the CPU is too noisy\n",
+               report.hit_median, report.evicted_median);
+        return;
     }
 
-    uint8_t* ptr = cache->buffer + (setno << cache->index_shift);
+    printf("L1 hit %lu, L2 hit %lu, threshold %lu\n", report.hit_median,
+           report.evicted_median, report.threshold);
+
+    for (int policy = 0; policy < CACHE_NPOLICIES; policy++) {
+        printf("  %-8s error %.3f\n", cache_policy_names[policy],
+               report.error[policy]);
+    }
 
-    for (size_t k = 0; k < cache->assoc; k++) {
-        cache_flush(ptr);
-        ptr += cache->nsets << cache->index_shift;
+    if (!report.confident) {
+        printf("L1D: no model fits, keeping %s\n",
+               cache_policy_names[cache->policy]);
+        return;
     }
 
-    return 0;
+    printf("L1D: %s\n", cache_policy_names[report.best]);
+
+    cache_set_policy(cache, report.best);
+    tune_prime(cache);
+
+    if (path != NULL && calib_key_init(&key, cache->cpu) == 0 &&
+        calib_store(path, &key, cache) != 0) {
+        fprintf(stderr, "Warning: could not store the policy in %s\n", path);
+    }
 }
 
-/**
- * Fill all ways in a set.
- *
- * This works by reading N distinct blocks in a given index, where N is the
- * associativity of the cache.
- *
- * This function works under the assumptions that the cache replacement policy
- * is LRU.
- */
-int cache_fill_set(cache_t* cache, size_t setno)
+static void usage(const char* prog)
 {
-    if (setno >= cache->nsets) {
-        return -1;
+    fprintf(stderr,
+            "Usage: %s [options] <role> <set> <cpu>\n"
+            "\n"
+            "Roles:\n"
+            "  transmit      send a frame over the channel\n"
+            "  receive       wait for a frame and print it\n"
+            "  loopback      send a frame to this thread and print it\n"
+            "  policy        infer the L1D replacement policy and keep it\n"
+            "                with the calibration\n"
+            "  timers        compare the timers, pick the best and keep it\n"
+            "                with the calibration\n"
+            "  slices        recover the LLC slice hash, which needs root,\n"
+            "                and keep it with the calibration\n"
+            "  inclusion     test which cache levels include which and keep\n"
+            "                it with the calibration\n"
+            "  ladder        sweep the read latency over growing working\n"
+            "                sets and find the cache levels in it\n"
+            "  pingpong      time a line bouncing between every pair of\n"
+            "                allowed CPUs and cluster them by it\n"
+            "\n"
+            "Options:\n"
+            "  --reprobe N   prime N extra times after a probe that lost a\n"
+            "                read to an outlier\n"
+            "  --realtime    lock memory, run under SCHED_FIFO and check that\n"
+            "                the CPU is isolated\n"
+            "  --no-warmup   calibrate without waiting for the clock to settle\n"
+            "  --calib-file PATH\n"
+            "                where calibrations are kept between runs\n"
+            "  --recalibrate calibrate even if a stored calibration exists\n"
+            "  --calibrate-all\n"
+            "                calibrate every allowed CPU in parallel and use\n"
+            "                the calibration of the CPU the role runs on\n"
+            "  --period TICKS\n"
+            "                length of a symbol slot in TSC ticks\n"
+            "  --timeout SECONDS\n"
+            "                how long the receiver waits for a frame\n"
+            "  --track-shift N\n"
+            "                weight of 1/2^N for threshold tracking, 0 to\n"
+            "                keep the calibrated threshold\n"
+            "  --policy NAME assume the lru, plru or random replacement policy\n"
+            "  --shared PATH use Flush+Reload over a file both ends map\n"
+            "                instead of prime+probe; <set> then picks the\n"
+            "                line within each page\n"
+            "  --flush-flush with --shared, time flushes of the lines instead\n"
+            "                of reloads\n"
+            "  --llc         prime+probe over the last level cache, between\n"
+            "                any two cores; <set> then picks the line within\n"
+            "                each page\n"
+            "  --pagemap     with --llc, find the eviction set from physical\n"
+            "                addresses, which needs root\n"
+            "  --probe INSN  time reads with load, prefetcht0, prefetchnta or\n"
+            "                prefetchw instead of the best one measured\n"
+            "  --timer NAME  time loads with rdtscp, lfence, mfence, cpuid or\n"
+            "                rdpmc instead of the best one measured\n"
+            "  --sim POLICY  run against a simulated cache with lru, plru or\n"
+            "                random replacement instead of hardware, which\n"
+            "                --policy then defaults to\n"
+            "  --sim-noise TICKS\n"
+            "                maximum jitter added to each simulated read\n"
+            "  --sim-outliers PPM\n"
+            "                rate of simulated interrupts per million reads\n"
+            "  --sim-seed SEED\n"
+            "                seed of the simulator's random number generator\n"
+            "  --sim-host    simulate the geometry of the host's L1D instead\n"
+            "                of a 32K 8-way one\n",
+            prog);
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option options[] = {
+        {"reprobe", required_argument, NULL, 'r'},
+        {"realtime", no_argument, NULL, 'R'},
+        {"no-warmup", no_argument, NULL, 'W'},
+        {"calib-file", required_argument, NULL, 'c'},
+        {"recalibrate", no_argument, NULL, 'C'},
+        {"calibrate-all", no_argument, NULL, 'A'},
+        {"period", required_argument, NULL, 'p'},
+        {"timeout", required_argument, NULL, 't'},
+        {"track-shift", required_argument, NULL, 'T'},
+        {"policy", required_argument, NULL, 'P'},
+        {"sim", required_argument, NULL, 's'},
+        {"sim-noise", required_argument, NULL, 'n'},
+        {"sim-outliers", required_argument, NULL, 'o'},
+        {"sim-seed", required_argument, NULL, 'S'},
+        {"sim-host", no_argument, NULL, 'H'},
+        {"shared", required_argument, NULL, 'F'},
+        {"flush-flush", no_argument, NULL, 'f'},
+        {"llc", no_argument, NULL, 'L'},
+        {"pagemap", no_argument, NULL, 'G'},
+        {"probe", required_argument, NULL, 'b'},
+        {"timer", required_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int reprobes = 0;
+    bool realtime = false;
+    bool warmup = true;
+    char calib_path[4096];
+    bool have_calib_path =
+        (calib_default_path(calib_path, sizeof(calib_path)) == 0);
+    bool recalibrate = false;
+    bool calibrate_all = false;
+    uint64_t period = 0;
+    int timeout = CHANNEL_DEFAULT_TIMEOUT;
+    int track_shift = 4;
+    bool simulate = false;
+    bool force_policy = false;
+    cache_policy_t policy = CACHE_POLICY_LRU;
+    sim_config_t sim_config;
+    const char* shared_path = NULL;
+    channel_mode_t shared_mode = CHANNEL_FLUSH_RELOAD;
+    bool use_llc = false;
+    bool use_pagemap = false;
+    bool force_probe = false;
+    cache_probe_t probe = CACHE_PROBE_LOAD;
+    bool force_timer = false;
+    cache_timer_t timer = CACHE_TIMER_RDTSCP;
+    int opt;
+
+    sim_default_config(&sim_config);
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                reprobes = atoi(optarg);
+                break;
+            case 'R':
+                realtime = true;
+                break;
+            case 'W':
+                warmup = false;
+                break;
+            case 'c':
+                snprintf(calib_path, sizeof(calib_path), "%s", optarg);
+                have_calib_path = true;
+                break;
+            case 'C':
+                recalibrate = true;
+                break;
+            case 'A':
+                calibrate_all = true;
+                break;
+            case 'p':
+                period = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                timeout = atoi(optarg);
+                break;
+            case 'T':
+                track_shift = atoi(optarg);
+
+                // The averages keep `TRACK_FRAC_BITS` of their 64 bits for
+                // the fraction, and shift the rest by this much
+                if (track_shift < 0 ||
+                    track_shift > 64 - TRACK_FRAC_BITS) {
+                    fprintf(stderr, "Track shift out of range: %s\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if (cache_parse_policy(optarg, &policy) != 0) {
+                    fprintf(stderr, "Unknown replacement policy: %s\n", optarg);
+                    return 1;
+                }
+                force_policy = true;
+                break;
+            case 's':
+                if (cache_parse_policy(optarg, &sim_config.policy) != 0) {
+                    fprintf(stderr, "Unknown replacement policy: %s\n", optarg);
+                    return 1;
+                }
+                simulate = true;
+                break;
+            case 'n':
+                sim_config.noise = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                sim_config.outlier_ppm = strtoul(optarg, NULL, 0);
+                break;
+            case 'S':
+                sim_config.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'H':
+                sim_host_geometry(&sim_config);
+                break;
+            case 'F':
+                shared_path = optarg;
+                break;
+            case 'f':
+                shared_mode = CHANNEL_FLUSH_FLUSH;
+                break;
+            case 'L':
+                use_llc = true;
+                break;
+            case 'G':
+                use_pagemap = true;
+                break;
+            case 'b':
+                if (cache_parse_probe(optarg, &probe) != 0) {
+                    fprintf(stderr, "Unknown probe instruction: %s\n", optarg);
+                    return 1;
+                }
+                force_probe = true;
+                break;
+            case 'm':
+                if (cache_parse_timer(optarg, &timer) != 0) {
+                    fprintf(stderr, "Unknown timer: %s\n", optarg);
+                    return 1;
+                }
+                force_timer = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 3) {
+        usage(argv[0]);
+        return 1;
     }
 
-    uint8_t* ptr = cache->buffer + (setno << cache->index_shift);
+    char* role = argv[optind];
+    int setno = atoi(argv[optind + 1]);
+    int cpuno = atoi(argv[optind + 2]);
+    cpu_set_t allowed;
 
-    for (size_t k = 0; k < cache->assoc; k++) {
-        cache_fill(ptr);
-        ptr += cache->nsets << cache->index_shift;
+    // Kept from before pinning, for the roles that spread over the CPUs
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        CPU_SET(cpuno, &allowed);
     }
 
-    return 0;
-}
+    if (pin_current_thread(cpuno) != 0) {
+        fprintf(stderr, "Failed to pin to CPU %d\n", cpuno);
+        return 1;
+    }
 
-/**
- * Performs a timed read on each block in the cache and counts how many blocks
- * are heuristically determined as present.
- *
- * This is useful after a `cache_fill_set()` invocation on the same set. After
- * that call finishes, this process `owns` all the ways in the set. Therefore,
- * if this function is called shortly after `cache_fill_set()` on the same set,
- * one should expect this function to return a number close to `cache->assoc`.
- */
-int cache_count_hits(cache_t* cache, size_t setno)
-{
-    if (setno >= cache->nsets) {
-        return -1;
+    if (realtime) {
+        realtime_enter(cpuno);
+        realtime_prefault_stack();
+    }
+
+    if (use_pagemap && !use_llc) {
+        fprintf(stderr, "--pagemap only works with --llc\n");
+        return 1;
     }
 
-    uint8_t* ptr = cache->buffer + (setno << cache->index_shift);
+    if (use_llc && shared_path != NULL) {
+        fprintf(stderr, "--llc does not work with --shared\n");
+        return 1;
+    }
 
-    int count = 0;
+    // The simulated clock has no frequency, and a simulated calibration must
+    // not end up in the file meant for the hardware.
+    if (simulate) {
+        if (calibrate_all) {
+            fprintf(stderr, "--calibrate-all does not work with --sim\n");
+            return 1;
+        }
 
-    for (size_t k = 0; k < cache->assoc; k++) {
-        uint64_t dur = timed_read(ptr);
+        if (use_llc || strcmp(role, "slices") == 0 ||
+            strcmp(role, "inclusion") == 0) {
+            fprintf(stderr, "The simulator has no LLC for --llc, slices or "
+                            "inclusion\n");
+            return 1;
+        }
 
-        if (cache->hit_threshold >= dur) {
-            count += 1;
+        if (strcmp(role, "pingpong") == 0) {
+            fprintf(stderr, "The simulator has no cores to bounce a line "
+                            "between\n");
+            return 1;
         }
 
-        ptr += cache->nsets << cache->index_shift;
+        if (sim_init(&sim_config) != 0) {
+            fprintf(stderr, "Failed to initialize the simulator\n");
+            return 1;
+        }
 
-        if (!(ptr < (cache->buffer + cache->buffer_size))) {
-            printf("sadface.\n");
+        // The prime is ordered for the policy it is told, and the simulator
+        // knows which one it runs
+        if (!force_policy) {
+            policy = sim_config.policy;
+            force_policy = true;
         }
+
+        warmup = false;
+        have_calib_path = false;
     }
 
-    return count;
-}
+    freq_t freq;
 
-int pin_current_thread(int cpuno)
-{
-    pthread_t current = pthread_self();
-    cpu_set_t cpuset;
+    freq_init(&freq, cpuno);
 
-    CPU_ZERO(&cpuset);
-    CPU_SET(cpuno, &cpuset);
+    if (warmup && freq_warmup(&freq) != 0) {
+        fprintf(stderr, "Warning: clock did not settle after %d windows\n",
+                freq.windows);
+    }
 
-    pthread_setaffinity_np(current, CPU_SETSIZE, &cpuset);
+    cache_t cache;
 
-    return 0;
-}
+    if (cache_init(&cache) != 0) {
+        fprintf(stderr, "Failed to initialize the cache\n");
+        return 1;
+    }
 
-/**
- * Transmit the message over the covert channel.
- *
- * `tx` is the set number for transmitting the message. `rx` is the set number
- * for receiving sync messages from receiver.
- */
-int transmit(cache_t* cache, int setno, char* msg)
-{
-    return 0;
-}
+    if (realtime) {
+        realtime_prefault(cache.buffer, cache.buffer_size);
+    }
 
-int receive(cache_t* cache, int setno)
-{
-    return 0;
-}
+    const char* path = have_calib_path ? calib_path : NULL;
+    // Kept, when there is one, for as long as the cache it calibrated
+    calib_table_t table = {0};
+    int restored;
 
-int main(int argc, char** argv)
-{
-    if (argc != 4) {
+    if (calibrate_all) {
+        restored = -1;
+
+        if (calib_table_build(&table, path, recalibrate) == 0) {
+            print_calib_table(&table);
+
+            if (calib_table_apply(&table, &cache) == 0) {
+                restored = calib_table_lookup(&table, cpuno)->restored;
+            }
+        }
+    } else {
+        restored = calib_restore(&cache, path, recalibrate);
+    }
+
+    if (restored < 0) {
+        fprintf(stderr, "Failed to calibrate the cache\n");
+        calib_table_deinit(&table);
+        cache_deinit(&cache);
         return 1;
     }
 
-    char* role = argv[1];
-    int setno = atoi(argv[2]);
-    int cpuno = atoi(argv[3]);
+    if (force_policy) {
+        cache_set_policy(&cache, policy);
+    }
 
-    pin_current_thread(cpuno);
+    if ((force_probe && probe != cache.probe) ||
+        (force_timer && timer != cache.timer)) {
+        cache.probe = force_probe ? probe : cache.probe;
+        cache.timer = force_timer ? timer : cache.timer;
+
+        if ((cache_backend == &cache_backend_hw &&
+             !timer_available(cache.timer)) ||
+            cache_calibrate(&cache) != 0) {
+            fprintf(stderr, "Failed to calibrate with %s timed by %s\n",
+                    cache_probe_names[cache.probe],
+                    cache_timer_names[cache.timer]);
+            calib_table_deinit(&table);
+            cache_deinit(&cache);
+            return 1;
+        }
 
-    cache_t cache;
+        restored = 0;
+    }
+
+    // Records stored before the baseline was measured lack it
+    if (cache.noise_floor == 0 && cache.timer_overhead == 0 &&
+        cache_measure_overhead(&cache) != 0) {
+        fprintf(stderr, "Warning: could not measure the timer overhead\n");
+    }
+
+    // And those stored before the levels were, the levels and the latency
+    // of an eviction
+    if ((cache.level_latency[CACHE_LEVEL_L1] == 0 ||
+         cache.evict_latency == 0) &&
+        cache_calibrate_levels(&cache) != 0) {
+        fprintf(stderr, "Warning: could not measure the cache levels\n");
+    }
+
+    cache.reprobes = reprobes;
+    cache.track_shift = track_shift;
+
+    channel_t channel;
+
+    if (channel_init(&channel, &cache, setno) != 0) {
+        fprintf(stderr, "Invalid set: %d\n", setno);
+        calib_table_deinit(&table);
+        cache_deinit(&cache);
+        return 1;
+    }
+
+    if (shared_path != NULL &&
+        channel_map_shared(&channel, shared_path, shared_mode) != 0) {
+        fprintf(stderr, "Cannot use %s for the shared channel\n", shared_path);
+        channel_deinit(&channel);
+        calib_table_deinit(&table);
+        cache_deinit(&cache);
+        return 1;
+    }
+
+    // The simulator has no LLC, so this is only ever the hardware
+    llc_t llc = {0};
+    bool slices_restored = false;
+    inclusion_report_t inclusion;
+
+    if (use_llc) {
+        bool receiver = (strcmp(role, "transmit") != 0);
+
+        if (llc_init(&llc, &cache) != 0 || llc_calibrate(&llc) != 0) {
+            fprintf(stderr, "Cannot run the channel over the LLC\n");
+            channel_deinit(&channel);
+            llc_deinit(&llc);
+            calib_table_deinit(&table);
+            cache_deinit(&cache);
+            return 1;
+        }
+
+        calib_key_t key;
+        bool keyed = (path != NULL && calib_key_init(&key, cpuno) == 0);
+
+        slices_restored = keyed && calib_load_slices(path, &key, &llc) == 0;
+
+        // A hierarchy that keeps the other core's lines in its private
+        // caches defeats the channel, however long it runs
+        if (!keyed || calib_load_inclusion(path, &key, &inclusion) != 0) {
+            if (inclusion_infer(&llc, setno, &inclusion) != 0) {
+                memset(&inclusion, 0, sizeof(inclusion));
+                fprintf(stderr, "Warning: could not test whether the LLC "
+                                "includes the private caches, assuming it "
+                                "does\n");
+            } else if (!inclusion_decided(&inclusion)) {
+                // Kept only once the experiments agree, so a noisy run does
+                // not decide every later one
+                fprintf(stderr, "Warning: the inclusion experiments did not "
+                                "agree, assuming what they could not tell\n");
+            } else if (keyed &&
+                       calib_store_inclusion(path, &key, &inclusion) != 0) {
+                fprintf(stderr, "Warning: could not store the inclusion in "
+                                "%s\n",
+                        path);
+            }
+        }
+
+        if (!inclusion_llc_works(&inclusion)) {
+            fprintf(stderr, "The LLC does not include the private caches, "
+                            "so --llc cannot evict the other core's lines; "
+                            "use --shared instead\n");
+            channel_deinit(&channel);
+            llc_deinit(&llc);
+            calib_table_deinit(&table);
+            cache_deinit(&cache);
+            return 1;
+        }
+
+        if (use_pagemap && llc_map_physical(&llc) != 0) {
+            fprintf(stderr, "No physical addresses in /proc/self/pagemap, "
+                            "searching by timing alone\n");
+        }
+
+        if (channel_use_llc(&channel, &llc, receiver) != 0) {
+            fprintf(stderr, "Cannot run the channel over the LLC\n");
+            channel_deinit(&channel);
+            llc_deinit(&llc);
+            calib_table_deinit(&table);
+            cache_deinit(&cache);
+            return 1;
+        }
+    }
 
-    cache_init(&cache);
+    if (period == 0) {
+        period = use_llc ? CHANNEL_LLC_PERIOD : CHANNEL_DEFAULT_PERIOD;
+    }
+
+    channel.period = period;
+    channel.timeout = timeout;
+    channel.freq = warmup ? &freq : NULL;
 
     printf("Set:    %d\n", setno);
     printf("CPU:   %d\n", cpuno);
+    printf("Backend: %s\n", cache_backend->name);
+
+    if (channel.mode == CHANNEL_FLUSH_RELOAD) {
+        printf("Mode:   flush+reload over %s\n", shared_path);
+    } else if (channel.mode == CHANNEL_FLUSH_FLUSH) {
+        printf("Mode:   flush+flush over %s (flush hit %lu, miss %lu)\n",
+               shared_path, cache.flush_hit_latency, cache.flush_miss_latency);
+    } else if (channel.mode == CHANNEL_LLC) {
+        printf("Mode:   llc prime+probe (hit %lu, dram %lu, threshold %lu)\n",
+               llc.hit_latency, llc.miss_latency, llc.hit_threshold);
+
+        if (channel.evset.nlines != 0) {
+            printf("Evset:  %zu lines at offset %zu after %lu tests "
+                   "(%.1f Mticks)\n",
+                   channel.evset.nlines, channel.evset.offset,
+                   channel.evset.tests, channel.evset.ticks / 1e6);
+        }
+
+        const char* hash = (llc.slice_bits != 0) ? "known" : "unknown";
+
+        print_inclusion(&inclusion);
+
+        printf("Slices: %zu of %zu sets, hash %s\n", llc.nslices,
+               llc.slice_sets, slices_restored ? "recovered" : hash);
+
+        if (llc.phys != NULL && channel.evset.nlines != 0) {
+            uint64_t paddr = llc_physical(&llc, channel.evset.lines[0]);
+
+            printf("Pagemap: set %zu of %zu, slice %d of %zu (-1 unknown), "
+                   "L2 set %zu of %zu\n",
+                   llc_set_of(&llc, paddr), llc.slice_sets,
+                   llc_slice_of(&llc, paddr), llc.nslices,
+                   llc_l2_set_of(&llc, paddr), llc.l2_sets);
+        }
+    } else {
+        printf("Mode:   prime+probe\n");
+    }
+
+    printf("Policy: %s\n", cache_policy_names[cache.policy]);
+    tune_prime(&cache);
+    printf("Calibration: %s (hit %lu, miss %lu, threshold %lu)\n",
+           restored ? "restored" : "fresh", cache.hit_latency,
+           cache.miss_latency, cache.hit_threshold);
+    printf("Reads:  timed with %s, %s\n", cache_probe_names[cache.probe],
+           cache_timer_names[cache.timer]);
+    print_timing(&cache);
+
+    // Exit status of the role, non-zero when a loopback lost its frame
+    int status = 0;
 
     if (strcmp(role, "transmit") == 0) {
+        const char* msg = "hello world!";
+
         printf("Role:  TRANSMIT\n");
-        transmit(&cache, setno, "hello world!");
+        channel_transmit(&channel, (const uint8_t*)msg, strlen(msg));
     } else if (strcmp(role, "receive") == 0) {
+        uint8_t msg[UINT8_MAX];
+
         printf("Role:  RECEIVE\n");
-        receive(&cache, setno);
+
+        int len = channel_receive(&channel, msg, sizeof(msg));
+
+        if (len < 0) {
+            printf("No frame received\n");
+        } else {
+            printf("Received: %.*s\n", len, (char*)msg);
+        }
+    } else if (strcmp(role, "loopback") == 0) {
+        const char* msg = "hello world!";
+        uint8_t out[UINT8_MAX];
+        cache_t peer;
+
+        printf("Role:  LOOPBACK\n");
+
+        if (cache_init(&peer) != 0) {
+            fprintf(stderr, "Failed to initialize the peer cache\n");
+            status = 1;
+        } else {
+            // The peer evicts our lines with the same prime it would use
+            // against another process
+            cache_set_order(&peer, cache.prime_seq, cache.prime_len,
+                            cache.probe_seq);
+
+            int len = channel_loopback(&channel, &peer, (const uint8_t*)msg,
+                                       strlen(msg), out, sizeof(out));
+
+            if (len < 0) {
+                printf("No frame received\n");
+                status = 1;
+            } else {
+                printf("Received: %.*s\n", len, (char*)out);
+
+                // The checksum is one byte, so compare what came back too
+                if ((size_t)len != strlen(msg) || memcmp(out, msg, len) != 0) {
+                    printf("Frame differs from the one sent\n");
+                    status = 1;
+                }
+            }
+
+            cache_deinit(&peer);
+        }
+    } else if (strcmp(role, "policy") == 0) {
+        printf("Role:  POLICY\n");
+        run_policy(&cache, setno, have_calib_path ? calib_path : NULL);
+    } else if (strcmp(role, "timers") == 0) {
+        printf("Role:  TIMERS\n");
+        run_timers(&cache, have_calib_path ? calib_path : NULL);
+    } else if (strcmp(role, "slices") == 0) {
+        printf("Role:  SLICES\n");
+        run_slices(&cache, have_calib_path ? calib_path : NULL);
+    } else if (strcmp(role, "inclusion") == 0) {
+        printf("Role:  INCLUSION\n");
+        run_inclusion(&cache, setno, have_calib_path ? calib_path : NULL);
+    } else if (strcmp(role, "ladder") == 0) {
+        printf("Role:  LADDER\n");
+        run_ladder(&cache);
+    } else if (strcmp(role, "pingpong") == 0) {
+        printf("Role:  PINGPONG\n");
+        run_pingpong(&cache, &allowed);
     } else {
         printf("Invalid role: %s\n", role);
+        status = 1;
+    }
+
+    if (cache.migrations != 0) {
+        printf("Migrations: %lu samples discarded\n", cache.migrations);
+    }
+
+    if (cache.outliers != 0) {
+        printf("Outliers:   %lu samples rejected\n", cache.outliers);
+    }
+
+    if (cache.served[CACHE_LEVEL_L1] != 0 ||
+        cache.served[CACHE_LEVEL_DRAM] != 0) {
+        printf("Served:    ");
+
+        for (int level = 0; level < CACHE_NLEVELS; level++) {
+            printf(" %s %lu", cache_level_names[level], cache.served[level]);
+        }
+
+        printf("\n");
+    }
+
+    if (cache.tracked != 0) {
+        printf("Tracked:    %lu samples, thresholds now %lu and evict %lu\n",
+               cache.tracked, cache.hit_threshold, cache.evict_threshold);
     }
 
+    if (channel.drifts != 0) {
+        printf("Drifts:     clock moved %lu times during the run\n",
+               channel.drifts);
+    }
+
+    if (warmup && channel.drifts == 0 && freq_drifted(&freq)) {
+        printf("Warning: clock frequency drifted during the run\n");
+    }
+
+    channel_deinit(&channel);
+    llc_deinit(&llc);
+    freq_deinit(&freq);
+    calib_table_deinit(&table);
     cache_deinit(&cache);
+    timer_release();
+
+    if (simulate) {
+        sim_deinit();
+    }
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,355 @@
+#include "pingpong.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "cpu.h"
+
+/**
+ * One end of a ping-pong, run by a thread pinned to `cpu`
+ */
+typedef struct pingpong_end {
+    pthread_t thread;
+
+    /// CPU to run on
+    int cpu;
+
+    /// Whether this end starts every round trip, which the other answers
+    bool initiator;
+
+    /// The line bounced between the two ends
+    uint64_t* line;
+
+    /// Ends that have pinned themselves, or given up, and whether either
+    /// gave up; shared by both ends
+    int* ready;
+    bool* failed;
+
+    /// TSC ticks each trial of `PINGPONG_ROUNDS` round trips took
+    uint64_t ticks[PINGPONG_TRIALS];
+} pingpong_end_t;
+
+/**
+ * Waits for the other end, then bounces the line: the initiator writes the
+ * next odd value and spins until the responder answers with the even one
+ * after it, so every write has to take the line from the other core's cache.
+ * No PAUSE in the spins, which would add more than the transfer to each.
+ */
+static void* pingpong_main(void* arg)
+{
+    pingpong_end_t* end = arg;
+    uint64_t value = 0;
+
+    if (pin_current_thread(end->cpu) != 0) {
+        __atomic_store_n(end->failed, true, __ATOMIC_RELEASE);
+    }
+
+    __atomic_add_fetch(end->ready, 1, __ATOMIC_ACQ_REL);
+
+    while (__atomic_load_n(end->ready, __ATOMIC_ACQUIRE) < 2) {
+    }
+
+    if (__atomic_load_n(end->failed, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    for (int trial = 0; trial < PINGPONG_TRIALS; trial++) {
+        uint64_t start = rdtsc();
+
+        for (int round = 0; round < PINGPONG_ROUNDS; round++) {
+            if (end->initiator) {
+                __atomic_store_n(end->line, value + 1, __ATOMIC_RELEASE);
+
+                while (__atomic_load_n(end->line, __ATOMIC_ACQUIRE) !=
+                       value + 2) {
+                }
+            } else {
+                while (__atomic_load_n(end->line, __ATOMIC_ACQUIRE) !=
+                       value + 1) {
+                }
+
+                __atomic_store_n(end->line, value + 2, __ATOMIC_RELEASE);
+            }
+
+            value += 2;
+        }
+
+        end->ticks[trial] = rdtsc() - start;
+    }
+
+    return NULL;
+}
+
+/**
+ * Bounces `line` between a thread on CPU `a`, which times it, and one on CPU
+ * `b`, and stores the median round trip in `*rtt`.
+ *
+ * Returns -1 if a thread could not be started or pinned.
+ */
+static int pingpong_pair(uint64_t* line, int a, int b, uint64_t* rtt)
+{
+    int ready = 0;
+    bool failed = false;
+    pingpong_end_t ends[2] = {
+        {.cpu = a, .initiator = true},
+        {.cpu = b, .initiator = false},
+    };
+    int started = 0;
+
+    __atomic_store_n(line, 0, __ATOMIC_RELEASE);
+
+    for (; started < 2; started++) {
+        ends[started].line = line;
+        ends[started].ready = &ready;
+        ends[started].failed = &failed;
+
+        if (pthread_create(&ends[started].thread, NULL, pingpong_main,
+                           &ends[started]) != 0) {
+            break;
+        }
+    }
+
+    // Stand in for the end that never started, so the other stops waiting
+    if (started < 2) {
+        __atomic_store_n(&failed, true, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&ready, 2 - started, __ATOMIC_ACQ_REL);
+    }
+
+    for (int k = 0; k < started; k++) {
+        pthread_join(ends[k].thread, NULL);
+    }
+
+    if (failed) {
+        return -1;
+    }
+
+    qsort(ends[0].ticks, PINGPONG_TRIALS, sizeof(*ends[0].ticks),
+          compare_u64);
+    *rtt = ends[0].ticks[PINGPONG_TRIALS / 2] / PINGPONG_ROUNDS;
+
+    return 0;
+}
+
+static int pingpong_find(int* parent, int cpu)
+{
+    while (parent[cpu] != cpu) {
+        parent[cpu] = parent[parent[cpu]];
+        cpu = parent[cpu];
+    }
+
+    return cpu;
+}
+
+/**
+ * Numbers the clusters of CPUs that round trips of at most `bound` connect,
+ * directly or through others, into `clusters` and returns how many there
+ * are. `parent` is scratch space for `ncpus` entries.
+ */
+static int pingpong_cluster(const pingpong_t* pp, uint64_t bound,
+                            int* clusters, int* parent)
+{
+    int nclusters = 0;
+
+    for (int cpu = 0; cpu < pp->ncpus; cpu++) {
+        parent[cpu] = cpu;
+        clusters[cpu] = -1;
+    }
+
+    for (int a = 0; a < pp->ncpus; a++) {
+        for (int b = a + 1; b < pp->ncpus; b++) {
+            uint64_t rtt = pingpong_rtt(pp, a, b);
+
+            if (rtt != 0 && rtt <= bound) {
+                parent[pingpong_find(parent, b)] = pingpong_find(parent, a);
+            }
+        }
+    }
+
+    // Labels go to roots in order of their lowest CPU, and each CPU takes
+    // the label of its root
+    int labels[pp->ncpus];
+
+    memset(labels, -1, sizeof(labels));
+
+    for (int cpu = 0; cpu < pp->ncpus; cpu++) {
+        if (!CPU_ISSET(cpu, &pp->cpus)) {
+            continue;
+        }
+
+        int root = pingpong_find(parent, cpu);
+
+        if (labels[root] < 0) {
+            labels[root] = nclusters++;
+        }
+
+        clusters[cpu] = labels[root];
+    }
+
+    return nclusters;
+}
+
+/**
+ * Finds the tiers in the round trips of `pp` and clusters its CPUs at each.
+ * The widest `PINGPONG_MAX_TIERS` gaps of at least `PINGPONG_TIER_GAP` in the
+ * sorted round trips are the tier boundaries: pairs on either side of such a
+ * gap go through different parts of the interconnect.
+ *
+ * Returns -1 if out of memory.
+ */
+static int pingpong_tiers(pingpong_t* pp)
+{
+    size_t npairs = (size_t)pp->ncpus * pp->ncpus;
+    uint64_t* sorted = calloc(npairs, sizeof(*sorted));
+    int* parent = calloc(pp->ncpus, sizeof(*parent));
+    double widest[PINGPONG_MAX_TIERS] = {0};
+    size_t n = 0;
+
+    pp->ntiers = 0;
+
+    if (sorted == NULL || parent == NULL) {
+        free(sorted);
+        free(parent);
+        return -1;
+    }
+
+    for (size_t k = 0; k < npairs; k++) {
+        if (pp->rtt[k] != 0) {
+            sorted[n++] = pp->rtt[k];
+        }
+    }
+
+    qsort(sorted, n, sizeof(*sorted), compare_u64);
+
+    // Insertion into `widest` by ratio, keeping the bounds alongside
+    for (size_t k = 0; k + 1 < n; k++) {
+        double ratio = (double)sorted[k + 1] / sorted[k];
+        size_t pos = pp->ntiers;
+
+        if (ratio < PINGPONG_TIER_GAP) {
+            continue;
+        }
+
+        while (pos > 0 && widest[pos - 1] < ratio) {
+            if (pos < PINGPONG_MAX_TIERS) {
+                widest[pos] = widest[pos - 1];
+                pp->tier_latency[pos] = pp->tier_latency[pos - 1];
+            }
+
+            pos -= 1;
+        }
+
+        if (pos < PINGPONG_MAX_TIERS) {
+            widest[pos] = ratio;
+            pp->tier_latency[pos] = sorted[k];
+
+            if (pp->ntiers < PINGPONG_MAX_TIERS) {
+                pp->ntiers += 1;
+            }
+        }
+    }
+
+    qsort(pp->tier_latency, pp->ntiers, sizeof(*pp->tier_latency),
+          compare_u64);
+
+    for (size_t tier = 0; tier < pp->ntiers; tier++) {
+        pp->nclusters[tier] =
+            pingpong_cluster(pp, pp->tier_latency[tier],
+                             &pp->clusters[tier * pp->ncpus], parent);
+    }
+
+    free(sorted);
+    free(parent);
+
+    return 0;
+}
+
+/**
+ * Measures the round trip of the first line of `cache->buffer` between every
+ * pair of CPUs in `cpus`, one pair at a time with a pinned thread at each
+ * end, and clusters the CPUs by it into `pp`. This is the cost the channel
+ * pays for every line the two ends share, and the tiers show which CPUs sit
+ * behind the same L3 and which are a die or a socket away.
+ *
+ * The line is only read and written by the two threads, so `cache` must not
+ * be in use by a channel meanwhile. The calling thread keeps its affinity.
+ *
+ * Returns -1 if `cpus` holds fewer than two CPUs, if out of memory, or if no
+ * pair could be measured. Pairs that could not be are left at zero.
+ */
+int pingpong_measure(cache_t* cache, const cpu_set_t* cpus, pingpong_t* pp)
+{
+    uint64_t* line = (uint64_t*)cache->buffer;
+    int measured = 0;
+
+    memset(pp, 0, sizeof(*pp));
+
+    if (CPU_COUNT(cpus) < 2) {
+        return -1;
+    }
+
+    pp->cpus = *cpus;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpus)) {
+            pp->ncpus = cpu + 1;
+        }
+    }
+
+    pp->rtt = calloc((size_t)pp->ncpus * pp->ncpus, sizeof(*pp->rtt));
+    pp->clusters = calloc((size_t)PINGPONG_MAX_TIERS * pp->ncpus,
+                          sizeof(*pp->clusters));
+
+    if (pp->rtt == NULL || pp->clusters == NULL) {
+        pingpong_deinit(pp);
+        return -1;
+    }
+
+    // The line goes the same way both ways, so each pair is timed once
+    for (int a = 0; a < pp->ncpus; a++) {
+        for (int b = a + 1; b < pp->ncpus; b++) {
+            uint64_t rtt;
+
+            if (!CPU_ISSET(a, cpus) || !CPU_ISSET(b, cpus) ||
+                pingpong_pair(line, a, b, &rtt) != 0) {
+                continue;
+            }
+
+            // Zero is kept for pairs that were not measured
+            rtt = (rtt != 0) ? rtt : 1;
+            pp->rtt[a * pp->ncpus + b] = rtt;
+            pp->rtt[b * pp->ncpus + a] = rtt;
+            measured += 1;
+        }
+    }
+
+    if (measured == 0 || pingpong_tiers(pp) != 0) {
+        pingpong_deinit(pp);
+        return -1;
+    }
+
+    return 0;
+}
+
+void pingpong_deinit(pingpong_t* pp)
+{
+    free(pp->rtt);
+    free(pp->clusters);
+    pp->rtt = NULL;
+    pp->clusters = NULL;
+}
+
+/**
+ * Returns the round trip between CPUs `a` and `b`, or zero if it was not
+ * measured.
+ */
+uint64_t pingpong_rtt(const pingpong_t* pp, int a, int b)
+{
+    if (a < 0 || b < 0 || a >= pp->ncpus || b >= pp->ncpus) {
+        return 0;
+    }
+
+    return pp->rtt[a * pp->ncpus + b];
+}
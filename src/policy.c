@@ -0,0 +1,283 @@
+#include "policy.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/// Timed reads per measurement of a line
+#define POLICY_TRIALS 16
+
+/// Runs of `sim_predict()` averaged for random replacement
+#define POLICY_RANDOM_RUNS 64
+
+/// Samples per median in `policy_threshold()`
+#define POLICY_CALIB_TRIALS 256
+
+/// Largest root mean square error for which the best fitting policy is
+/// believed. Above it, the policy is probably adaptive or otherwise unlike
+/// any of the models.
+#define POLICY_MAX_ERROR 0.2
+
+/// Attempts allowed per sample before giving up on a noisy or unstable CPU
+#define POLICY_MAX_ATTEMPTS 8
+
+/// Number of experiments `policy_experiment()` knows
+#define POLICY_NEXPERIMENTS 6
+
+/**
+ * Writes experiment number `n` into `seq` and returns its length. `seq` must
+ * have room for `7 * assoc + 10` entries.
+ *
+ * Lines are numbered as in `cache_line()`. Every experiment starts by flushing
+ * all the lines it uses, filling the set with lines `assoc + 2` to
+ * `2 * assoc + 1` and flushing those again, which leaves the set empty but its
+ * replacement state known. It then fills
+ * lines `0` to `assoc - 1` in order, touches some of them again and brings in
+ * one or two new lines, `assoc` and `assoc + 1`. Which lines survive tells the
+ * policies apart; these are the usual experiments of the replacement policy
+ * literature.
+ */
+static size_t policy_experiment(int n, size_t assoc, size_t* seq)
+{
+    size_t len = 0;
+
+    for (size_t k = 0; k < 2 * assoc + 2; k++) {
+        seq[len++] = k | SIM_FLUSH;
+    }
+
+    for (size_t k = 0; k < assoc; k++) {
+        seq[len++] = assoc + 2 + k;
+    }
+
+    for (size_t k = 0; k < assoc; k++) {
+        seq[len++] = (assoc + 2 + k) | SIM_FLUSH;
+    }
+
+    for (size_t k = 0; k < assoc; k++) {
+        seq[len++] = k;
+    }
+
+    switch (n) {
+        case 0:
+            break;
+        case 1:
+            seq[len++] = 0;
+            break;
+        case 2:
+            for (size_t k = assoc; k > 0; k--) {
+                seq[len++] = k - 1;
+            }
+            break;
+        case 3:
+            for (size_t k = 0; k < assoc; k += 2) {
+                seq[len++] = k;
+            }
+            break;
+        case 4:
+            for (size_t k = assoc / 2; k < assoc; k++) {
+                seq[len++] = k;
+            }
+            break;
+        case 5:
+            for (size_t k = 1; k < assoc; k += 2) {
+                seq[len++] = k;
+            }
+            break;
+    }
+
+    seq[len++] = assoc;
+
+    if (n >= 3) {
+        seq[len++] = assoc + 1;
+    }
+
+    return len;
+}
+
+/**
+ * Replays `seq` on the lines of set `setno`, then times line `line`.
+ *
+ * Returns -1 if the read had to be discarded.
+ */
+static int policy_replay(cache_t* cache, size_t setno, const size_t* seq,
+                         size_t len, size_t line, uint64_t* dur)
+{
+    for (size_t k = 0; k < len; k++) {
+        uint8_t* ptr = cache_line(cache, setno, seq[k] & ~SIM_FLUSH);
+
+        if (seq[k] & SIM_FLUSH) {
+            cache_flush(ptr);
+        } else {
+            cache_fill(ptr);
+        }
+    }
+
+    if (cache_timed_read(cache, cache_line(cache, setno, line), dur) != 0) {
+        return -1;
+    }
+
+    return *dur > cache->outlier_threshold ? -1 : 0;
+}
+
+/**
+ * Measures the latency of an L1 hit and of a read to a line evicted from the
+ * L1 by conflicts, which is served by the L2. `cache->hit_threshold` is
+ * calibrated against flushed lines served by DRAM and is too coarse for this.
+ *
+ * Returns -1 if too many reads had to be discarded.
+ */
+static int policy_threshold(cache_t* cache, size_t setno,
+                             policy_report_t* report)
+{
+    uint64_t hits[POLICY_CALIB_TRIALS];
+    uint64_t evicted[POLICY_CALIB_TRIALS];
+    uint8_t* target = cache_line(cache, setno, 0);
+
+    int attempts = POLICY_MAX_ATTEMPTS * POLICY_CALIB_TRIALS;
+
+    for (int n = 0; n < POLICY_CALIB_TRIALS;) {
+        if (attempts-- == 0) {
+            return -1;
+        }
+
+        cache_fill(target);
+
+        if (cache_timed_read(cache, target, &hits[n]) == 0 &&
+            hits[n] <= cache->outlier_threshold) {
+            n += 1;
+        }
+    }
+
+    attempts = POLICY_MAX_ATTEMPTS * POLICY_CALIB_TRIALS;
+
+    for (int n = 0; n < POLICY_CALIB_TRIALS;) {
+        if (attempts-- == 0) {
+            return -1;
+        }
+
+        cache_fill(target);
+
+        // Four passes over twice as many lines as there are ways evict the
+        // target under any of the policies, without flushing it to DRAM.
+        for (int pass = 0; pass < 4; pass++) {
+            for (size_t k = 1; k <= 2 * cache->assoc; k++) {
+                cache_fill(cache_line(cache, setno, k));
+            }
+        }
+
+        if (cache_timed_read(cache, target, &evicted[n]) == 0 &&
+            evicted[n] <= cache->outlier_threshold) {
+            n += 1;
+        }
+    }
+
+    qsort(hits, POLICY_CALIB_TRIALS, sizeof(*hits), compare_u64);
+    qsort(evicted, POLICY_CALIB_TRIALS, sizeof(*evicted), compare_u64);
+    report->hit_median = percentile(hits, POLICY_CALIB_TRIALS, 50);
+    report->evicted_median = percentile(evicted, POLICY_CALIB_TRIALS, 50);
+    report->threshold = (report->hit_median + report->evicted_median) / 2;
+
+    return 0;
+}
+
+/**
+ * Infers the replacement policy of the L1D by running a set of access
+ * sequences over set `setno` of `cache->buffer`, measuring which lines
+ * survive each one, and comparing the outcome with what the simulator
+ * predicts for each policy it knows.
+ *
+ * Only the L1D is covered: it is the only level `cache_t` describes, and the
+ * other levels are physically indexed.
+ *
+ * Returns -1 if `setno` is out of range, the associativity is too small to
+ * run the experiments, L1 hits and L2 hits cannot be told apart, or too many
+ * reads had to be discarded.
+ */
+int policy_infer(cache_t* cache, size_t setno, policy_report_t* report)
+{
+    size_t assoc = cache->assoc;
+    size_t nlines = assoc + 2;
+    size_t seq[7 * assoc + 10];
+    double measured[POLICY_NEXPERIMENTS][nlines];
+    double sumsq[CACHE_NPOLICIES];
+    size_t count = 0;
+
+    memset(report, 0, sizeof(*report));
+    memset(sumsq, 0, sizeof(sumsq));
+
+    if (setno >= cache->nsets || assoc < 3) {
+        return -1;
+    }
+
+    if (policy_threshold(cache, setno, report) != 0 ||
+        report->evicted_median <= report->hit_median) {
+        return -1;
+    }
+
+    for (int n = 0; n < POLICY_NEXPERIMENTS; n++) {
+        size_t len = policy_experiment(n, assoc, seq);
+
+        for (size_t line = 0; line < nlines; line++) {
+            int misses = 0;
+            int attempts = POLICY_MAX_ATTEMPTS * POLICY_TRIALS;
+
+            for (int trial = 0; trial < POLICY_TRIALS;) {
+                uint64_t dur;
+
+                if (attempts-- == 0) {
+                    return -1;
+                }
+
+                if (policy_replay(cache, setno, seq, len, line, &dur) != 0) {
+                    continue;
+                }
+
+                misses += (dur > report->threshold);
+                trial += 1;
+            }
+
+            measured[n][line] = (double)misses / POLICY_TRIALS;
+        }
+
+        for (int policy = 0; policy < CACHE_NPOLICIES; policy++) {
+            int runs = (policy == CACHE_POLICY_RANDOM) ? POLICY_RANDOM_RUNS : 1;
+            double absent[nlines];
+            bool present[nlines];
+
+            memset(absent, 0, sizeof(absent));
+
+            for (int run = 0; run < runs; run++) {
+                sim_predict(policy, assoc, seq, len, run + 1, present, nlines,
+                            NULL);
+
+                for (size_t line = 0; line < nlines; line++) {
+                    absent[line] += present[line] ? 0.0 : 1.0 / runs;
+                }
+            }
+
+            for (size_t line = 0; line < nlines; line++) {
+                double diff = measured[n][line] - absent[line];
+
+                sumsq[policy] += diff * diff;
+            }
+        }
+
+        count += nlines;
+    }
+
+    report->best = CACHE_POLICY_LRU;
+
+    for (int policy = 0; policy < CACHE_NPOLICIES; policy++) {
+        report->error[policy] = sqrt(sumsq[policy] / count);
+
+        if (report->error[policy] < report->error[report->best]) {
+            report->best = policy;
+        }
+    }
+
+    report->confident = report->error[report->best] <= POLICY_MAX_ERROR;
+
+    return 0;
+}
@@ -0,0 +1,399 @@
+#include "prime.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/// Widest sliding window tried, besides the one covering every line
+#define PRIME_MAX_WINDOW 4
+
+/// Most lines a prime touches, in multiples of the associativity
+#define PRIME_MAX_LINES 3
+
+/// Most times a window is repeated
+#define PRIME_MAX_REPEAT 16
+
+/// Simulated starting states each candidate is tried from
+#define PRIME_TRIALS 256
+
+/// Accesses per way that scramble the set before each trial
+#define PRIME_SCRAMBLE 4
+
+/// Fraction of starting states a prime must evict under random replacement,
+/// where no length guarantees it. Deterministic policies must evict them all.
+#define PRIME_RANDOM_EVICTION 0.99
+
+/// Seed of the starting states, fixed so that every run picks the same prime
+#define PRIME_SEED 0x9e3779b97f4a7c15ULL
+
+/// Most plain passes `prime_passes()` tries
+#define PRIME_MAX_PASSES 8
+
+/**
+ * Writes the accesses of `pattern` into `seq`, lines numbered as in
+ * `cache_line()`, and returns how many there are. `pattern->len` is ignored.
+ */
+size_t prime_pattern_build(const prime_pattern_t* pattern, size_t* seq)
+{
+    size_t len = 0;
+
+    for (size_t first = 0; first + pattern->window <= pattern->lines; first++) {
+        for (size_t rep = 0; rep < pattern->repeat; rep++) {
+            for (size_t k = 0; k < pattern->window; k++) {
+                seq[len++] = first + k;
+            }
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Finds the `assoc` distinct lines `seq` accessed last and stores them in
+ * `lines`, least recently accessed first. These are the lines a prime should
+ * leave in the set, and the ones the probe reads.
+ */
+static void prime_resident(const size_t* seq, size_t len, size_t assoc,
+                           size_t* lines)
+{
+    size_t found = 0;
+
+    for (size_t k = len; k > 0 && found < assoc; k--) {
+        bool seen = false;
+
+        for (size_t n = 0; n < found; n++) {
+            seen |= (lines[assoc - 1 - n] == seq[k - 1]);
+        }
+
+        if (!seen) {
+            lines[assoc - 1 - found] = seq[k - 1];
+            found += 1;
+        }
+    }
+}
+
+/**
+ * Writes `PRIME_SCRAMBLE * assoc` accesses into `seq` that leave a set in a
+ * random state: each is either one of our lines `0..lines-1`, as the previous
+ * symbol would leave them, or one of `2 * assoc` foreign lines numbered from
+ * `PRIME_MAX_LINES * assoc`.
+ */
+static size_t prime_scramble(size_t assoc, size_t lines, uint64_t* rng,
+                             size_t* seq)
+{
+    size_t len = PRIME_SCRAMBLE * assoc;
+
+    for (size_t k = 0; k < len; k++) {
+        uint64_t r = sim_random(rng);
+
+        if (r & 1) {
+            seq[k] = (r >> 1) % lines;
+        } else {
+            seq[k] = PRIME_MAX_LINES * assoc + (r >> 1) % (2 * assoc);
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Counts the random starting states after which the `len` accesses of `prime`
+ * leave exactly the lines `resident` in the set, giving up once more than
+ * `failures` have not. Any other outcome either leaves a foreign line in
+ * place or makes the probe miss lines nobody else touched. `seq` is scratch
+ * space.
+ */
+static int prime_eviction(cache_policy_t policy, size_t assoc, size_t lines,
+                          const size_t* prime, size_t len,
+                          const size_t* resident, int failures, size_t* seq)
+{
+    uint64_t rng = PRIME_SEED;
+    bool present[lines];
+    int evicted = 0;
+
+    for (int trial = 0; trial < PRIME_TRIALS; trial++) {
+        size_t n = prime_scramble(assoc, lines, &rng, seq);
+        bool all = true;
+
+        memcpy(seq + n, prime, len * sizeof(*prime));
+        sim_predict(policy, assoc, seq, n + len, trial + 1, present, lines,
+                    NULL);
+
+        for (size_t k = 0; k < assoc; k++) {
+            all &= present[resident[k]];
+        }
+
+        if (all) {
+            evicted += 1;
+        } else if (--failures < 0) {
+            break;
+        }
+    }
+
+    return evicted;
+}
+
+/**
+ * Returns the fraction of trials in which probing the lines of `probe` in
+ * order counts exactly as many hits as there are probed lines left in the
+ * set, after the prime and a random number of accesses by another process.
+ * Misses evicting lines not yet probed is what makes a probe order count
+ * wrong. `seq` is scratch space.
+ */
+static double prime_accuracy(cache_policy_t policy, size_t assoc,
+                             size_t lines, const size_t* prime, size_t len,
+                             const size_t* probe, size_t* seq)
+{
+    uint64_t rng = PRIME_SEED;
+    bool present[lines];
+    bool hits[(PRIME_SCRAMBLE + 2) * assoc + len];
+    int exact = 0;
+
+    for (int trial = 0; trial < PRIME_TRIALS; trial++) {
+        size_t n = prime_scramble(assoc, lines, &rng, seq);
+        size_t victims = sim_random(&rng) % (assoc + 1);
+        int expected = 0;
+        int counted = 0;
+
+        memcpy(seq + n, prime, len * sizeof(*prime));
+        n += len;
+
+        for (size_t k = 0; k < victims; k++) {
+            seq[n++] = (PRIME_MAX_LINES + 2) * assoc + k;
+        }
+
+        sim_predict(policy, assoc, seq, n, trial + 1, present, lines, NULL);
+
+        for (size_t k = 0; k < assoc; k++) {
+            expected += present[probe[k]];
+            seq[n + k] = probe[k];
+        }
+
+        sim_predict(policy, assoc, seq, n + assoc, trial + 1, present, lines,
+                    hits);
+
+        for (size_t k = 0; k < assoc; k++) {
+            counted += hits[n + k];
+        }
+
+        exact += (counted == expected);
+    }
+
+    return (double)exact / PRIME_TRIALS;
+}
+
+static int compare_patterns(const void* a, const void* b)
+{
+    const prime_pattern_t* pa = a;
+    const prime_pattern_t* pb = b;
+
+    if (pa->len != pb->len) {
+        return pa->len < pb->len ? -1 : 1;
+    }
+
+    if (pa->lines != pb->lines) {
+        return pa->lines < pb->lines ? -1 : 1;
+    }
+
+    return (pa->window > pb->window) - (pa->window < pb->window);
+}
+
+/**
+ * Searches for the shortest prime that leaves only our lines in a set from any
+ * starting state under `cache->policy`, and the probe order
+ * that counts evictions correctly most often after it, and installs both with
+ * `cache_set_order()`. The result is described in `best` unless it is NULL.
+ *
+ * Candidates slide windows of one to `PRIME_MAX_WINDOW` lines, or every line,
+ * over `assoc` to `PRIME_MAX_LINES * assoc` lines, or as many ways as
+ * `cache->buffer` holds if that is fewer, repeating each window up to
+ * `PRIME_MAX_REPEAT` times, and are tried against the simulator from
+ * `PRIME_TRIALS` random starting states in order of length. Under random
+ * replacement no prime is certain, so the first to evict
+ * `PRIME_RANDOM_EVICTION` of the states wins.
+ *
+ * This needs no access to the hardware and gives the same answer every time
+ * for the same policy and associativity.
+ *
+ * Returns 1, leaving the orders of `cache` alone, if no candidate is good
+ * enough; `best` then describes the one that came closest. Returns -1 if out
+ * of memory.
+ */
+int prime_optimise(cache_t* cache, prime_pattern_t* best)
+{
+    size_t assoc = cache->assoc;
+    size_t capacity = CACHE_PRIME_CAPACITY(assoc);
+    size_t ncandidates = ((PRIME_MAX_LINES - 1) * assoc + 1) *
+                         (PRIME_MAX_WINDOW + 1) * PRIME_MAX_REPEAT;
+    double target = (cache->policy == CACHE_POLICY_RANDOM)
+                        ? PRIME_RANDOM_EVICTION
+                        : 1.0;
+    prime_pattern_t* candidates = calloc(ncandidates, sizeof(*candidates));
+    size_t* prime = calloc(capacity, sizeof(*prime));
+    size_t* seq = calloc((PRIME_SCRAMBLE + 2) * assoc + capacity, sizeof(*seq));
+    size_t resident[assoc];
+    size_t probe[assoc];
+    prime_pattern_t chosen = {0};
+    size_t count = 0;
+
+    if (candidates == NULL || prime == NULL || seq == NULL) {
+        free(candidates);
+        free(prime);
+        free(seq);
+        return -1;
+    }
+
+    // Primes may only use distinct ways of `cache->buffer`, which
+    // `cache_init()` has written in full so that none alias the zero page
+    size_t ways = cache->buffer_size / (cache->nsets * cache->line_size);
+    size_t max_lines = PRIME_MAX_LINES * assoc;
+
+    max_lines = (max_lines < ways) ? max_lines : ways;
+
+    for (size_t lines = assoc; lines <= max_lines; lines++) {
+        for (size_t window = 1; window <= PRIME_MAX_WINDOW + 1; window++) {
+            prime_pattern_t pattern = {
+                .lines = lines,
+                .window = window > PRIME_MAX_WINDOW ? lines : window,
+            };
+
+            if (pattern.window > lines ||
+                (window > PRIME_MAX_WINDOW && lines <= PRIME_MAX_WINDOW)) {
+                continue;
+            }
+
+            for (size_t repeat = 1; repeat <= PRIME_MAX_REPEAT; repeat++) {
+                pattern.repeat = repeat;
+                pattern.len = (lines - pattern.window + 1) * repeat *
+                              pattern.window;
+
+                if (pattern.len <= capacity) {
+                    candidates[count++] = pattern;
+                }
+            }
+        }
+    }
+
+    qsort(candidates, count, sizeof(*candidates), compare_patterns);
+
+    // Deterministic policies get no failures at all, the others the number
+    // the target allows
+    int failures = (int)((1.0 - target) * PRIME_TRIALS);
+    prime_pattern_t closest = {0};
+    int most = -1;
+    bool found = false;
+
+    for (size_t n = 0; n < count && !found; n++) {
+        size_t len = prime_pattern_build(&candidates[n], prime);
+
+        prime_resident(prime, len, assoc, resident);
+
+        // Counting stops once the candidate can neither reach the target nor
+        // beat the closest so far, so the count is exact whenever it matters
+        // and the closest is ranked over every trial
+        int allowance = PRIME_TRIALS - most - 1;
+
+        allowance = (allowance > failures) ? allowance : failures;
+
+        int evicted = prime_eviction(cache->policy, assoc,
+                                     candidates[n].lines, prime, len,
+                                     resident, allowance, seq);
+
+        if (evicted >= PRIME_TRIALS - failures) {
+            chosen = candidates[n];
+            found = true;
+        } else if (evicted > most) {
+            closest = candidates[n];
+            most = evicted;
+        }
+    }
+
+    if (!found) {
+        chosen = closest;
+    }
+
+    size_t len = prime_pattern_build(&chosen, prime);
+
+    prime_resident(prime, len, assoc, resident);
+
+    // Without the allowance, for a fair figure when nothing was good enough
+    chosen.eviction = (double)prime_eviction(cache->policy, assoc,
+                                             chosen.lines, prime, len,
+                                             resident, PRIME_TRIALS, seq) /
+                      PRIME_TRIALS;
+
+    // Reverse first, so that it wins ties as it did before there was a choice
+    for (int reverse = 1; reverse >= 0 && found; reverse--) {
+        size_t order[assoc];
+
+        for (size_t k = 0; k < assoc; k++) {
+            order[k] = resident[reverse ? assoc - 1 - k : k];
+        }
+
+        double accuracy = prime_accuracy(cache->policy, assoc, chosen.lines,
+                                         prime, len, order, seq);
+
+        if (reverse || accuracy > chosen.accuracy) {
+            chosen.probe_reverse = reverse;
+            chosen.accuracy = accuracy;
+            memcpy(probe, order, sizeof(order));
+        }
+    }
+
+    if (found) {
+        cache_set_order(cache, prime, len, probe);
+    }
+
+    if (best != NULL) {
+        *best = chosen;
+    }
+
+    free(candidates);
+    free(prime);
+    free(seq);
+
+    return found ? 0 : 1;
+}
+
+/**
+ * Returns the fewest passes in address order over the first `assoc` lines of
+ * a set that leave exactly those lines in it from every simulated starting
+ * state under `policy`, trying up to `PRIME_MAX_PASSES`. If none does, as
+ * under tree-PLRU with some associativities that are not a power of two,
+ * returns the fewest that do so most often.
+ */
+size_t prime_passes(cache_policy_t policy, size_t assoc)
+{
+    size_t prime[PRIME_MAX_PASSES * assoc];
+    size_t seq[(PRIME_SCRAMBLE + PRIME_MAX_PASSES) * assoc];
+    size_t resident[assoc];
+    size_t best = 1;
+    int most = -1;
+
+    for (size_t k = 0; k < PRIME_MAX_PASSES * assoc; k++) {
+        prime[k] = k % assoc;
+    }
+
+    for (size_t k = 0; k < assoc; k++) {
+        resident[k] = k;
+    }
+
+    for (size_t passes = 1; passes <= PRIME_MAX_PASSES; passes++) {
+        int evicted = prime_eviction(policy, assoc, assoc, prime,
+                                     passes * assoc, resident, PRIME_TRIALS,
+                                     seq);
+
+        if (evicted > most) {
+            best = passes;
+            most = evicted;
+        }
+
+        if (evicted == PRIME_TRIALS) {
+            break;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,168 @@
+#include "realtime.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "cpu.h"
+
+/// Amount of stack touched by `realtime_prefault_stack()`. Comfortably more
+/// than the calibration sample arrays and the probe loops need.
+#define PREFAULT_STACK_SIZE (256 * 1024)
+
+/**
+ * Locks all current and future pages of the process into memory.
+ */
+static int realtime_lock_memory(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        int err = errno;
+        struct rlimit limit;
+
+        getrlimit(RLIMIT_MEMLOCK, &limit);
+
+        fprintf(stderr,
+                "realtime: mlockall unavailable: %s (RLIMIT_MEMLOCK is %lu "
+                "bytes; needs CAP_IPC_LOCK or a higher limit), page faults "
+                "remain possible\n",
+                strerror(err), (unsigned long)limit.rlim_cur);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Switches the calling thread to SCHED_FIFO at the highest priority.
+ */
+static int realtime_set_fifo(void)
+{
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    if (err != 0) {
+        fprintf(stderr,
+                "realtime: SCHED_FIFO unavailable: %s (needs CAP_SYS_NICE or "
+                "RLIMIT_RTPRIO), staying on the default scheduler\n",
+                strerror(err));
+        return -1;
+    }
+
+    // RT throttling still preempts a spinning FIFO thread for the rest of
+    // every period; it is worth knowing about even though it is not an error.
+    FILE* file = fopen("/proc/sys/kernel/sched_rt_runtime_us", "r");
+    long runtime;
+
+    if (file != NULL) {
+        if (fscanf(file, "%ld", &runtime) == 1 && runtime >= 0) {
+            fprintf(stderr,
+                    "realtime: RT throttling is enabled (sched_rt_runtime_us "
+                    "= %ld), FIFO threads are still preempted each period\n",
+                    runtime);
+        }
+
+        fclose(file);
+    }
+
+    return 0;
+}
+
+/**
+ * Checks `cpuno` against the kernel's isolated and tickless CPU lists.
+ */
+static int realtime_check_isolation(int cpuno)
+{
+    const struct {
+        const char* path;
+        const char* name;
+    } lists[] = {
+        {"/sys/devices/system/cpu/isolated", "isolcpus"},
+        {"/sys/devices/system/cpu/nohz_full", "nohz_full"},
+    };
+
+    int ret = 0;
+
+    for (size_t k = 0; k < sizeof(lists) / sizeof(lists[0]); k++) {
+        cpu_set_t set;
+
+        if (cpulist_read(lists[k].path, &set) != 0) {
+            fprintf(stderr, "realtime: %s unavailable (cannot read %s)\n",
+                    lists[k].name, lists[k].path);
+            ret = -1;
+        } else if (!CPU_ISSET(cpuno, &set)) {
+            fprintf(stderr, "realtime: CPU %d is not in %s\n", cpuno,
+                    lists[k].name);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Puts the calling thread, pinned to `cpuno`, into realtime mode: all memory
+ * is locked, the thread runs under SCHED_FIFO and the CPU is checked for
+ * isolation from the scheduler and timer tick.
+ *
+ * Each step is attempted regardless of the others. Whatever is unavailable is
+ * reported on stderr and the caller is expected to carry on without it.
+ *
+ * Returns 0 if everything was in place, -1 if anything was missing.
+ */
+int realtime_enter(int cpuno)
+{
+    int ret = 0;
+
+    if (realtime_lock_memory() != 0) {
+        ret = -1;
+    }
+
+    if (realtime_set_fifo() != 0) {
+        ret = -1;
+    }
+
+    if (realtime_check_isolation(cpuno) != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/**
+ * Writes to every page in `size` bytes at `ptr` so that none of them faults
+ * later on.
+ *
+ * The contents of the buffer are clobbered.
+ */
+void realtime_prefault(void* ptr, size_t size)
+{
+    volatile uint8_t* bytes = ptr;
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    for (size_t off = 0; off < size; off += page) {
+        bytes[off] = 0;
+    }
+}
+
+/**
+ * Faults in the next `PREFAULT_STACK_SIZE` bytes of the calling thread's stack,
+ * where the sample arrays of the calibration and probe loops live.
+ */
+void realtime_prefault_stack(void)
+{
+    uint8_t stack[PREFAULT_STACK_SIZE];
+
+    realtime_prefault(stack, sizeof(stack));
+    __asm__ __volatile__("" : : "r"(stack) : "memory");
+}
@@ -0,0 +1,507 @@
+#include "sim.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sched.h>
+#include <unistd.h>
+
+
+/**
+ * One way of a simulated set
+ */
+typedef struct sim_way {
+    bool valid;
+
+    /// Address of the line held, divided by the line size
+    uintptr_t line;
+
+    /// Time of the last access, for LRU
+    uint64_t stamp;
+} sim_way_t;
+
+/**
+ * The simulated cache. There is only ever one, shared by everything in the
+ * process, just as the hardware cache is.
+ */
+static struct {
+    sim_config_t config;
+
+    size_t nsets;
+    int line_shift;
+
+    /// `nsets * assoc` ways, set by set
+    sim_way_t* ways;
+
+    /// Tree-PLRU state: one bit per node of a binary tree over the ways of
+    /// each set, `nodes` per set. A node points at the half holding the next
+    /// victim.
+    uint8_t* tree;
+    size_t nodes;
+
+    /// Number of accesses so far, for LRU stamps
+    uint64_t accesses;
+
+    uint64_t clock;
+    uint64_t rng;
+
+    /// CPU reported by timed reads
+    int cpu;
+} sim;
+
+/**
+ * xorshift64*, plenty for noise and random replacement. `*rng` is the state
+ * and must not be zero.
+ */
+uint64_t sim_random(uint64_t* rng)
+{
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+
+    return *rng * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * A single set: `assoc` ways and a PLRU tree of `2 * assoc` nodes, with the
+ * policy applied to it. The simulated cache is an array of these, and
+ * `sim_predict()` runs one on its own.
+ */
+typedef struct sim_set {
+    cache_policy_t policy;
+    size_t assoc;
+    sim_way_t* ways;
+    uint8_t* tree;
+    uint64_t* rng;
+} sim_set_t;
+
+/**
+ * Walks the PLRU tree of `set` towards `way`, flipping each node on the path to
+ * point away from it. The tree splits the ways `[lo, hi)` of each node in
+ * half, so any associativity works, not only powers of two.
+ */
+static void sim_plru_touch(sim_set_t* set, size_t way)
+{
+    size_t node = 0;
+    size_t lo = 0;
+    size_t hi = set->assoc;
+
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+
+        if (way < mid) {
+            set->tree[node] = 1;
+            node = 2 * node + 1;
+            hi = mid;
+        } else {
+            set->tree[node] = 0;
+            node = 2 * node + 2;
+            lo = mid;
+        }
+    }
+}
+
+/**
+ * Follows the PLRU tree of `set` to the way it points at.
+ */
+static size_t sim_plru_victim(sim_set_t* set)
+{
+    size_t node = 0;
+    size_t lo = 0;
+    size_t hi = set->assoc;
+
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+
+        if (set->tree[node] == 0) {
+            node = 2 * node + 1;
+            hi = mid;
+        } else {
+            node = 2 * node + 2;
+            lo = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Chooses the way of `set` to evict according to the policy. Invalid ways are
+ * always used first.
+ */
+static size_t sim_victim(sim_set_t* set)
+{
+    sim_way_t* ways = set->ways;
+    size_t victim = 0;
+
+    for (size_t way = 0; way < set->assoc; way++) {
+        if (!ways[way].valid) {
+            return way;
+        }
+    }
+
+    switch (set->policy) {
+        case CACHE_POLICY_LRU:
+            for (size_t way = 1; way < set->assoc; way++) {
+                if (ways[way].stamp < ways[victim].stamp) {
+                    victim = way;
+                }
+            }
+            break;
+        case CACHE_POLICY_PLRU:
+            victim = sim_plru_victim(set);
+            break;
+        default:
+            victim = sim_random(set->rng) % set->assoc;
+            break;
+    }
+
+    return victim;
+}
+
+/**
+ * Accesses `line` in `set`, filling it if necessary. `stamp` must increase
+ * with every access.
+ *
+ * Returns whether the access hit.
+ */
+static bool sim_set_access(sim_set_t* set, uintptr_t line, uint64_t stamp)
+{
+    sim_way_t* ways = set->ways;
+    size_t way;
+    bool hit = false;
+
+    for (way = 0; way < set->assoc; way++) {
+        if (ways[way].valid && ways[way].line == line) {
+            hit = true;
+            break;
+        }
+    }
+
+    if (!hit) {
+        way = sim_victim(set);
+        ways[way].valid = true;
+        ways[way].line = line;
+    }
+
+    ways[way].stamp = stamp;
+
+    if (set->policy == CACHE_POLICY_PLRU) {
+        sim_plru_touch(set, way);
+    }
+
+    return hit;
+}
+
+/**
+ * Invalidates `line` in `set`. Like CLFLUSH, this leaves the replacement state
+ * alone.
+ *
+ * Returns whether the line was cached.
+ */
+static bool sim_set_flush(sim_set_t* set, uintptr_t line)
+{
+    bool cached = false;
+
+    for (size_t way = 0; way < set->assoc; way++) {
+        if (set->ways[way].valid && set->ways[way].line == line) {
+            set->ways[way].valid = false;
+            cached = true;
+        }
+    }
+
+    return cached;
+}
+
+/**
+ * Returns the simulated set `ptr` maps to.
+ */
+static sim_set_t sim_set_of(uint8_t* ptr, uintptr_t* line)
+{
+    *line = (uintptr_t)ptr >> sim.line_shift;
+
+    size_t index = *line % sim.nsets;
+    sim_set_t set = {
+        .policy = sim.config.policy,
+        .assoc = sim.config.assoc,
+        .ways = &sim.ways[index * sim.config.assoc],
+        .tree = &sim.tree[index * sim.nodes],
+        .rng = &sim.rng,
+    };
+
+    return set;
+}
+
+/**
+ * Accesses the line holding `ptr`, filling it if necessary.
+ *
+ * Returns whether the access hit.
+ */
+static bool sim_access(uint8_t* ptr)
+{
+    uintptr_t line;
+    sim_set_t set = sim_set_of(ptr, &line);
+
+    return sim_set_access(&set, line, ++sim.accesses);
+}
+
+static void sim_fill(uint8_t* ptr)
+{
+    bool hit = sim_access(ptr);
+
+    sim.clock += hit ? sim.config.hit_latency : sim.config.miss_latency;
+}
+
+static void sim_flush(uint8_t* ptr)
+{
+    uintptr_t line;
+    sim_set_t set = sim_set_of(ptr, &line);
+
+    sim_set_flush(&set, line);
+
+    sim.clock += sim.config.miss_latency;
+}
+
+/**
+ * Adds the configured noise and the occasional interrupt to a latency `dur`,
+ * and lets the clock run for the result.
+ */
+static uint64_t sim_jitter(uint64_t dur, int* cpu)
+{
+    if (sim.config.noise != 0) {
+        dur += sim_random(&sim.rng) % (sim.config.noise + 1);
+    }
+
+    if (sim.config.outlier_ppm != 0 &&
+        sim_random(&sim.rng) % 1000000 < sim.config.outlier_ppm) {
+        dur += sim.config.outlier_latency;
+    }
+
+    sim.clock += dur;
+    *cpu = sim.cpu;
+
+    return dur;
+}
+
+/**
+ * Every simulated timer behaves the same. Timing nothing takes
+ * `sim.config.timer_latency`.
+ */
+static uint64_t sim_timed_read(uint8_t* ptr, cache_timer_t timer, int* cpu)
+{
+    (void)timer;
+
+    if (ptr == NULL) {
+        return sim_jitter(sim.config.timer_latency, cpu);
+    }
+
+    bool hit = sim_access(ptr);
+
+    return sim_jitter(hit ? sim.config.hit_latency : sim.config.miss_latency,
+                      cpu);
+}
+
+/**
+ * A simulated prefetch of any kind fills the line like a read and takes as
+ * long.
+ */
+static uint64_t sim_timed_prefetch(uint8_t* ptr, cache_probe_t probe, int* cpu)
+{
+    (void)probe;
+
+    return sim_timed_read(ptr, CACHE_TIMER_RDTSCP, cpu);
+}
+
+static uint64_t sim_timed_flush(uint8_t* ptr, int* cpu)
+{
+    uintptr_t line;
+    sim_set_t set = sim_set_of(ptr, &line);
+    bool cached = sim_set_flush(&set, line);
+
+    return sim_jitter(cached ? sim.config.flush_hit_latency
+                             : sim.config.flush_miss_latency,
+                      cpu);
+}
+
+static uint64_t sim_clock(void)
+{
+    sim.clock += sim.config.clock_step;
+
+    return sim.clock;
+}
+
+static void sim_geometry(size_t* size, size_t* line_size, size_t* assoc)
+{
+    *size = sim.config.size;
+    *line_size = sim.config.line_size;
+    *assoc = sim.config.assoc;
+}
+
+/// Backend running everything against the simulated cache
+static const cache_backend_t cache_backend_sim = {
+    .name = "simulator",
+    .fill = sim_fill,
+    .flush = sim_flush,
+    .timed_read = sim_timed_read,
+    .timed_flush = sim_timed_flush,
+    .timed_prefetch = sim_timed_prefetch,
+    .clock = sim_clock,
+    .geometry = sim_geometry,
+};
+
+/**
+ * Fills `config` with a simulated 32K, 8-way L1D of 64-byte lines, with LRU
+ * replacement, latencies in the range of a real L1 and a little noise. The
+ * geometry is fixed so that runs are the same on every host;
+ * `sim_host_geometry()` trades that for the host's.
+ */
+void sim_default_config(sim_config_t* config)
+{
+    memset(config, 0, sizeof(*config));
+
+    config->size = 32768;
+    config->line_size = 64;
+    config->assoc = 8;
+    config->policy = CACHE_POLICY_LRU;
+    config->timer_latency = 24;
+    config->hit_latency = 40;
+    config->miss_latency = 60;
+    config->flush_hit_latency = 46;
+    config->flush_miss_latency = 30;
+    config->noise = 8;
+    config->outlier_ppm = 100;
+    config->outlier_latency = 5000;
+    config->clock_step = 20;
+    config->seed = 1;
+}
+
+/**
+ * Gives the cache described by `config` the geometry of the L1D of the host.
+ */
+void sim_host_geometry(sim_config_t* config)
+{
+    config->size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    config->line_size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    config->assoc = sysconf(_SC_LEVEL1_DCACHE_ASSOC);
+}
+
+/**
+ * Creates the simulated cache described by `config` and makes it the backend
+ * of every cache primitive. The simulator never dereferences the pointers it
+ * is given; only the addresses matter.
+ *
+ * Returns -1 if the geometry is unusable or memory runs out.
+ */
+int sim_init(const sim_config_t* config)
+{
+    if (config->line_size == 0 || config->assoc == 0 ||
+        config->size < config->line_size * config->assoc) {
+        return -1;
+    }
+
+    memset(&sim, 0, sizeof(sim));
+
+    sim.config = *config;
+    sim.nsets = config->size / (config->line_size * config->assoc);
+    sim.line_shift = dlog2(config->line_size);
+    sim.nodes = 2 * config->assoc;
+    sim.cpu = sched_getcpu();
+
+    sim.ways = calloc(sim.nsets * config->assoc, sizeof(*sim.ways));
+    sim.tree = calloc(sim.nsets * sim.nodes, sizeof(*sim.tree));
+
+    if (sim.ways == NULL || sim.tree == NULL) {
+        sim_deinit();
+        return -1;
+    }
+
+    sim_reset();
+
+    cache_backend = &cache_backend_sim;
+
+    return 0;
+}
+
+/**
+ * Empties the simulated cache and rewinds the clock and the random number
+ * generator, so that what follows is a repeat of a run from `sim_init()`.
+ */
+void sim_reset(void)
+{
+    memset(sim.ways, 0, sim.nsets * sim.config.assoc * sizeof(*sim.ways));
+    memset(sim.tree, 0, sim.nsets * sim.nodes);
+
+    sim.accesses = 0;
+    sim.clock = 0;
+
+    // xorshift gets stuck at zero
+    sim.rng = sim.config.seed != 0 ? sim.config.seed : 1;
+}
+
+/**
+ * Frees the simulated cache and puts the hardware backend back.
+ */
+void sim_deinit(void)
+{
+    free(sim.ways);
+    free(sim.tree);
+
+    sim.ways = NULL;
+    sim.tree = NULL;
+
+    cache_backend = &cache_backend_hw;
+}
+
+/**
+ * Runs `len` entries of `seq` against a single empty set of `assoc` ways under
+ * `policy`, and reports in `present` which of the lines `0..nlines-1` are
+ * cached at the end. Entries are line numbers to access, or line numbers
+ * combined with `SIM_FLUSH` to flush. Unless `hits` is NULL, it receives
+ * whether each of the `len` entries hit; flushes count as misses.
+ *
+ * This stands alone from the simulated cache and may be used with the
+ * hardware backend in place. `seed` drives random replacement.
+ */
+void sim_predict(cache_policy_t policy, size_t assoc, const size_t* seq,
+                 size_t len, uint64_t seed, bool* present, size_t nlines,
+                 bool* hits)
+{
+    sim_way_t ways[assoc];
+    uint8_t tree[2 * assoc];
+    uint64_t rng = seed != 0 ? seed : 1;
+    sim_set_t set = {
+        .policy = policy,
+        .assoc = assoc,
+        .ways = ways,
+        .tree = tree,
+        .rng = &rng,
+    };
+
+    memset(ways, 0, sizeof(ways));
+    memset(tree, 0, sizeof(tree));
+
+    for (size_t k = 0; k < len; k++) {
+        bool hit = false;
+
+        if (seq[k] & SIM_FLUSH) {
+            sim_set_flush(&set, seq[k] & ~SIM_FLUSH);
+        } else {
+            hit = sim_set_access(&set, seq[k], k + 1);
+        }
+
+        if (hits != NULL) {
+            hits[k] = hit;
+        }
+    }
+
+    for (size_t line = 0; line < nlines; line++) {
+        present[line] = false;
+
+        for (size_t way = 0; way < assoc; way++) {
+            if (ways[way].valid && ways[way].line == line) {
+                present[line] = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,267 @@
+#include "timer.h"
+
+#include <cpuid.h>
+#include <string.h>
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Defines `timer_<name>()`, which times `body` between two RDTSCPs. This is
+ * the original kernel of `timed_read()`: it does not have to be accurate. In
+ * fact, the two requirements are for it to be precise (that is, low
+ * deviation) and for the difference between an L1 cache hit and all other
+ * access scenarios to show.
+ *
+ * Both RDTSCPs also load TSC_AUX into ECX, which Linux sets to the number of
+ * the CPU executing it. The CPU the body was timed on is stored in `*cpu`, or
+ * `CPU_MIGRATED` if the thread moved between the two timestamps, in which case
+ * the latency is meaningless.
+ */
+#define TIMER_RDTSCP(name, body)                                             \
+    static uint64_t timer_##name(uint8_t* ptr, uint32_t counter, int* cpu)   \
+    {                                                                        \
+        uint64_t t0[2];                                                      \
+        uint64_t t1[2];                                                      \
+        uint32_t aux0;                                                       \
+        uint32_t aux1;                                                       \
+                                                                             \
+        (void)counter;                                                       \
+                                                                             \
+        __asm__ __volatile__(                                                \
+            "rdtscp\n"                                                       \
+            "lfence\n"                                                       \
+            "mov %%rax, %[t0_0]\n"                                           \
+            "mov %%rdx, %[t0_1]\n"                                           \
+            "mov %%ecx, %[aux0]\n" body                                      \
+            "rdtscp\n"                                                       \
+            "lfence\n"                                                       \
+            "mov %%rax, %[t1_0]\n"                                           \
+            "mov %%rdx, %[t1_1]\n"                                           \
+            : [t0_0] "=&r"(t0[0]), [t0_1] "=&r"(t0[1]), [aux0] "=&r"(aux0),  \
+              [t1_0] "=g"(t1[0]), [t1_1] "=g"(t1[1]), [aux1] "=c"(aux1)      \
+            : [ptr] "r"(ptr)                                                 \
+            : "rax", "rdx", "rbx");                                          \
+                                                                             \
+        *cpu = (aux0 == aux1) ? (int)(aux1 & TSC_AUX_CPU_MASK)               \
+                              : CPU_MIGRATED;                                \
+                                                                             \
+        return (t1[0] | (t1[1] << 32)) - (t0[0] | (t0[1] << 32));            \
+    }
+
+/**
+ * Defines `timer_<name>()`, which times `body` between the counter values
+ * `start` and `stop` leave in EDX:EAX. ECX holds `counter` for RDPMC and may
+ * be overwritten; RBX is free for CPUID.
+ *
+ * None of these read TSC_AUX at both ends, so `*cpu` is always set to
+ * `CPU_UNKNOWN`: a migration goes unnoticed, which is safe enough for a pinned
+ * thread.
+ */
+#define TIMER_KERNEL(name, start, body, stop)                                \
+    static uint64_t timer_##name(uint8_t* ptr, uint32_t counter, int* cpu)   \
+    {                                                                        \
+        uint64_t t0;                                                         \
+        uint64_t t1;                                                         \
+                                                                             \
+        __asm__ __volatile__(start                                           \
+                             "shl $32, %%rdx\n"                              \
+                             "or %%rdx, %%rax\n"                             \
+                             "mov %%rax, %[t0]\n" body stop                  \
+                             "shl $32, %%rdx\n"                              \
+                             "or %%rdx, %%rax\n"                             \
+                             "mov %%rax, %[t1]\n"                            \
+                             : [t0] "=&r"(t0), [t1] "=r"(t1), "+c"(counter)  \
+                             : [ptr] "r"(ptr)                                \
+                             : "rax", "rbx", "rdx", "memory");               \
+                                                                             \
+        *cpu = CPU_UNKNOWN;                                                  \
+                                                                             \
+        return t1 - t0;                                                      \
+    }
+
+/// RDTSCP support in EDX of CPUID leaf 0x80000001, which older `cpuid.h`
+/// do not name
+#define TIMER_CPUID_RDTSCP (1U << 27)
+
+/// What every kernel times: a one byte load, or nothing at all
+#define TIMER_LOAD "mov (%[ptr]), %%al\n"
+#define TIMER_EMPTY ""
+
+/// LFENCE before RDTSC waits for earlier instructions to complete, and after
+/// it keeps later ones from starting early; Intel's recommended pairing
+#define LFENCE_START "lfence\nrdtsc\nlfence\n"
+#define LFENCE_STOP "lfence\nrdtsc\n"
+
+/// MFENCE also drains the store buffer, and is what orders RDTSC on AMD parts
+/// where LFENCE is not dispatch serialising
+#define MFENCE_START "mfence\nrdtsc\nmfence\n"
+#define MFENCE_STOP "mfence\nrdtsc\n"
+
+/// CPUID fully serialises before the first timestamp, but takes too long and
+/// varies too much to sit inside the measurement, so RDTSCP ends it instead
+#define CPUID_START "xor %%eax, %%eax\ncpuid\nrdtsc\n"
+#define CPUID_STOP "rdtscp\nlfence\n"
+
+/// Core cycles rather than TSC ticks, so that the gap does not shrink when the
+/// core runs above the nominal frequency
+#define RDPMC_START "lfence\nrdpmc\nlfence\n"
+#define RDPMC_STOP "lfence\nrdpmc\n"
+
+TIMER_RDTSCP(rdtscp_read, TIMER_LOAD)
+TIMER_RDTSCP(rdtscp_empty, TIMER_EMPTY)
+TIMER_KERNEL(lfence_read, LFENCE_START, TIMER_LOAD, LFENCE_STOP)
+TIMER_KERNEL(lfence_empty, LFENCE_START, TIMER_EMPTY, LFENCE_STOP)
+TIMER_KERNEL(mfence_read, MFENCE_START, TIMER_LOAD, MFENCE_STOP)
+TIMER_KERNEL(mfence_empty, MFENCE_START, TIMER_EMPTY, MFENCE_STOP)
+TIMER_KERNEL(cpuid_read, CPUID_START, TIMER_LOAD, CPUID_STOP)
+TIMER_KERNEL(cpuid_empty, CPUID_START, TIMER_EMPTY, CPUID_STOP)
+TIMER_KERNEL(rdpmc_read, RDPMC_START, TIMER_LOAD, RDPMC_STOP)
+TIMER_KERNEL(rdpmc_empty, RDPMC_START, TIMER_EMPTY, RDPMC_STOP)
+
+typedef uint64_t (*timer_kernel_t)(uint8_t* ptr, uint32_t counter, int* cpu);
+
+/// Kernels of each timer that time a load, and that time nothing
+static const timer_kernel_t timer_kernels[CACHE_NTIMERS][2] = {
+    [CACHE_TIMER_RDTSCP] = {timer_rdtscp_read, timer_rdtscp_empty},
+    [CACHE_TIMER_LFENCE] = {timer_lfence_read, timer_lfence_empty},
+    [CACHE_TIMER_MFENCE] = {timer_mfence_read, timer_mfence_empty},
+    [CACHE_TIMER_CPUID] = {timer_cpuid_read, timer_cpuid_empty},
+    [CACHE_TIMER_RDPMC] = {timer_rdpmc_read, timer_rdpmc_empty},
+};
+
+/// The cycle counter RDPMC reads is opened per thread, since perf counts for
+/// the thread that opened it, and is kept until `timer_release()`.
+static _Thread_local bool timer_pmc_opened;
+static _Thread_local struct perf_event_mmap_page* timer_pmc_page;
+
+/**
+ * Returns the index of the counter RDPMC should read plus one, or zero if the
+ * counter cannot be read right now. The kernel may move the event to another
+ * counter at any time, so this is read afresh for each measurement.
+ */
+static uint32_t timer_pmc_index(void)
+{
+    return *(volatile uint32_t*)&timer_pmc_page->index;
+}
+
+/**
+ * Opens a cycle counter for the calling thread and maps the page through
+ * which the kernel says whether, and at which index, RDPMC may read it.
+ *
+ * Returns whether that worked; only the first call tries.
+ */
+static bool timer_pmc_open(void)
+{
+    if (timer_pmc_opened) {
+        return timer_pmc_page != NULL;
+    }
+
+    timer_pmc_opened = true;
+
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    void* page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd,
+                      0);
+
+    // The mapping keeps the event alive
+    close(fd);
+
+    if (page == MAP_FAILED) {
+        return false;
+    }
+
+    timer_pmc_page = page;
+
+    if (!timer_pmc_page->cap_user_rdpmc || timer_pmc_index() == 0) {
+        munmap(page, sysconf(_SC_PAGESIZE));
+        timer_pmc_page = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Unmaps the cycle counter of the calling thread, which closes it, so that a
+ * thread that has used RDPMC does not leave it behind when it exits. The next
+ * RDPMC read of the thread opens it again.
+ */
+void timer_release(void)
+{
+    if (timer_pmc_page != NULL) {
+        munmap(timer_pmc_page, sysconf(_SC_PAGESIZE));
+        timer_pmc_page = NULL;
+    }
+
+    timer_pmc_opened = false;
+}
+
+/**
+ * Returns whether `timer` works on this CPU and for this thread. RDPMC needs
+ * a cycle counter perf lets user space read, which virtual machines and
+ * `perf_event_paranoid` often rule out.
+ */
+bool timer_available(cache_timer_t timer)
+{
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+
+    switch (timer) {
+        case CACHE_TIMER_RDTSCP:
+        case CACHE_TIMER_CPUID:
+            return __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) &&
+                   (edx & TIMER_CPUID_RDTSCP);
+        case CACHE_TIMER_RDPMC:
+            return timer_pmc_open();
+        default:
+            return true;
+    }
+}
+
+/**
+ * Times a read of the byte at `ptr` with the kernel of `timer`, or nothing at
+ * all if `ptr` is NULL, which is the overhead of the timer itself.
+ *
+ * `*cpu` is set as described at `TIMER_RDTSCP()` and `TIMER_KERNEL()`, or to
+ * `CPU_MIGRATED` if the cycle counter is not currently readable.
+ */
+uint64_t timer_read(cache_timer_t timer, uint8_t* ptr, int* cpu)
+{
+    timer_kernel_t kernel = timer_kernels[timer][ptr == NULL];
+    uint32_t counter = 0;
+
+    if (timer == CACHE_TIMER_RDPMC) {
+        uint32_t index = timer_pmc_open() ? timer_pmc_index() : 0;
+
+        if (index == 0) {
+            *cpu = CPU_MIGRATED;
+            return 0;
+        }
+
+        counter = index - 1;
+
+        uint64_t mask = ~0ULL >> (64 - timer_pmc_page->pmc_width);
+
+        return kernel(ptr, counter, cpu) & mask;
+    }
+
+    return kernel(ptr, counter, cpu);
+}
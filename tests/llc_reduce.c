@@ -0,0 +1,138 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sched.h>
+
+#include "cache.h"
+#include "cpu.h"
+#include "llc.h"
+#include "sim.h"
+
+/// Ways and sets of the simulated LLC. Lines at the start of a page fall into
+/// `TEST_CLASSES` of its sets by their page number.
+#define TEST_ASSOC 8
+#define TEST_SETS 256
+#define TEST_LINE 64
+#define TEST_PAGE 4096
+#define TEST_CLASSES (TEST_SETS * TEST_LINE / TEST_PAGE)
+
+/// Candidates per class, of which `llc_reduce()` has to keep `TEST_ASSOC`
+#define TEST_PER_CLASS (4 * TEST_ASSOC)
+#define TEST_CANDIDATES (TEST_CLASSES * TEST_PER_CLASS)
+
+/// Seeds of the simulated noise, each a run of its own
+#define TEST_SEEDS 5
+
+/**
+ * Reduces the candidates of one run, shuffled by `seed`, against the
+ * simulator standing in for an LLC with LRU replacement, and checks that
+ * exactly `TEST_ASSOC` lines are left, all of them in the victim's set.
+ *
+ * Returns -1 on failure.
+ */
+static int test_reduce(uint8_t* pages, uint64_t seed)
+{
+    sim_config_t config;
+    cache_t cache;
+    llc_t llc;
+    llc_evset_t evset;
+    uint8_t* cand[TEST_CANDIDATES];
+    uint8_t* scratch[TEST_CANDIDATES];
+    size_t n = TEST_CANDIDATES;
+    uint64_t rng = seed;
+    int ret = 0;
+
+    sim_default_config(&config);
+    config.size = TEST_SETS * TEST_ASSOC * TEST_LINE;
+    config.line_size = TEST_LINE;
+    config.assoc = TEST_ASSOC;
+    config.policy = CACHE_POLICY_LRU;
+    config.seed = seed;
+
+    if (sim_init(&config) != 0 || llc_evset_init(&evset, TEST_ASSOC) != 0) {
+        sim_deinit();
+        return -1;
+    }
+
+    // The timed reads only need the CPU, probe and timer of a cache
+    memset(&cache, 0, sizeof(cache));
+    cache.cpu = sched_getcpu();
+    cache.probe = CACHE_PROBE_LOAD;
+    cache.timer = CACHE_TIMER_RDTSCP;
+
+    memset(&llc, 0, sizeof(llc));
+    llc.cache = &cache;
+    llc.assoc = TEST_ASSOC;
+    llc.line_size = TEST_LINE;
+    llc.page_size = TEST_PAGE;
+    llc.hit_threshold = (config.hit_latency + config.miss_latency) / 2;
+    llc.outlier_threshold = config.outlier_latency;
+
+    // Page 0 is the victim, and the candidates follow it in shuffled order
+    for (size_t k = 0; k < n; k++) {
+        cand[k] = pages + (k + 1) * TEST_PAGE;
+    }
+
+    for (size_t k = n - 1; k > 0; k--) {
+        size_t j = sim_random(&rng) % (k + 1);
+        uint8_t* line = cand[k];
+
+        cand[k] = cand[j];
+        cand[j] = line;
+    }
+
+    llc_reduce(&llc, &evset, pages, cand, &n, scratch);
+
+    for (size_t k = 0; k < n; k++) {
+        if ((size_t)(cand[k] - pages) / TEST_PAGE % TEST_CLASSES != 0) {
+            ret = -1;
+        }
+    }
+
+    if (n != TEST_ASSOC) {
+        ret = -1;
+    }
+
+    printf("Seed %lu: %zu of %d lines kept in %lu tests, %s\n", seed, n,
+           TEST_CANDIDATES, evset.tests, ret == 0 ? "ok" : "FAILED");
+
+    llc_evset_deinit(&evset);
+    sim_deinit();
+
+    return ret;
+}
+
+/**
+ * Drives `llc_reduce()` with the simulator in place of the LLC, which the
+ * hardware backend can only be tested against on a host that has one to
+ * measure.
+ */
+int main(void)
+{
+    // Never read or written; the simulator only looks at the addresses
+    uint8_t* pages = aligned_alloc(TEST_PAGE,
+                                   (TEST_CANDIDATES + 1) * TEST_PAGE);
+    int failed = 0;
+
+    if (pages == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // The simulated timer reports the CPU the simulator was created on
+    if (pin_current_thread(sched_getcpu()) != 0) {
+        fprintf(stderr, "Failed to pin\n");
+        free(pages);
+        return 1;
+    }
+
+    for (uint64_t seed = 1; seed <= TEST_SEEDS; seed++) {
+        failed += (test_reduce(pages, seed) != 0);
+    }
+
+    free(pages);
+
+    return failed != 0;
+}
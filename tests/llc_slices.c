@@ -0,0 +1,159 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "llc.h"
+#include "sim.h"
+
+/// Page size and the byte within each page the lines sit at
+#define TEST_PAGE 4096
+#define TEST_OFFSET 0x5c0
+
+/// Pages of the synthetic buffer, each with a frame of its own
+#define TEST_PAGES 512
+
+/// Physical address bits, enough for every bit the Intel masks use
+#define TEST_PHYS_BITS 38
+
+/// Addresses the recovered hash is checked against, none of them fitted
+#define TEST_HELD_OUT 4096
+
+/// Seeds of the synthetic frames, each a run of its own
+#define TEST_SEEDS 5
+
+/**
+ * Returns the slice the Intel hash of `nbits` masks puts `paddr` in.
+ */
+static int test_intel_slice(uint64_t paddr, int nbits)
+{
+    int slice = 0;
+
+    for (int k = 0; k < nbits; k++) {
+        slice |= __builtin_parityll(paddr & llc_intel_slice_masks[k]) << k;
+    }
+
+    return slice;
+}
+
+/**
+ * Returns a random physical address at `TEST_OFFSET` within its page whose
+ * set index is the same as that of every other one drawn, as for the lines
+ * `llc_recover_slices()` sorts.
+ */
+static uint64_t test_paddr(const llc_t* llc, uint64_t* rng)
+{
+    uint64_t set_bits = (uint64_t)llc->slice_sets * llc->line_size - 1;
+    uint64_t paddr = sim_random(rng) & (((uint64_t)1 << TEST_PHYS_BITS) - 1);
+
+    return (paddr & ~set_bits & ~(uint64_t)(TEST_PAGE - 1)) | TEST_OFFSET;
+}
+
+/**
+ * Sorts the lines of a synthetic buffer into slices by the Intel hash of
+ * `nbits` masks, or by an arbitrary slice per page if `linear` is clear, and
+ * fits a hash to them with `llc_fit_slices()`. A linear hash has to be found
+ * again, up to how its slices are numbered: it must sort `TEST_HELD_OUT`
+ * other addresses as the Intel hash does. Any other has to be rejected.
+ *
+ * Returns -1 on failure.
+ */
+static int test_fit(uint64_t seed, int nbits, bool linear)
+{
+    size_t nslices = (size_t)1 << nbits;
+    uint64_t phys[TEST_PAGES];
+    uint8_t* lines[TEST_PAGES];
+    int slice[TEST_PAGES];
+    uint8_t* reps[1 << LLC_MAX_SLICE_BITS] = {0};
+    uint64_t masks[LLC_MAX_SLICE_BITS];
+    int renamed[1 << LLC_MAX_SLICE_BITS];
+    uint64_t rng = seed;
+    llc_t llc;
+    int fitted;
+    int ret = 0;
+
+    memset(&llc, 0, sizeof(llc));
+    llc.line_size = 64;
+    llc.page_size = TEST_PAGE;
+    llc.slice_sets = 2048;
+    llc.nslices = nslices;
+    llc.phys = phys;
+
+    // Never read or written; only the offsets of the lines into it matter
+    llc.buffer = aligned_alloc(TEST_PAGE, (size_t)TEST_PAGES * TEST_PAGE);
+
+    if (llc.buffer == NULL) {
+        return -1;
+    }
+
+    for (size_t page = 0; page < TEST_PAGES; page++) {
+        phys[page] = test_paddr(&llc, &rng) & ~(uint64_t)(TEST_PAGE - 1);
+        lines[page] = llc.buffer + page * TEST_PAGE + TEST_OFFSET;
+        slice[page] = linear ? test_intel_slice(phys[page] | TEST_OFFSET,
+                                                nbits)
+                             : (int)(sim_random(&rng) % nslices);
+
+        if (reps[slice[page]] == NULL) {
+            reps[slice[page]] = lines[page];
+        }
+    }
+
+    for (size_t c = 0; c < nslices; c++) {
+        if (reps[c] == NULL) {
+            free(llc.buffer);
+            return -1;
+        }
+    }
+
+    bool fit = llc_fit_slices(&llc, lines, TEST_PAGES, slice, reps, nslices,
+                              masks, &fitted);
+
+    if (!linear) {
+        ret = fit ? -1 : 0;
+    } else if (!fit || fitted != nbits) {
+        ret = -1;
+    } else {
+        llc.slice_bits = fitted;
+        memcpy(llc.slice_masks, masks, fitted * sizeof(*masks));
+        memset(renamed, -1, sizeof(renamed));
+
+        // Each recovered slice must stand for one and the same Intel slice
+        for (int k = 0; k < TEST_HELD_OUT && ret == 0; k++) {
+            uint64_t paddr = test_paddr(&llc, &rng);
+            int found = llc_slice_of(&llc, paddr);
+            int want = test_intel_slice(paddr, nbits);
+
+            if (renamed[found] < 0) {
+                renamed[found] = want;
+            }
+
+            ret = (renamed[found] == want) ? 0 : -1;
+        }
+    }
+
+    printf("Seed %lu, %zu slices, %s: %s\n", seed, nslices,
+           linear ? "Intel hash" : "no hash", ret == 0 ? "ok" : "FAILED");
+
+    free(llc.buffer);
+
+    return ret;
+}
+
+/**
+ * Drives `llc_fit_slices()` with synthetic physical addresses sorted by the
+ * known Intel slice hash, which needs neither root nor an LLC to measure.
+ */
+int main(void)
+{
+    int failed = 0;
+
+    for (uint64_t seed = 1; seed <= TEST_SEEDS; seed++) {
+        for (int nbits = 1; nbits <= LLC_INTEL_SLICE_MASKS; nbits++) {
+            failed += (test_fit(seed, nbits, true) != 0);
+        }
+
+        failed += (test_fit(seed, LLC_INTEL_SLICE_MASKS, false) != 0);
+    }
+
+    return failed != 0;
+}